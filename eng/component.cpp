@@ -72,6 +72,13 @@ utl::Polytope3F CameraCmp::GetFrustum(glm::vec2 viewportSize) const
     return frustum;
 }
 
+RenderingCmp::~RenderingCmp()
+{
+    // the scene may already be gone when the world is destroyed with the system
+    if (_objParamsSlot != ~0u && Sys::Get() && Sys::Get()->_scene)
+        Sys::Get()->_scene->FreeObjParamsSlot(_objParamsSlot);
+}
+
 void RenderingCmp::UpdateObjectBoundFromModels()
 {
     utl::BoxF box;
@@ -88,19 +95,16 @@ bool RenderingCmp::UpdateObjParams(RenderObjectsData &renderData)
     if (!_parent->IsTransformDirty() || _models.empty())
         return true;
 
-    if (!_objParams) {
-        _objParams = Scene::CreateResourseSetWithBuffer(_models[0]._pipeline.get(), 0, "ModelData");
-    }
-
-    auto uploadPass = Scene::UpdateResourceSetBuffer(_objParams.get(), "ModelData", [this](utl::AnyRef params) {
+    Scene *scene = renderData._scene;
+    ASSERT(_objParamsSlot != ~0u);
+    bool res = Scene::UpdateResourceSetBuffer(scene->_objParams.get(), "ModelData", [this](utl::AnyRef params) {
         *params.GetMember("world").Get<glm::mat4>() = _parent->GetTransform().GetMatrix();
         return true;
-    });
+    }, scene->GetObjParamsOffset(_objParamsSlot));
 
     _parent->SetTransformDirty(false);
-    renderData._updatePasses.push_back(std::move(uploadPass));
 
-    return true;
+    return res;
 }
 
 }
\ No newline at end of file
@@ -25,10 +25,13 @@ struct CameraCmp : public Component {
 struct RenderObjectsData;
 struct RenderingCmp : public Component {
 
+	~RenderingCmp() override;
+
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<RenderingCmp>(); }
 
 	std::vector<Model> _models;
-	std::shared_ptr<rhi::ResourceSet> _objParams;
+	// slot of the object's parameters in the scene's shared buffer
+	uint32_t _objParamsSlot = ~0u;
 
 	void UpdateObjectBoundFromModels();
 	bool UpdateObjParams(RenderObjectsData &renderData);
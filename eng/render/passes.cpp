@@ -1,7 +1,141 @@
 #include "passes.h"
+#include "rhi/rhi.h"
+#include "rhi/pass.h"
+#include "rhi/pipeline.h"
+#include "rhi/resource.h"
 
 namespace eng {
 
+bool MipGenerator::Init(rhi::Rhi *rhi)
+{
+	_rhi = rhi;
 
+	auto downsample = _rhi->GetShader("data/downsample.comp", rhi::ShaderKind::Compute);
+	if (!downsample)
+		return false;
+	_pipeline = _rhi->GetPipeline(rhi::PipelineData{ ._shaders = { downsample } });
+	if (!_pipeline)
+		return false;
+
+	_sampler = _rhi->New<rhi::Sampler>("MipGenerator", rhi::SamplerDescriptor{
+		._minFilter = rhi::Filter::Nearest,
+		._magFilter = rhi::Filter::Nearest,
+		._mipMapMode = rhi::MipMapMode::Nearest,
+		._addressModes = { rhi::AddressMode::ClampToEdge, rhi::AddressMode::ClampToEdge, rhi::AddressMode::ClampToEdge },
+	});
+	if (!_sampler)
+		return false;
+
+	// counts the workgroups that finished, the last one to finish resets it for the next dispatch
+	_counter = _rhi->New<rhi::Buffer>("MipGenCounter", rhi::ResourceDescriptor{
+		._usage{.uav = 1, .copyDst = 1},
+		._dimensions{ (int32_t)sizeof(uint32_t), 0, 0, 0 },
+	});
+	if (!_counter)
+		return false;
+	auto clearPass = _rhi->Create<rhi::CopyPass>("MipGenCounterClear");
+	if (!clearPass->Fill({ _counter }, 0))
+		return false;
+	auto sub = _rhi->Submit({ clearPass }, "MipGenCounterClear");
+	return sub->Prepare() && sub->Execute();
+}
+
+bool MipGenerator::IsFormatSupported(rhi::Format fmt)
+{
+	return rhi::GetLinearFormat(fmt) == rhi::Format::R8G8B8A8;
+}
+
+bool MipGenerator::IsSupported(rhi::Texture const *tex)
+{
+	rhi::ResourceDescriptor const &desc = tex->_descriptor;
+	if (!desc._usage.srv || !desc._usage.uav || !IsFormatSupported(desc._format))
+		return false;
+	return desc._dimensions.y > 0 && desc._dimensions.z == 0 && desc._dimensions.w == 0;
+}
+
+bool MipGenerator::GenerateMips(std::shared_ptr<rhi::Texture> const &tex, std::vector<std::shared_ptr<rhi::Pass>> &passes, Filter filter)
+{
+	rhi::ResourceDescriptor const &desc = tex->_descriptor;
+	if (desc._mipLevels <= 1)
+		return true;
+
+	if (!IsSupported(tex.get())) {
+		auto blitPass = _rhi->Create<rhi::CopyPass>(tex->_name + "MipGen");
+		if (!blitPass->CopyTopToLowerMips(tex))
+			return false;
+		passes.push_back(std::move(blitPass));
+		return true;
+	}
+
+	rhi::ShaderParam const *paramsDesc = _pipeline->_pipelineData.GetShader(rhi::ShaderKind::Compute)->GetParam(rhi::ShaderParam::PushConstants);
+	ASSERT(paramsDesc);
+	glm::vec2 kaiserWeights = GetKaiserWeights(_kaiserAlpha);
+
+	for (int8_t srcMip = 0; srcMip < desc._mipLevels - 1; ) {
+		glm::ivec2 srcSize(desc.GetMipDims(srcMip));
+		// the last workgroup reduces at most a tile of the 6th mip further
+		int8_t maxMips = all(lessThanEqual(srcSize, glm::ivec2(TileSize * TileSize))) ? MaxMipsPerPass : MaxMipsPerPass / 2;
+		int8_t numMips = std::min<int8_t>(desc._mipLevels - 1 - srcMip, maxMips);
+		glm::ivec2 numGroups = (srcSize + TileSize - 1) / TileSize;
+
+		std::vector<rhi::ResourceRef> refs;
+		refs.push_back({ tex, rhi::ResourceView::FromDescriptor(desc, srcMip, 1) });
+		refs.push_back({ _sampler });
+		for (int8_t m = 0; m < MaxMipsPerPass; ++m) {
+			// the entries past the pass's mips are never written, they repeat its last mip to keep the set valid
+			rhi::ResourceView mipView = rhi::ResourceView::FromDescriptor(desc, srcMip + 1 + std::min<int8_t>(m, numMips - 1), 1);
+			mipView._format = rhi::GetLinearFormat(desc._format);
+			refs.push_back({ tex, mipView });
+		}
+		refs.push_back({ _counter });
+
+		auto resSet = _pipeline->AllocResourceSet(0);
+		ASSERT(refs.size() == resSet->GetSetDescription()->GetNumEntries());
+		if (!resSet->Update(refs))
+			return false;
+
+		std::vector<uint8_t> pushConstants(paramsDesc->_type->_size);
+		utl::AnyRef params{ paramsDesc->_type, pushConstants.data() };
+		*params.GetMember("srcSize").Get<glm::ivec2>() = srcSize;
+		*params.GetMember("numMips").Get<int32_t>() = numMips;
+		*params.GetMember("numWorkGroups").Get<uint32_t>() = numGroups.x * numGroups.y;
+		*params.GetMember("filterKind").Get<int32_t>() = (int32_t)filter;
+		*params.GetMember("srgb").Get<int32_t>() = rhi::IsSrgb(desc._format);
+		*params.GetMember("kaiserWeights").Get<glm::vec2>() = kaiserWeights;
+
+		auto pass = _rhi->Create<rhi::ComputePass>(tex->_name + "MipGen");
+		std::shared_ptr<rhi::ResourceSet> sets[] = { resSet };
+		if (!pass->Init(_pipeline.get(), sets, glm::ivec3(numGroups, 1), {}, pushConstants))
+			return false;
+		passes.push_back(std::move(pass));
+
+		srcMip += numMips;
+	}
+
+	return true;
+}
+
+// Modified Bessel function of the first kind of order 0, summed from its power series
+static float BesselI0(float x)
+{
+	float sum = 1, term = 1;
+	for (int32_t k = 1; k < 32; ++k) {
+		term *= x * x / (4.0f * k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+glm::vec2 MipGenerator::GetKaiserWeights(float alpha)
+{
+	// the taps are 0.5 and 1.5 source texels away from the center of the reduced texel, the window spans 2
+	auto getTap = [alpha](float x) {
+		float sincArg = glm::pi<float>() * x / 2;
+		float window = BesselI0(alpha * std::sqrt(1 - x * x / 4)) / BesselI0(alpha);
+		return std::sin(sincArg) / sincArg * window;
+	};
+	glm::vec2 weights{ getTap(1.5f), getTap(0.5f) };
+	return weights / (2 * (weights.x + weights.y));
+}
 
 }
\ No newline at end of file
@@ -1,6 +1,49 @@
 #pragma once
 
+#include "rhi/base.h"
+
+namespace rhi {
+struct Rhi;
+struct Buffer;
+struct Pass;
+struct Pipeline;
+struct Sampler;
+struct Texture;
+}
+
 namespace eng {
 
+// Generates mip chains with a compute shader that writes up to 12 mips in a single dispatch
+// Textures the shader can't write fall back to a chain of blits
+struct MipGenerator {
+	enum class Filter : int8_t {
+		Box,
+		// wider footprint for sharper mips, used where the neighbours of a texel are visible to the dispatch
+		Kaiser,
+	};
+
+	static constexpr int8_t MaxMipsPerPass = 12;
+	// source texels each workgroup reduces along an axis
+	static constexpr int32_t TileSize = 64;
+
+	bool Init(rhi::Rhi *rhi);
+
+	// Compute needs 2d textures with srv and uav usage, in a format the shader writes as rgba8
+	static bool IsFormatSupported(rhi::Format fmt);
+	static bool IsSupported(rhi::Texture const *tex);
+
+	// Appends the passes generating the mips below the top one, srgb textures are averaged in linear space
+	bool GenerateMips(std::shared_ptr<rhi::Texture> const &tex, std::vector<std::shared_ptr<rhi::Pass>> &passes, Filter filter = Filter::Box);
+
+	// Weights of the outer and inner taps of a 4 tap sinc filter windowed with a Kaiser window, normalized
+	static glm::vec2 GetKaiserWeights(float alpha);
+
+	rhi::Rhi *_rhi = nullptr;
+	std::shared_ptr<rhi::Pipeline> _pipeline;
+	std::shared_ptr<rhi::Sampler> _sampler;
+	// shared by all the dispatches, which are ordered by its barriers
+	std::shared_ptr<rhi::Buffer> _counter;
+	float _kaiserAlpha = 4;
+};
 
 }
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "residency.h"
+#include "texture_loader.h"
+#include "utl/mathutl.h"
+
+namespace eng {
+
+bool ResidencyManager::Init(rhi::Rhi *rhi, TextureLoader *loader)
+{
+	_rhi = rhi;
+	_loader = loader;
+	return true;
+}
+
+std::shared_ptr<ResidencyManager::Entry> ResidencyManager::Manage(std::string path, bool genMips, std::shared_ptr<rhi::Texture> texture, OnReplacedFn onReplaced)
+{
+	ASSERT(texture->_descriptor._usage.copySrc);
+	auto entry = std::make_shared<Entry>();
+	entry->_path = std::move(path);
+	entry->_genMips = genMips;
+	entry->_texture = std::move(texture);
+	entry->_onReplaced = std::move(onReplaced);
+	_entries.push_back(entry);
+	return entry;
+}
+
+void ResidencyManager::Release(Entry *entry)
+{
+	std::erase_if(_entries, [&](std::shared_ptr<Entry> const &e) { return e.get() == entry; });
+}
+
+bool ResidencyManager::Update()
+{
+	rhi::Rhi::MemoryBudget memBudget = _rhi->GetMemoryBudget();
+	_stats._lastBudget = memBudget;
+
+	// replaced textures are counted as freed already, so they don't get dropped for again
+	uint64_t pendingSize = 0;
+	std::erase_if(_pendingReleases, [&](PendingRelease const &pending) {
+		if (pending._texture.expired())
+			return true;
+		pendingSize += pending._size;
+		return false;
+	});
+	uint64_t usage = memBudget._usage - std::min(memBudget._usage, pendingSize);
+	uint64_t budget = GetBudget(memBudget);
+
+	if (usage > budget) {
+		std::vector<Entry *> candidates;
+		for (auto &entry : _entries) {
+			rhi::ResourceDescriptor const &desc = entry->_texture->_descriptor;
+			if (entry->_reloading || desc._mipLevels <= 1 || utl::VecMaxElem(glm::ivec2(desc.GetMipDims(1))) < _minMipSize)
+				continue;
+			candidates.push_back(entry.get());
+		}
+		std::sort(candidates.begin(), candidates.end(), [](Entry const *e0, Entry const *e1) {
+			return e0->_texture->_lastUsedFrame < e1->_texture->_lastUsedFrame;
+		});
+		for (uint32_t c = 0; c < candidates.size() && c < _maxDropsPerFrame && usage > budget; ++c) {
+			uint64_t size = GetTextureSize(candidates[c]->_texture->_descriptor);
+			if (!DropTopMip(*candidates[c]))
+				return false;
+			usage -= std::min(usage, size - GetTextureSize(candidates[c]->_texture->_descriptor));
+		}
+		return true;
+	}
+
+	uint64_t reloadLimit = (uint64_t)(budget * _reloadThreshold);
+	if (usage < reloadLimit) {
+		std::vector<std::shared_ptr<Entry>> candidates;
+		std::copy_if(_entries.begin(), _entries.end(), std::back_inserter(candidates), [](std::shared_ptr<Entry> const &entry) {
+			return entry->_droppedMips && !entry->_reloading;
+		});
+		std::sort(candidates.begin(), candidates.end(), [](std::shared_ptr<Entry> const &e0, std::shared_ptr<Entry> const &e1) {
+			return e0->_texture->_lastUsedFrame > e1->_texture->_lastUsedFrame;
+		});
+		uint32_t reloads = 0;
+		for (auto &entry : candidates) {
+			if (reloads >= _maxReloadsPerFrame)
+				break;
+			// each dropped mip was about 3/4 of the texture
+			uint64_t size = GetTextureSize(entry->_texture->_descriptor);
+			uint64_t growth = size * ((1ull << (2 * entry->_droppedMips)) - 1);
+			if (usage + growth > reloadLimit)
+				continue;
+			Reload(entry);
+			usage += growth;
+			++reloads;
+		}
+	}
+
+	return true;
+}
+
+uint64_t ResidencyManager::GetBudget(rhi::Rhi::MemoryBudget const &memBudget) const
+{
+	return _budget ? _budget : (uint64_t)(memBudget._budget * _budgetScale);
+}
+
+uint64_t ResidencyManager::GetTextureSize(rhi::ResourceDescriptor const &desc)
+{
+	uint64_t size = 0;
+	for (int8_t mip = 0; mip < desc._mipLevels; ++mip) {
+		glm::ivec4 dims = desc.GetMipDims(mip);
+		size += rhi::GetFormatRegionSize(desc._format, glm::ivec3(dims.x, dims.y, std::max(dims.z, dims.w)));
+	}
+	return size;
+}
+
+bool ResidencyManager::DropTopMip(Entry &entry)
+{
+	std::shared_ptr<rhi::Texture> texture = entry._texture;
+	rhi::ResourceDescriptor desc = texture->_descriptor;
+	desc._dimensions = desc.GetMipDims(1);
+	--desc._mipLevels;
+	auto dropped = _rhi->New<rhi::Texture>(texture->_name, desc);
+	if (!dropped)
+		return false;
+	// keeps its place in the LRU order until it's used again
+	dropped->_lastUsedFrame = texture->_lastUsedFrame;
+
+	auto copyMips = _rhi->Create<rhi::CopyPass>("DropMip " + texture->_name);
+	if (!copyMips->CopyMips(texture, dropped, 1, 0))
+		return false;
+	auto sub = _rhi->Submit({ copyMips }, "DropMip " + texture->_name);
+	if (!sub->Prepare() || !sub->Execute())
+		return false;
+
+	_pendingReleases.push_back(PendingRelease{ ._texture = texture, ._size = GetTextureSize(texture->_descriptor) });
+	entry._texture = dropped;
+	++entry._droppedMips;
+	++_stats._droppedMips;
+	if (entry._onReplaced)
+		entry._onReplaced(dropped);
+
+	return true;
+}
+
+void ResidencyManager::Reload(std::shared_ptr<Entry> const &entry)
+{
+	entry->_reloading = true;
+	std::weak_ptr<Entry> weakEntry = entry;
+	_loader->LoadAsync(entry->_path, entry->_genMips, [this, weakEntry](std::shared_ptr<rhi::Texture> const &texture) {
+		std::shared_ptr<Entry> entry = weakEntry.lock();
+		if (!entry)
+			return;
+		entry->_reloading = false;
+		if (!texture)
+			return;
+		_pendingReleases.push_back(PendingRelease{ ._texture = entry->_texture, ._size = GetTextureSize(entry->_texture->_descriptor) });
+		texture->_lastUsedFrame = entry->_texture->_lastUsedFrame;
+		entry->_texture = texture;
+		entry->_droppedMips = 0;
+		++_stats._reloads;
+		if (entry->_onReplaced)
+			entry->_onReplaced(texture);
+	});
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "rhi/rhi.h"
+
+namespace eng {
+
+struct TextureLoader;
+
+// Keeps the textures loaded from files within a device memory budget
+// Over the budget the top mips of the least recently used textures are dropped, when there's room again the
+// textures missing mips are reloaded, the most recently used first
+struct ResidencyManager {
+	// Called with the texture that replaces a managed one, its users have to bind it in its place
+	using OnReplacedFn = std::function<void(std::shared_ptr<rhi::Texture> const &texture)>;
+
+	struct Entry {
+		std::string _path;
+		bool _genMips = false;
+		std::shared_ptr<rhi::Texture> _texture;
+		OnReplacedFn _onReplaced;
+		// mips dropped from the top of the texture as loaded
+		int8_t _droppedMips = 0;
+		bool _reloading = false;
+	};
+
+	struct Stats {
+		uint64_t _droppedMips = 0;
+		uint64_t _reloads = 0;
+		rhi::Rhi::MemoryBudget _lastBudget;
+	};
+
+	bool Init(rhi::Rhi *rhi, TextureLoader *loader);
+
+	// The texture has to be resident and have copySrc usage
+	std::shared_ptr<Entry> Manage(std::string path, bool genMips, std::shared_ptr<rhi::Texture> texture, OnReplacedFn onReplaced);
+	void Release(Entry *entry);
+
+	// Drops or reloads mips depending on the memory use, called once per frame
+	bool Update();
+
+	// The configured budget, or the driver's one scaled down
+	uint64_t GetBudget(rhi::Rhi::MemoryBudget const &memBudget) const;
+	static uint64_t GetTextureSize(rhi::ResourceDescriptor const &desc);
+
+	bool DropTopMip(Entry &entry);
+	void Reload(std::shared_ptr<Entry> const &entry);
+
+	// Textures that were replaced, their memory is freed once the GPU and their users are done with them
+	struct PendingRelease {
+		std::weak_ptr<rhi::Texture> _texture;
+		uint64_t _size = 0;
+	};
+
+	rhi::Rhi *_rhi = nullptr;
+	TextureLoader *_loader = nullptr;
+	std::vector<std::shared_ptr<Entry>> _entries;
+	std::vector<PendingRelease> _pendingReleases;
+
+	// in bytes, 0 uses the driver's budget scaled by _budgetScale
+	uint64_t _budget = 0;
+	float _budgetScale = 0.9f;
+	// mips are reloaded while the memory use is below this part of the budget
+	float _reloadThreshold = 0.75f;
+	// textures aren't shrunk below this size
+	int32_t _minMipSize = 64;
+	// spread over frames to avoid hitches
+	uint32_t _maxDropsPerFrame = 4;
+	uint32_t _maxReloadsPerFrame = 1;
+	Stats _stats;
+};
+
+}
\ No newline at end of file
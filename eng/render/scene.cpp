@@ -4,6 +4,8 @@
 #include "eng/component.h"
 #include "rhi/pass.h"
 #include "rhi/resource.h"
+#include "utl/thread_pool.h"
+#include "utl/mathutl.h"
 
 namespace eng {
 
@@ -31,16 +33,49 @@ RenderObjectsData Scene::RenderObjects()
 	ASSERT(res);
 
 	utl::Polytope3F frustum = _camera->GetFrustum(renderData.GetRenderTargetSize());
+	std::vector<Object *> visibleObjects;
 	_world->EnumObjects(frustum, [&](std::shared_ptr<Object> &obj) {
-		bool res = RenderObject(obj.get(), renderData);
-		ASSERT(res);
+		visibleObjects.push_back(obj.get());
 		return utl::Enum::Continue;
 	});
 
+	// the buffer is grown before the objects write their parameters, so none of them get lost in the copy to the new one
+	res = ReserveObjParams(visibleObjects, renderData);
+	ASSERT(res);
+
+	std::erase_if(visibleObjects, [&](Object *obj) {
+		bool res = PrepareObject(obj, renderData);
+		ASSERT(res);
+		return !res;
+	});
+
+	// the parameter updates of all the objects are copied in a single pass
+	if (auto uploadPass = Sys::Get()->_uploadRing->TakeCopyPass())
+		renderData._updatePasses.push_back(std::move(uploadPass));
+
+	utl::ThreadPool *threadPool = Sys::Get()->_threadPool.get();
+	uint32_t numObjects = (uint32_t)visibleObjects.size();
+	uint32_t numContexts = std::min(threadPool->GetNumThreads() + 1, (numObjects + MinObjectsPerContext - 1) / MinObjectsPerContext);
+	numContexts = std::max(numContexts, 1u);
+	res = renderData._renderPass->InitContexts(numContexts);
+	ASSERT(res);
+
+	threadPool->ParallelFor(numContexts, [&](uint32_t context) {
+		uint32_t begin = (uint64_t)numObjects * context / numContexts;
+		uint32_t end = (uint64_t)numObjects * (context + 1) / numContexts;
+		for (uint32_t i = begin; i < end; ++i) {
+			bool res = RenderObject(visibleObjects[i], renderData, context);
+			ASSERT(res);
+		}
+		// the context's commands are finished on the thread that recorded them
+		bool ended = renderData._renderPass->EndContext(context);
+		ASSERT(ended);
+	});
+
 	return renderData;
 }
 
-bool Scene::RenderObject(Object *obj, RenderObjectsData &renderData)
+bool Scene::PrepareObject(Object *obj, RenderObjectsData &renderData)
 {
 	auto *renderCmp = obj->GetComponent<RenderingCmp>();
 	if (!renderCmp)
@@ -49,23 +84,36 @@ bool Scene::RenderObject(Object *obj, RenderObjectsData &renderData)
 	if (!renderCmp->UpdateObjParams(renderData))
 		return false;
 
+	for (auto &model : renderCmp->_models) {
+		if (!model._material->UpdateMaterialParams(model._pipeline.get()))
+			return false;
+	}
+
+	return true;
+}
+
+bool Scene::RenderObject(Object *obj, RenderObjectsData &renderData, uint32_t context)
+{
+	auto *renderCmp = obj->GetComponent<RenderingCmp>();
+	if (!renderCmp)
+		return true;
+
 	bool res = true;
 	std::vector<rhi::GraphicsPass::BufferStream> vertexStreams;
 	std::vector<std::shared_ptr<rhi::ResourceSet>> resourceSets;
+	uint32_t objParamsOffset = GetObjParamsOffset(renderCmp->_objParamsSlot);
 	for (auto &model : renderCmp->_models) {
 		rhi::GraphicsPass::DrawData drawData;
 		drawData._pipeline = model._pipeline;
 
-		if (!model._material->UpdateMaterialParams(model._pipeline.get()))
-			return false;
-
-		resourceSets.insert(resourceSets.end(), { renderCmp->_objParams, model._material->_materialParams, renderData._scene->_sceneParams });
+		resourceSets.insert(resourceSets.end(), { _objParams, model._material->_materialParams, renderData._scene->_sceneParams });
 		drawData._resourceSets = resourceSets;
+		drawData._dynamicOffsets = std::span(&objParamsOffset, 1);
 
 		res = model._mesh->SetGeometryData(drawData, vertexStreams) && res;
 		ASSERT(res);
 
-		res = renderData._renderPass->Draw(drawData) && res;
+		res = renderData._renderPass->Draw(drawData, context) && res;
 		ASSERT(res);
 		vertexStreams.clear();
 		resourceSets.clear();
@@ -87,47 +135,102 @@ bool Scene::UpdateSceneParams(RenderObjectsData &renderData)
 		});
 	}
 
-	auto uploadPass = Scene::UpdateResourceSetBuffer(_sceneParams.get(), "SceneData", [&](utl::AnyRef params) {
+	bool res = Scene::UpdateResourceSetBuffer(_sceneParams.get(), "SceneData", [&](utl::AnyRef params) {
 		*params.GetMember("view").Get<glm::mat4>() = _camera->GetViewMatrix();
 		*params.GetMember("proj").Get<glm::mat4>() = _camera->GetProjMatrix(renderData.GetRenderTargetSize());
 		return true;
 	});
-	renderData._updatePasses.push_back(std::move(uploadPass));
 
-	return true;
+	return res;
 }
 
-std::shared_ptr<rhi::CopyPass> Scene::UpdateResourceSetBuffer(rhi::ResourceSet *resSet, std::string bufName, UpdateBufferFn updateBufferFn)
+bool Scene::ReserveObjParams(std::span<Object *> objects, RenderObjectsData &renderData)
 {
-	std::shared_ptr<rhi::CopyPass> uploadPass;
-	int32_t transformsParam = resSet->GetSetDescription()->GetParamIndex(bufName);
-	if (transformsParam >= 0) {
-		rhi::ResourceSetDescription::Param const &param = resSet->GetSetDescription()->_params[transformsParam];
-		ASSERT(param._kind == rhi::ShaderParam::UniformBuffer || param._kind == rhi::ShaderParam::UAVBuffer);
-		rhi::ShaderParam const *shaderParam = resSet->_pipeline->GetShaderParam(resSet->_setIndex, transformsParam);
-
-		rhi::Rhi *rhi = resSet->_pipeline->_rhi;
+	rhi::Pipeline *pipeline = nullptr;
+	for (Object *obj : objects) {
+		auto *renderCmp = obj->GetComponent<RenderingCmp>();
+		if (!renderCmp || renderCmp->_models.empty() || renderCmp->_objParamsSlot != ~0u)
+			continue;
+		if (_freeObjParamsSlots.size()) {
+			renderCmp->_objParamsSlot = _freeObjParamsSlots.back();
+			_freeObjParamsSlots.pop_back();
+		} else {
+			renderCmp->_objParamsSlot = _numObjParamsSlots++;
+		}
+		// whatever is in the slot belonged to another object
+		obj->SetTransformDirty(true);
+		pipeline = renderCmp->_models[0]._pipeline.get();
+	}
 
-		rhi::ResourceDescriptor bufDesc{
-			._usage{.copySrc = 1, .cpuAccess = 1, },
-			._dimensions{ (int32_t)shaderParam->_type->_size, 0, 0, 0 },
-		};
-		auto uploadBuf = rhi->New<rhi::Buffer>("Update" + shaderParam->_name, bufDesc);
-		auto uploadData = uploadBuf->Map();
+	if (_numObjParamsSlots <= _objParamsCapacity)
+		return true;
 
-		utl::AnyRef transforms{ shaderParam->_type, uploadData.data() };
-		bool res = updateBufferFn(transforms);
+	if (!_objParams) {
+		_objParams = pipeline->AllocResourceSet(0);
+		if (!_objParams)
+			return false;
+	}
+	rhi::ShaderParam const *param = _objParams->_pipeline->GetShaderParam(0, "ModelData");
+	if (!param)
+		return false;
+	ASSERT(_objParams->GetSetDescription()->_params[param->_binding]._dynamic);
+	// the largest minimum offset alignment Vulkan allows for dynamic buffers
+	_objParamsStride = (uint32_t)utl::RoundUp(param->_type->_size, rhi::UploadRing::s_defaultAlignment);
 
-		uploadBuf->Unmap();
+	uint32_t capacity = std::max({ _numObjParamsSlots, _objParamsCapacity * 2, MinObjParamsCapacity });
+	rhi::ResourceDescriptor paramBufDesc{
+		._usage = rhi::ResourceUsage{.srv = 1, .uav = (param->_kind == rhi::ShaderParam::UAVBuffer), .copySrc = 1, .copyDst = 1},
+		._dimensions = glm::ivec4{(int32_t)(capacity * _objParamsStride), 0, 0, 0},
+	};
+	auto paramBuf = _objParams->_pipeline->_rhi->New<rhi::Buffer>(param->_name, paramBufDesc);
+	if (!paramBuf)
+		return false;
 
-		if (res) {
-			uploadPass = rhi->Create<rhi::CopyPass>("Upload" + shaderParam->_name);
-			bool res = uploadPass->Copy(rhi::CopyPass::CopyData{ ._src{uploadBuf}, ._dst{resSet->_resourceRefs[transformsParam]._bindable} });
-			ASSERT(res);
-		}
+	rhi::ResourceRef &paramRef = _objParams->_resourceRefs[param->_binding];
+	if (paramRef._bindable) {
+		auto copyParams = _objParams->_pipeline->_rhi->Create<rhi::CopyPass>("GrowObjParams");
+		glm::ivec4 copySize{ (int32_t)(_objParamsCapacity * _objParamsStride), 0, 0, 0 };
+		bool res = copyParams->Copy(rhi::CopyPass::CopyData{
+			._src{ paramRef._bindable, rhi::ResourceView{ ._region = utl::Box4I::FromMinAndSize(glm::ivec4(0), copySize) } },
+			._dst{ paramBuf, rhi::ResourceView{ ._region = utl::Box4I::FromMinAndSize(glm::ivec4(0), copySize) } },
+		});
+		if (!res)
+			return false;
+		renderData._updatePasses.push_back(std::move(copyParams));
 	}
 
-	return uploadPass;
+	paramRef = rhi::ResourceRef{
+		._bindable = std::move(paramBuf),
+		._view = rhi::ResourceView{ ._region = utl::Box4I::FromMinAndSize(glm::ivec4(0), glm::ivec4{ (int32_t)param->_type->_size, 0, 0, 0 }) },
+	};
+	_objParamsCapacity = capacity;
+
+	return _objParams->Update();
+}
+
+void Scene::FreeObjParamsSlot(uint32_t slot)
+{
+	ASSERT(slot < _numObjParamsSlots);
+	_freeObjParamsSlots.push_back(slot);
+}
+
+bool Scene::UpdateResourceSetBuffer(rhi::ResourceSet *resSet, std::string bufName, UpdateBufferFn updateBufferFn, size_t bufOffset)
+{
+	int32_t transformsParam = resSet->GetSetDescription()->GetParamIndex(bufName);
+	if (transformsParam < 0)
+		return true;
+
+	rhi::ResourceSetDescription::Param const &param = resSet->GetSetDescription()->_params[transformsParam];
+	ASSERT(param._kind == rhi::ShaderParam::UniformBuffer || param._kind == rhi::ShaderParam::UAVBuffer);
+	rhi::ShaderParam const *shaderParam = resSet->_pipeline->GetShaderParam(resSet->_setIndex, transformsParam);
+
+	auto paramBuf = std::static_pointer_cast<rhi::Buffer>(resSet->_resourceRefs[transformsParam]._bindable);
+	std::span<uint8_t> uploadData = Sys::Get()->_uploadRing->Upload(paramBuf, bufOffset, shaderParam->_type->_size);
+	if (uploadData.empty())
+		return false;
+
+	utl::AnyRef transforms{ shaderParam->_type, uploadData.data() };
+	return updateBufferFn(transforms);
 }
 
 std::shared_ptr<rhi::ResourceSet> Scene::CreateResourseSetWithBuffer(rhi::Pipeline *pipeline, uint32_t setIndex, std::string bufName)
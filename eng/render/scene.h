@@ -29,19 +29,37 @@ struct RenderObjectsData {
 struct Scene {
 	Scene(World *world, CameraCmp *camera, std::span<rhi::RenderTargetData> renderTargets);
 
+	// Objects are prepared serially, then their draws are recorded in contexts spread over the worker threads
 	RenderObjectsData RenderObjects();
 
-	bool RenderObject(Object *obj, RenderObjectsData &renderData);
+	bool PrepareObject(Object *obj, RenderObjectsData &renderData);
+	bool RenderObject(Object *obj, RenderObjectsData &renderData, uint32_t context = 0);
 	bool UpdateSceneParams(RenderObjectsData &renderData);
 
+	// Gives the objects without one a slot in the shared object parameters buffer, growing it when needed
+	bool ReserveObjParams(std::span<Object *> objects, RenderObjectsData &renderData);
+	void FreeObjParamsSlot(uint32_t slot);
+	uint32_t GetObjParamsOffset(uint32_t slot) const { return slot * _objParamsStride; }
+
 	using UpdateBufferFn = std::function<bool(utl::AnyRef bufferContent)>;
-	static std::shared_ptr<rhi::CopyPass> UpdateResourceSetBuffer(rhi::ResourceSet *resSet, std::string bufName, UpdateBufferFn updateBufferFn);
+	// The new contents are written to the upload ring, the copy to the buffer goes in the frame's upload pass
+	static bool UpdateResourceSetBuffer(rhi::ResourceSet *resSet, std::string bufName, UpdateBufferFn updateBufferFn, size_t bufOffset = 0);
 	static std::shared_ptr<rhi::ResourceSet> CreateResourseSetWithBuffer(rhi::Pipeline *pipeline, uint32_t setIndex, std::string bufName);
 
 	World *_world = nullptr;
 	CameraCmp *_camera = nullptr;
 	std::vector<rhi::RenderTargetData> _renderTargets;
 	std::shared_ptr<rhi::ResourceSet> _sceneParams;
+	// all objects share a resource set with a dynamic ModelData buffer, each draw binds it at the offset of its object's slot
+	std::shared_ptr<rhi::ResourceSet> _objParams;
+	uint32_t _objParamsStride = 0;
+	uint32_t _objParamsCapacity = 0;
+	uint32_t _numObjParamsSlots = 0;
+	std::vector<uint32_t> _freeObjParamsSlots;
+
+	// fewer objects than this aren't worth recording in a separate context
+	static constexpr uint32_t MinObjectsPerContext = 256;
+	static constexpr uint32_t MinObjParamsCapacity = 1024;
 };
 
 
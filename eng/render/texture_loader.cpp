@@ -0,0 +1,351 @@
+#include "texture_loader.h"
+#include "passes.h"
+#include "rhi/rhi.h"
+#include "utl/thread_pool.h"
+#include "utl/file.h"
+#include "utl/mathutl.h"
+
+#include "stb_image.h"
+#include <numeric>
+
+namespace eng {
+
+// KTX2 files store their format as a VkFormat value
+static std::unordered_map<uint32_t, rhi::Format> const s_ktx2Formats{ {
+		{ 9,   rhi::Format::R8                 },
+		{ 16,  rhi::Format::R8G8               },
+		{ 23,  rhi::Format::R8G8B8             },
+		{ 37,  rhi::Format::R8G8B8A8           },
+		{ 43,  rhi::Format::R8G8B8A8_srgb      },
+		{ 44,  rhi::Format::B8G8R8A8           },
+		{ 50,  rhi::Format::B8G8R8A8_srgb      },
+		{ 133, rhi::Format::BC1                },
+		{ 134, rhi::Format::BC1_srgb           },
+		{ 135, rhi::Format::BC2                },
+		{ 136, rhi::Format::BC2_srgb           },
+		{ 137, rhi::Format::BC3                },
+		{ 138, rhi::Format::BC3_srgb           },
+		{ 139, rhi::Format::BC4                },
+		{ 141, rhi::Format::BC5                },
+		{ 143, rhi::Format::BC6H_uf            },
+		{ 145, rhi::Format::BC7                },
+		{ 146, rhi::Format::BC7_srgb           },
+		{ 147, rhi::Format::ETC2_R8G8B8        },
+		{ 148, rhi::Format::ETC2_R8G8B8_srgb   },
+		{ 151, rhi::Format::ETC2_R8G8B8A8      },
+		{ 152, rhi::Format::ETC2_R8G8B8A8_srgb },
+		{ 157, rhi::Format::ASTC_4x4           },
+		{ 158, rhi::Format::ASTC_4x4_srgb      },
+		{ 165, rhi::Format::ASTC_6x6           },
+		{ 166, rhi::Format::ASTC_6x6_srgb      },
+		{ 171, rhi::Format::ASTC_8x8           },
+		{ 172, rhi::Format::ASTC_8x8_srgb      },
+	} };
+
+// the mips are generated with compute where the format allows it, with blits otherwise
+static rhi::ResourceUsage GetTextureUsage(rhi::Format fmt, bool genMips)
+{
+	bool computeMips = genMips && MipGenerator::IsFormatSupported(fmt);
+	// copySrc lets the residency manager copy out the lower mips when it drops the top ones
+	return rhi::ResourceUsage{ .srv = 1, .uav = computeMips, .copySrc = 1, .copyDst = 1 };
+}
+
+TextureLoader::~TextureLoader()
+{
+	// the decoding tasks report to the loader, so it has to outlive them
+	auto lock = std::unique_lock(_mutex);
+	_decodedCond.wait(lock, [this] { return _numDecoding == 0; });
+}
+
+bool TextureLoader::Init(rhi::Rhi *rhi, utl::ThreadPool *threadPool, MipGenerator *mipGenerator)
+{
+	_rhi = rhi;
+	_threadPool = threadPool;
+	_mipGenerator = mipGenerator;
+
+	_placeholder = _rhi->New<rhi::Texture>("TexturePlaceholder", rhi::ResourceDescriptor{
+		._usage{.srv = 1, .copyDst = 1},
+		._format = rhi::Format::R8G8B8A8,
+		._dimensions{ 1, 1, 0, 0 },
+	});
+	if (!_placeholder)
+		return false;
+
+	auto staging = _rhi->New<rhi::Buffer>("Staging TexturePlaceholder", rhi::ResourceDescriptor{
+		._usage{.copySrc = 1, .cpuAccess = 1},
+		._dimensions{ 4, 0, 0, 0 },
+		._hostAccess = rhi::HostAccess::Upload,
+	});
+	if (!staging)
+		return false;
+	std::span<uint8_t> pixMem = staging->Map();
+	std::fill(pixMem.begin(), pixMem.end(), 0xff);
+	if (!staging->Unmap())
+		return false;
+
+	auto copyStaging = _rhi->Create<rhi::CopyPass>();
+	if (!copyStaging->Copy(rhi::CopyPass::CopyData{ ._src{staging}, ._dst{_placeholder, rhi::ResourceView{._mipRange{0, 0}}} }))
+		return false;
+	auto sub = _rhi->Submit({ copyStaging }, "Upload TexturePlaceholder");
+	return sub->Prepare() && sub->Execute();
+}
+
+std::shared_ptr<TextureLoader::Request> TextureLoader::LoadAsync(std::string path, bool genMips, OnResidentFn onResident)
+{
+	auto request = std::make_shared<Request>();
+	request->_path = std::move(path);
+	request->_genMips = genMips;
+	request->_onResident = std::move(onResident);
+
+	{
+		auto lock = std::unique_lock(_mutex);
+		++_numDecoding;
+	}
+	_threadPool->Run([this, request] {
+		request->_state = Decode(*request) ? State::Decoded : State::Failed;
+		{
+			auto lock = std::unique_lock(_mutex);
+			_decoded.push_back(request);
+			--_numDecoding;
+		}
+		_decodedCond.notify_all();
+	});
+
+	return request;
+}
+
+bool TextureLoader::Update()
+{
+	auto reportLoaded = [](Request &request, std::shared_ptr<rhi::Texture> const &texture) {
+		if (request._onResident)
+			request._onResident(texture);
+		request._onResident = nullptr;
+	};
+
+	while (_uploading.size() && _uploading.front()._submission->IsFinishedExecuting()) {
+		for (auto &request : _uploading.front()._requests) {
+			request->_state = State::Resident;
+			reportLoaded(*request, request->_texture);
+		}
+		_uploading.pop_front();
+	}
+
+	// textures are uploaded in the order they finished decoding, at least one per frame
+	std::vector<std::shared_ptr<Request>> toUpload;
+	{
+		auto lock = std::unique_lock(_mutex);
+		size_t uploadSize = 0;
+		auto itEnd = _decoded.begin();
+		for (; itEnd != _decoded.end() && (itEnd == _decoded.begin() || uploadSize + (*itEnd)->_size <= _maxUploadPerFrame); ++itEnd) {
+			uploadSize += (*itEnd)->_size;
+		}
+		toUpload.assign(std::make_move_iterator(_decoded.begin()), std::make_move_iterator(itEnd));
+		_decoded.erase(_decoded.begin(), itEnd);
+	}
+
+	Batch batch;
+	std::shared_ptr<rhi::CopyPass> copyPass;
+	std::vector<std::shared_ptr<rhi::Pass>> mipsPasses;
+	for (auto &request : toUpload) {
+		if (request->_state == State::Decoded) {
+			if (!copyPass)
+				copyPass = _rhi->Create<rhi::CopyPass>("TextureLoader");
+			if (RecordUpload(_rhi, *request, copyPass.get(), _mipGenerator, mipsPasses)) {
+				request->_state = State::Uploading;
+				batch._requests.push_back(std::move(request));
+				continue;
+			}
+			request->_state = State::Failed;
+		}
+		LOG("Failed to load texture '%s'", request->_path);
+		reportLoaded(*request, nullptr);
+	}
+	if (batch._requests.empty())
+		return true;
+
+	// the upload runs on the transfer queue alongside rendering, the mips are generated on the universal one
+	batch._submission = _rhi->Submit({ copyPass }, "Upload textures", rhi::QueueKind::Transfer);
+	if (!batch._submission->Prepare() || !batch._submission->Execute())
+		return false;
+	if (mipsPasses.size()) {
+		batch._submission = _rhi->Submit(std::move(mipsPasses), "Mips textures");
+		if (!batch._submission->Prepare() || !batch._submission->Execute())
+			return false;
+	}
+	_uploading.push_back(std::move(batch));
+
+	return true;
+}
+
+bool TextureLoader::IsIdle()
+{
+	auto lock = std::unique_lock(_mutex);
+	return !_numDecoding && _decoded.empty() && _uploading.empty();
+}
+
+std::shared_ptr<rhi::Texture> TextureLoader::GetTexture(Request const &request) const
+{
+	return request.IsResident() ? request._texture : _placeholder;
+}
+
+bool TextureLoader::Decode(Request &request)
+{
+	if (utl::GetPathExt(request._path) == ".ktx2")
+		return DecodeKtx2(request);
+
+	int x, y, ch;
+	request._pixels = { stbi_load(request._path.c_str(), &x, &y, &ch, 0), stbi_image_free };
+	if (!request._pixels)
+		return false;
+
+	rhi::Format fmt;
+	switch (ch) {
+		case 1:
+			fmt = rhi::Format::R8;
+			break;
+		case 2:
+			fmt = rhi::Format::R8G8;
+			break;
+		case 4:
+			fmt = rhi::Format::R8G8B8A8;
+			break;
+		default:
+			return false;
+	}
+	glm::vec4 dims{ x, y, 0, 0 };
+	request._desc = rhi::ResourceDescriptor{
+		._usage = GetTextureUsage(fmt, request._genMips),
+		._format = fmt,
+		._dimensions = dims,
+		._mipLevels = rhi::GetMaxMipLevels(dims),
+	};
+	request._size = (size_t)x * y * ch;
+	request._mips = { Request::MipData{ ._size = request._size } };
+
+	return true;
+}
+
+bool TextureLoader::DecodeKtx2(Request &request)
+{
+	static constexpr uint8_t s_identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+	struct Header {
+		uint8_t _identifier[12];
+		uint32_t _vkFormat, _typeSize;
+		uint32_t _pixelWidth, _pixelHeight, _pixelDepth;
+		uint32_t _layerCount, _faceCount, _levelCount;
+		uint32_t _supercompressionScheme;
+		uint32_t _dfdByteOffset, _dfdByteLength;
+		uint32_t _kvdByteOffset, _kvdByteLength;
+		uint64_t _sgdByteOffset, _sgdByteLength;
+	};
+	static_assert(sizeof(Header) == 80);
+	struct LevelIndex {
+		uint64_t _byteOffset, _byteLength, _uncompressedByteLength;
+	};
+
+	request._contents = utl::ReadFile(request._path);
+	std::vector<uint8_t> const &contents = request._contents;
+	Header header;
+	if (contents.size() < sizeof(header))
+		return false;
+	memcpy(&header, contents.data(), sizeof(header));
+	if (memcmp(header._identifier, s_identifier, sizeof(s_identifier)))
+		return false;
+	if (header._supercompressionScheme) {
+		LOG("Texture '%s' uses supercompression %d, which isn't supported", request._path, header._supercompressionScheme);
+		return false;
+	}
+	auto itFormat = s_ktx2Formats.find(header._vkFormat);
+	if (itFormat == s_ktx2Formats.end()) {
+		LOG("Texture '%s' has unsupported format %d", request._path, header._vkFormat);
+		return false;
+	}
+	rhi::Format fmt = itFormat->second;
+	if (header._faceCount != 1 && header._faceCount != 6)
+		return false;
+
+	// cube maps are arrays of faces with a 3rd dimension of 1
+	bool isCube = header._faceCount == 6;
+	glm::ivec4 dims(
+		header._pixelWidth,
+		header._pixelHeight,
+		isCube ? 1u : header._pixelDepth,
+		isCube ? 6 * std::max(header._layerCount, 1u) : header._layerCount);
+	// files without mips ask for them to be generated, compressed formats can't be blitted to so they go without
+	uint32_t numLevels = std::max(header._levelCount, 1u);
+	request._genMips = !header._levelCount && request._genMips && !rhi::IsCompressed(fmt);
+	if (numLevels > (uint32_t)rhi::GetMaxMipLevels(dims))
+		return false;
+	if (contents.size() < sizeof(Header) + numLevels * sizeof(LevelIndex))
+		return false;
+
+	request._desc = rhi::ResourceDescriptor{
+		._usage = GetTextureUsage(fmt, request._genMips),
+		._format = fmt,
+		._dimensions = dims,
+		._mipLevels = request._genMips ? rhi::GetMaxMipLevels(dims) : (int8_t)numLevels,
+	};
+
+	// copies from buffers to textures need offsets aligned to the texel or block size, and to 4
+	size_t alignment = std::lcm(rhi::GetFormatSize(fmt), 4u);
+	request._mips.clear();
+	request._size = 0;
+	for (uint32_t level = 0; level < numLevels; ++level) {
+		LevelIndex index;
+		memcpy(&index, contents.data() + sizeof(Header) + level * sizeof(LevelIndex), sizeof(index));
+		glm::ivec4 mipDims = request._desc.GetMipDims(level);
+		uint32_t mipSize = rhi::GetFormatRegionSize(fmt, glm::ivec3(mipDims.x, mipDims.y, std::max(mipDims.z, mipDims.w)));
+		if (index._byteLength != mipSize || index._byteOffset + index._byteLength > contents.size())
+			return false;
+		size_t stagingOffset = utl::RoundUp(request._size, alignment);
+		request._mips.push_back(Request::MipData{
+			._srcOffset = index._byteOffset,
+			._stagingOffset = stagingOffset,
+			._size = index._byteLength,
+		});
+		request._size = stagingOffset + index._byteLength;
+	}
+
+	return true;
+}
+
+bool TextureLoader::RecordUpload(rhi::Rhi *rhi, Request &request, rhi::CopyPass *copyPass, MipGenerator *mipGenerator, std::vector<std::shared_ptr<rhi::Pass>> &mipsPasses)
+{
+	ASSERT(request._mips.size());
+	if (!rhi->IsFormatSupported(request._desc._format, request._desc._usage)) {
+		LOG("Texture '%s' has a format the device doesn't support", request._path);
+		return false;
+	}
+	request._texture = rhi->New<rhi::Texture>(request._path, request._desc);
+	if (!request._texture)
+		return false;
+
+	std::shared_ptr<rhi::Buffer> staging = rhi->New<rhi::Buffer>("Staging " + request._path, rhi::ResourceDescriptor{
+		._usage{.copySrc = 1, .cpuAccess = 1},
+		._dimensions{ (int32_t)request._size, 0, 0, 0 },
+		._hostAccess = rhi::HostAccess::Upload,
+	});
+	if (!staging)
+		return false;
+	std::span<uint8_t> pixMem = staging->Map();
+	for (auto &mip : request._mips) {
+		memcpy(pixMem.data() + mip._stagingOffset, request.GetSourceData() + mip._srcOffset, mip._size);
+	}
+	if (!staging->Unmap())
+		return false;
+	request._pixels = nullptr;
+	request._contents = {};
+
+	for (int8_t m = 0; m < (int8_t)request._mips.size(); ++m) {
+		auto &mip = request._mips[m];
+		rhi::ResourceView stagingView{ ._region = utl::Box4I::FromMinAndSize(glm::ivec4((int32_t)mip._stagingOffset, 0, 0, 0), glm::ivec4((int32_t)mip._size, 0, 0, 0)) };
+		if (!copyPass->Copy(rhi::CopyPass::CopyData{ ._src{staging, stagingView}, ._dst{request._texture, rhi::ResourceView::FromDescriptor(request._desc, m, 1)} }))
+			return false;
+	}
+	if (request._genMips && !mipGenerator->GenerateMips(request._texture, mipsPasses))
+		return false;
+
+	return true;
+}
+
+}
\ No newline at end of file
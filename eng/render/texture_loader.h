@@ -0,0 +1,101 @@
+#pragma once
+
+#include "rhi/resource.h"
+#include <condition_variable>
+
+namespace rhi {
+struct Rhi;
+struct Pass;
+struct CopyPass;
+struct Submission;
+}
+
+namespace utl {
+struct ThreadPool;
+}
+
+namespace eng {
+
+struct MipGenerator;
+
+// Decodes textures on the thread pool and uploads the decoded ones in batches from the frame loop
+// Until a texture is resident its users bind the loader's placeholder in its place
+struct TextureLoader {
+	enum class State : int8_t {
+		Decoding,
+		Decoded,
+		Uploading,
+		Resident,
+		Failed,
+	};
+
+	// Called from Update once the texture is resident, or with null if it failed to load
+	using OnResidentFn = std::function<void(std::shared_ptr<rhi::Texture> const &texture)>;
+
+	struct Request {
+		std::string _path;
+		bool _genMips = false;
+		std::atomic<State> _state = State::Decoding;
+		std::shared_ptr<rhi::Texture> _texture;
+		OnResidentFn _onResident;
+
+		// where a mip's data is in the source and in the staging buffer
+		struct MipData {
+			size_t _srcOffset = 0, _stagingOffset = 0, _size = 0;
+		};
+
+		// the decoded image, or the contents of a container file with its mips, released once they're copied to
+		// a staging buffer
+		std::unique_ptr<uint8_t, void (*)(void *)> _pixels{ nullptr, nullptr };
+		std::vector<uint8_t> _contents;
+		std::vector<MipData> _mips;
+		rhi::ResourceDescriptor _desc;
+		// of the staging buffer
+		size_t _size = 0;
+
+		bool IsResident() const { return _state == State::Resident; }
+		uint8_t const *GetSourceData() const { return _pixels ? _pixels.get() : _contents.data(); }
+	};
+
+	~TextureLoader();
+
+	bool Init(rhi::Rhi *rhi, utl::ThreadPool *threadPool, MipGenerator *mipGenerator);
+
+	// Returns right away, the texture is decoded on a worker thread
+	std::shared_ptr<Request> LoadAsync(std::string path, bool genMips, OnResidentFn onResident = nullptr);
+	// Reports the textures whose uploads finished and starts uploading the ones decoded since the last call
+	bool Update();
+	bool IsIdle();
+
+	// The loaded texture once it's resident, the placeholder before that
+	std::shared_ptr<rhi::Texture> GetTexture(Request const &request) const;
+
+	// KTX2 files are uploaded with the mips they contain, other images are decoded with stb
+	static bool Decode(Request &request);
+	static bool DecodeKtx2(Request &request);
+	// Creates the texture and records the copy of its contents to it, and appends the passes generating its mips if needed
+	static bool RecordUpload(rhi::Rhi *rhi, Request &request, rhi::CopyPass *copyPass, MipGenerator *mipGenerator, std::vector<std::shared_ptr<rhi::Pass>> &mipsPasses);
+
+	struct Batch {
+		// the last submission of the batch, the others finish before it
+		std::shared_ptr<rhi::Submission> _submission;
+		std::vector<std::shared_ptr<Request>> _requests;
+	};
+
+	rhi::Rhi *_rhi = nullptr;
+	utl::ThreadPool *_threadPool = nullptr;
+	MipGenerator *_mipGenerator = nullptr;
+	std::shared_ptr<rhi::Texture> _placeholder;
+
+	std::mutex _mutex;
+	std::condition_variable _decodedCond;
+	// guarded by the mutex
+	std::vector<std::shared_ptr<Request>> _decoded;
+	uint32_t _numDecoding = 0;
+
+	std::deque<Batch> _uploading;
+	// the decoded textures larger than this are uploaded over several frames
+	size_t _maxUploadPerFrame = 64 * 1024 * 1024;
+};
+
+}
\ No newline at end of file
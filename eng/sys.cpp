@@ -1,10 +1,11 @@
 #include "sys.h"
 #include "world.h"
 #include "render/scene.h"
+#include "render/texture_loader.h"
+#include "render/passes.h"
+#include "render/residency.h"
 #include "rhi/vk/rhi_vk.h"
 
-#include "stb_image.h"
-
 namespace eng {
 Sys::~Sys()
 {
@@ -12,6 +13,8 @@ Sys::~Sys()
 
 bool Sys::Init()
 {
+    _threadPool = std::make_unique<utl::ThreadPool>();
+
     _ui = std::make_unique<Ui>();
     if (!_ui->Init())
         return false;
@@ -19,7 +22,7 @@ bool Sys::Init()
     return true;
 }
 
-bool Sys::InitRhi(std::shared_ptr<Window> const &window, int32_t deviceIndex)
+bool Sys::InitRhi(std::shared_ptr<Window> const &window, int32_t deviceIndex, uint32_t framesInFlight)
 {
     _rhi = std::static_pointer_cast<rhi::Rhi>(std::make_shared<rhi::RhiVk>());
 
@@ -29,12 +32,31 @@ bool Sys::InitRhi(std::shared_ptr<Window> const &window, int32_t deviceIndex)
 #if !defined(NDEBUG)
         ._enableValidation = true,
 #endif
+        ._framesInFlight = framesInFlight,
         ._window = window->GetWindowData(),
+        ._cacheDir = "cache",
+        ._threadPool = _threadPool.get(),
     };
 
     if (!_rhi->Init(rhiSettings, deviceIndex))
         return false;
 
+    _uploadRing = std::make_unique<rhi::UploadRing>();
+    if (!_uploadRing->Init(_rhi.get()))
+        return false;
+
+    _mipGenerator = std::make_unique<MipGenerator>();
+    if (!_mipGenerator->Init(_rhi.get()))
+        return false;
+
+    _textureLoader = std::make_unique<TextureLoader>();
+    if (!_textureLoader->Init(_rhi.get(), _threadPool.get(), _mipGenerator.get()))
+        return false;
+
+    _residency = std::make_unique<ResidencyManager>();
+    if (!_residency->Init(_rhi.get(), _textureLoader.get()))
+        return false;
+
     LOG("Created rhi device '%s'", _rhi->GetInitializedDevice()._name);
 
     for (auto *win : _ui->_windows) {
@@ -49,62 +71,30 @@ bool Sys::InitRhi(std::shared_ptr<Window> const &window, int32_t deviceIndex)
 std::shared_ptr<rhi::Texture> Sys::LoadTexture(std::string path, bool genMips)
 {
 	auto rhi = eng::Sys::Get()->_rhi.get();
-	int x, y, ch;
-	uint8_t *img = stbi_load(path.c_str(), &x, &y, &ch, 0);
-
-	if (!img)
-		return nullptr;
-
-	rhi::Format fmt;
-	switch (ch) {
-		case 1:
-			fmt = rhi::Format::R8;
-			break;
-		case 2:
-			fmt = rhi::Format::R8G8;
-			break;
-		case 4:
-			fmt = rhi::Format::R8G8B8A8;
-			break;
-		default:
-			return nullptr;
-	}
-	glm::vec4 dims{ x, y, 0, 0 };
-	rhi::ResourceDescriptor texDesc{
-		._usage{.srv = 1, .copySrc = genMips, .copyDst = 1},
-		._format = fmt,
-		._dimensions = dims,
-		._mipLevels = rhi::GetMaxMipLevels(dims),
+	TextureLoader::Request request{
+		._path = path,
+		._genMips = genMips,
 	};
-	std::shared_ptr<rhi::Texture> tex = rhi->New<rhi::Texture>(path, texDesc);
-
-	std::shared_ptr<rhi::Buffer> staging = rhi->New<rhi::Buffer>("Staging " + path, rhi::ResourceDescriptor{
-		._usage{.copySrc = 1, .cpuAccess = 1},
-		._dimensions{x * y * ch, 0, 0, 0},
-		});
-	std::span<uint8_t> pixMem = staging->Map();
-	memcpy(pixMem.data(), img, pixMem.size());
-	staging->Unmap();
-
-	stbi_image_free(img);
+	if (!TextureLoader::Decode(request))
+		return nullptr;
 
-	std::vector<std::shared_ptr<rhi::Pass>> passes;
 	auto copyStaging = rhi->Create<rhi::CopyPass>();
-	copyStaging->Copy(rhi::CopyPass::CopyData{ ._src{staging}, ._dst{tex, rhi::ResourceView{._mipRange{0, 0}}} });
-	passes.push_back(copyStaging);
-
-	if (genMips) {
-		auto mipGen = rhi->Create<rhi::CopyPass>();
-		mipGen->CopyTopToLowerMips(tex);
-		passes.push_back(mipGen);
-	}
+	std::vector<std::shared_ptr<rhi::Pass>> mipsPasses;
+	if (!TextureLoader::RecordUpload(rhi, request, copyStaging.get(), _mipGenerator.get(), mipsPasses))
+		return nullptr;
 
-	auto sub = rhi->Submit(std::move(passes), "Upload " + path);
+	// the upload runs on the transfer queue alongside rendering, the mips are generated on the universal one
+	auto sub = rhi->Submit({ copyStaging }, "Upload " + path, rhi::QueueKind::Transfer);
 	sub->Prepare();
 	sub->Execute();
-	sub->WaitUntilFinished();
 
-	return tex;
+	if (mipsPasses.size()) {
+		auto subMips = rhi->Submit(std::move(mipsPasses), "Mips " + path);
+		subMips->Prepare();
+		subMips->Execute();
+	}
+
+	return request._texture;
 }
 
 
@@ -4,7 +4,9 @@
 #include "ui/window.h"
 #include "rhi/rhi.h"
 #include "rhi/resource.h"
+#include "rhi/upload.h"
 #include "utl/update_queue.h"
+#include "utl/thread_pool.h"
 #include <chrono>
 
 namespace eng {
@@ -19,20 +21,30 @@ struct World;
 struct Renderer;
 struct Scene;
 struct Ui;
+struct TextureLoader;
+struct MipGenerator;
+struct ResidencyManager;
 
 struct Sys {
 
 	~Sys();
 
 	bool Init();
-	bool InitRhi(std::shared_ptr<Window> const &window, int32_t deviceIndex = 0);
+	bool InitRhi(std::shared_ptr<Window> const &window, int32_t deviceIndex = 0, uint32_t framesInFlight = 2);
 
+	// Decodes and submits the upload on the calling thread, TextureLoader::LoadAsync doesn't block it
 	std::shared_ptr<rhi::Texture> LoadTexture(std::string path, bool genMips);
 
 	void UpdateTime(utl::UpdateQueue::Time deltaSec);
 
 	utl::UpdateQueue::Time _timeScale = 1.0;
+	std::unique_ptr<utl::ThreadPool> _threadPool;
 	std::shared_ptr<rhi::Rhi> _rhi;
+	std::unique_ptr<rhi::UploadRing> _uploadRing;
+	std::unique_ptr<MipGenerator> _mipGenerator;
+	// destroyed after the loader, whose pending callbacks reference it
+	std::unique_ptr<ResidencyManager> _residency;
+	std::unique_ptr<TextureLoader> _textureLoader;
 	std::unique_ptr<Ui> _ui;
 	std::unique_ptr<World> _world;
 	std::unique_ptr<Scene> _scene;
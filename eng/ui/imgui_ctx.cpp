@@ -98,7 +98,8 @@ bool ImguiCtx::Init(Window *window)
     init_info.RenderPass = passVk->_renderPass;
     init_info.Subpass = 0;
     init_info.MinImageCount = 2;
-    init_info.ImageCount = 2;
+    // imgui cycles through ImageCount sets of vertex buffers, they need to cover all frames in flight
+    init_info.ImageCount = std::max(2u, rhiVk->GetFramesInFlight());
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     init_info.Allocator = (VkAllocationCallbacks *)rhiVk->AllocCallbacks();
     init_info.CheckVkResultFn = [](VkResult err) { ASSERT(err == VK_SUCCESS); };
@@ -151,8 +152,11 @@ void ImguiCtx::Render(rhi::GraphicsPass *graphicsPass)
     ImGui::Render();
     ImDrawData *draw_data = ImGui::GetDrawData();
 
-    // Record dear imgui primitives into command buffer
-    ImGui_ImplVulkan_RenderDrawData(draw_data, passVk->_recorder._cmdBuffers.back());
+    // Record dear imgui primitives into a context of their own after the others, so they're drawn over everything else in the pass
+    uint32_t context = passVk->AddContext();
+    ImGui_ImplVulkan_RenderDrawData(draw_data, passVk->GetCmds(context));
+    bool ended = passVk->EndContext(context);
+    ASSERT(ended);
 
 }
 
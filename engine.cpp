@@ -6,10 +6,15 @@
 #include "eng/object.h"
 #include "eng/component.h"
 #include "eng/render/scene.h"
+#include "eng/render/texture_loader.h"
+#include "eng/render/residency.h"
 #include "eng/ui/properties.h"
 
 #include "rhi/pass.h"
 #include "rhi/pipeline.h"
+#include "rhi/graph.h"
+
+#include "utl/file.h"
 
 #define SDL_MAIN_HANDLED
 #include "SDL2/SDL.h"
@@ -50,8 +55,10 @@ eng::Model InitTriModel(std::span<rhi::RenderTargetData> renderTargets)
 	rhi::PipelineData solidData{
 		._shaders = {{ solidVert, solidFrag }},
 		._vertexInputs = { rhi::VertexInputData{._layout = solidVert->GetParam(rhi::ShaderParam::Kind::VertexLayout, 0)->_ownTypes[0] }},
+		._dynamicBuffers = { "ModelData" },
 	};
-	auto solidPipe = rhi->GetPipeline(solidData, solidPass.get());
+	// compiles in the background, the triangle shows up once it's ready
+	auto solidPipe = rhi->GetPipelineAsync(solidData, solidPass.get());
 
 	auto *vertLayout = solidPipe->_pipelineData.GetShader(rhi::ShaderKind::Vertex)->GetParam(rhi::ShaderParam::VertexLayout);
 	auto triBuf = rhi->New<rhi::Buffer>("triangle", rhi::ResourceDescriptor{
@@ -80,8 +87,6 @@ eng::Model InitTriModel(std::span<rhi::RenderTargetData> renderTargets)
 
 	auto sampler = rhi->New<rhi::Sampler>("samp", rhi::SamplerDescriptor{});
 
-	auto gridTex = eng::Sys::Get()->LoadTexture("data/grid2.png", true);
-
 	auto mesh = std::make_shared<eng::Mesh>();
 	mesh->_name = "Triangle";
 	mesh->_vertices = triBuf;
@@ -94,7 +99,20 @@ eng::Model InitTriModel(std::span<rhi::RenderTargetData> renderTargets)
 	mat->_name = "Solid";
 	mat->_shaders = { solidVert, solidFrag };
 	mat->_params["samp"] = sampler;
-	mat->_params["tex"] = gridTex;
+	// the material samples the placeholder until the texture is loaded
+	eng::TextureLoader *texLoader = eng::Sys::Get()->_textureLoader.get();
+	mat->_params["tex"] = texLoader->_placeholder;
+	texLoader->LoadAsync("data/grid2.png", true, [mat](std::shared_ptr<rhi::Texture> const &tex) {
+		if (!tex)
+			return;
+		auto setTex = [mat](std::shared_ptr<rhi::Texture> const &tex) {
+			mat->_params["tex"] = tex;
+			mat->_paramsDirty = true;
+		};
+		setTex(tex);
+		// the residency manager may swap in a texture with fewer mips when memory gets low
+		eng::Sys::Get()->_residency->Manage("data/grid2.png", true, tex, setTex);
+	});
 
 	eng::Model model;
 	model._mesh = mesh;
@@ -125,10 +143,173 @@ bool InitWorld(rhi::Swapchain *swapchain)
 	return true;
 }
 
-int main()
+// Loads the images in data/ over and over, first on the calling thread and then with the async loader
+// The longest time the calling thread is blocked for is what a frame loop would see as a hitch
+void BenchTextureLoading(uint32_t count)
+{
+	std::vector<std::string> paths;
+	for (auto &entry : std::filesystem::directory_iterator("data")) {
+		std::string ext = entry.path().extension().string();
+		if (ext == ".png" || ext == ".jpg" || ext == ".tga" || ext == ".bmp")
+			paths.push_back(entry.path().generic_string());
+	}
+	if (paths.empty()) {
+		std::cout << "No images to load in data/\n";
+		return;
+	}
+
+	using Clock = std::chrono::high_resolution_clock;
+	auto seconds = [](Clock::duration duration) { return std::chrono::duration<double>(duration).count(); };
+	rhi::Rhi *rhi = eng::Sys::Get()->_rhi.get();
+
+	std::vector<std::shared_ptr<rhi::Texture>> textures;
+	Clock::time_point start = Clock::now();
+	double maxBlocked = 0;
+	rhi->BeginFrame();
+	for (uint32_t i = 0; i < count; ++i) {
+		Clock::time_point loadStart = Clock::now();
+		textures.push_back(eng::Sys::Get()->LoadTexture(paths[i % paths.size()], true));
+		maxBlocked = std::max(maxBlocked, seconds(Clock::now() - loadStart));
+	}
+	rhi->WaitIdle();
+	double syncTime = seconds(Clock::now() - start);
+	std::cout << "Sync load of " << count << " textures " << syncTime * 1000 << " ms, longest block " << maxBlocked * 1000 << " ms.\n";
+	textures.clear();
+
+	eng::TextureLoader *texLoader = eng::Sys::Get()->_textureLoader.get();
+	start = Clock::now();
+	maxBlocked = 0;
+	uint32_t numFrames = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		texLoader->LoadAsync(paths[i % paths.size()], true, [&](std::shared_ptr<rhi::Texture> const &tex) {
+			textures.push_back(tex);
+		});
+	}
+	maxBlocked = seconds(Clock::now() - start);
+	while (!texLoader->IsIdle()) {
+		rhi->BeginFrame();
+		Clock::time_point updateStart = Clock::now();
+		texLoader->Update();
+		maxBlocked = std::max(maxBlocked, seconds(Clock::now() - updateStart));
+		++numFrames;
+	}
+	rhi->WaitIdle();
+	double asyncTime = seconds(Clock::now() - start);
+	std::cout << "Async load of " << count << " textures " << asyncTime * 1000 << " ms over " << numFrames << " frames, longest block " << maxBlocked * 1000 << " ms.\n";
+}
+
+void DrawMemoryWindow(rhi::Rhi *rhi)
+{
+	static bool s_detailed = false;
+	rhi::Rhi::MemoryStats stats = rhi->GetMemoryStats(s_detailed);
+	auto toMb = [](uint64_t bytes) { return bytes / (1024.0 * 1024.0); };
+
+	ImGui::Begin("Memory", nullptr, ImGuiWindowFlags_NoFocusOnAppearing);
+	ImGui::SetWindowPos(ImVec2(220, 10), ImGuiCond_Once);
+	ImGui::SetWindowSize(ImVec2(360, 300), ImGuiCond_Once);
+	ImGui::Checkbox("Detailed", &s_detailed);
+
+	ImGui::Text("Host: %.2f MB, internal %.2f MB, %llu allocs, %llu frees", toMb(stats._host._bytes), toMb(stats._host._internalBytes),
+		(unsigned long long)stats._host._allocations, (unsigned long long)stats._host._frees);
+
+	if (ImGui::CollapsingHeader("Heaps", ImGuiTreeNodeFlags_DefaultOpen)) {
+		for (uint32_t h = 0; h < stats._heaps.size(); ++h) {
+			auto &heap = stats._heaps[h];
+			ImGui::Text("%u%s: %.1f / %.1f MB budget, %.1f MB heap", h, heap._deviceLocal ? " local" : "", toMb(heap._budget._usage), toMb(heap._budget._budget), toMb(heap._size));
+			ImGui::Text("   %u blocks %.1f MB, %u allocs %.1f MB", heap._blocks, toMb(heap._blockBytes), heap._allocations, toMb(heap._allocationBytes));
+			if (s_detailed)
+				ImGui::Text("   %u free ranges, largest %.1f MB", heap._freeRanges, toMb(heap._largestFreeRange));
+		}
+		ImGui::Text("Defragmented %.1f MB, freed %.1f MB", toMb(stats._defragBytesMoved), toMb(stats._defragBytesFreed));
+	}
+
+	if (ImGui::CollapsingHeader("Resources", ImGuiTreeNodeFlags_DefaultOpen)) {
+		for (uint32_t k = 0; k < stats._resources.size(); ++k) {
+			auto &res = stats._resources[k];
+			ImGui::Text("%s: %u, %.1f MB", rhi::Rhi::GetResourceKindName((rhi::Rhi::ResourceKind)k), res._count, toMb(res._bytes));
+		}
+		auto &residency = eng::Sys::Get()->_residency->_stats;
+		ImGui::Text("Residency: %llu mips dropped, %llu reloads", (unsigned long long)residency._droppedMips, (unsigned long long)residency._reloads);
+	}
+
+	ImGui::Text("Pipelines: %u, %u variants", stats._pipelines, stats._pipelineVariants);
+
+	if (ImGui::CollapsingHeader("Objects")) {
+		for (auto &[type, count] : stats._objects)
+			ImGui::Text("%s: %u", type->_name.c_str(), count);
+	}
+
+	ImGui::End();
+}
+
+// Loads variants of the GLSL shaders in data/ twice, compiling them into an empty cache and then from the cache
+// The variants differ in a comment, so each of them is compiled and cached separately
+void BenchShaderLoading(uint32_t count)
+{
+	std::vector<std::pair<std::string, rhi::ShaderKind>> paths;
+	for (auto &entry : std::filesystem::directory_iterator("data")) {
+		std::string ext = entry.path().extension().string();
+		rhi::ShaderKind kind = ext == ".vert" ? rhi::ShaderKind::Vertex : ext == ".frag" ? rhi::ShaderKind::Fragment : ext == ".comp" ? rhi::ShaderKind::Compute : rhi::ShaderKind::Invalid;
+		if (kind != rhi::ShaderKind::Invalid)
+			paths.push_back({ entry.path().generic_string(), kind });
+	}
+	if (paths.empty()) {
+		std::cout << "No shaders to load in data/\n";
+		return;
+	}
+
+	rhi::Rhi *rhi = eng::Sys::Get()->_rhi.get();
+	std::string cacheDir = rhi->_settings._cacheDir;
+	rhi->_settings._cacheDir = "cache/bench_shaders";
+	std::error_code err;
+	std::filesystem::remove_all(rhi->_settings._cacheDir, err);
+
+	std::vector<std::vector<uint8_t>> sources;
+	for (uint32_t i = 0; i < count; ++i) {
+		std::vector<uint8_t> source = utl::ReadFile(paths[i % paths.size()].first);
+		std::string variant = "\n// variant " + std::to_string(i) + "\n";
+		source.insert(source.end(), variant.begin(), variant.end());
+		sources.push_back(std::move(source));
+	}
+
+	auto loadAll = [&] {
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < count; ++i) {
+			auto &[path, kind] = paths[i % paths.size()];
+			auto shader = rhi->Create<rhi::Shader>();
+			bool res = shader->Load(rhi::ShaderData{ ._name = utl::GetPathFilenameExt(path), ._kind = kind }, sources[i]);
+			ASSERT(res);
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+	double coldTime = loadAll();
+	double warmTime = loadAll();
+	std::cout << "Loading " << count << " shaders took " << coldTime << " ms compiling, " << warmTime << " ms from the cache.\n";
+
+	std::filesystem::remove_all(rhi->_settings._cacheDir, err);
+	rhi->_settings._cacheDir = cacheDir;
+}
+
+int main(int argc, char *argv[])
 {
 	std::cout << "Starting in " << std::filesystem::current_path() << std::endl;
 
+	uint32_t framesInFlight = 2;
+	uint32_t benchTextures = 0;
+	uint32_t benchShaders = 0;
+	bool offscreen = false;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--frames-in-flight" && i + 1 < argc)
+			framesInFlight = std::max(std::atoi(argv[++i]), 1);
+		if (arg == "--bench-textures")
+			benchTextures = i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? std::atoi(argv[++i]) : 500;
+		if (arg == "--bench-shaders")
+			benchShaders = i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? std::atoi(argv[++i]) : 300;
+		if (arg == "--offscreen")
+			offscreen = true;
+	}
+
 	utl::TypeInfo::Init();
 	utl::OnDestroy typesDone(utl::TypeInfo::Done);
 
@@ -144,11 +325,23 @@ int main()
 		},
 	});
 
-	eng::Sys::Get()->InitRhi(window);
+	// compare runs with and without the pipeline cache files to see the cold and warm startup times
+	auto startupBegin = std::chrono::steady_clock::now();
+	eng::Sys::Get()->InitRhi(window, 0, framesInFlight);
+
+	if (benchTextures) {
+		BenchTextureLoading(benchTextures);
+		return 0;
+	}
+	if (benchShaders) {
+		BenchShaderLoading(benchShaders);
+		return 0;
+	}
 
 	InitWorld(window->_swapchain.get());
 	eng::Sys::Get()->_scene = eng::Sys::Get()->_world->CreateScene();
 	ASSERT(eng::Sys::Get()->_scene->_camera);
+	std::cout << "Startup " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count() << " ms.\n";
 
 	rhi::Rhi *rhi = eng::Sys::Get()->_rhi.get();
 
@@ -172,6 +365,8 @@ int main()
 		}
 	};
 
+	rhi::RenderGraph renderGraph;
+
 	std::chrono::time_point startTime = std::chrono::high_resolution_clock::now();
 	std::chrono::time_point now = startTime;
 	uint64_t frame = 0;
@@ -188,15 +383,26 @@ int main()
 		if (any(equal(swapchainSize, glm::ivec2(0))))
 			continue;
 
+		bool res = rhi->BeginFrame();
+		ASSERT(res);
+
+		res = eng::Sys::Get()->_textureLoader->Update();
+		ASSERT(res);
+		res = eng::Sys::Get()->_residency->Update();
+		ASSERT(res);
+
 		auto swapchainTexture = window->_swapchain->AcquireNextImage();
 			
-		window->_imguiCtx->LayoutUi([] {
+		window->_imguiCtx->LayoutUi([&] {
 			ImGui::Begin("Fps", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoBackground /* | ImGuiWindowFlags_AlwaysAutoResize */);
 			ImGui::SetWindowPos(ImVec2(10, 10), ImGuiCond_Once);
-			ImGui::SetWindowSize(ImVec2(100, 20), ImGuiCond_Once);
+			ImGui::SetWindowSize(ImVec2(200, 60), ImGuiCond_Once);
 			ImGui::Text("%.1f FPS", ImGui::GetIO().Framerate);
+			ImGui::Text("%u submits, %u cmd buffers", rhi->_frameStats._prevFrameQueueSubmits, rhi->_frameStats._prevFrameCmdBuffers);
 			ImGui::End();
 
+			DrawMemoryWindow(rhi);
+
 			static PropTest tst, tst1;
 			tst._next = &tst1;
 			tst1._next = &tst;
@@ -206,9 +412,18 @@ int main()
 		});
 
 
+		// offscreen, the frame is drawn into a transient texture that's copied to the swapchain image at the end
+		std::shared_ptr<rhi::Texture> frameTexture = swapchainTexture;
+		if (offscreen) {
+			rhi::ResourceDescriptor frameDesc = swapchainTexture->_descriptor;
+			frameDesc._usage = rhi::ResourceUsage{ .rt = 1, .copySrc = 1 };
+			frameTexture = renderGraph.CreateTransientTexture(rhi, frameDesc, "Offscreen");
+			ASSERT(frameTexture);
+		}
+
 		std::array<rhi::RenderTargetData, 1> renderTargets{
 			{
-				swapchainTexture,
+				frameTexture,
 				glm::vec4(0, 0, 1 ,1),
 			},
 		};
@@ -222,27 +437,46 @@ int main()
 
 		window->_imguiCtx->Render(renderObjData._renderPass.get());
 
-		std::vector<std::shared_ptr<rhi::Pass>> passes{ renderObjData._updatePasses.begin(), renderObjData._updatePasses.end() };
+		for (auto &pass : renderObjData._updatePasses) {
+			renderGraph.AddPass(pass);
+		}
+
+		renderGraph.AddPass(renderObjData._renderPass);
 
-		passes.push_back(renderObjData._renderPass);
+		if (offscreen) {
+			auto copyFrame = rhi->Create<rhi::CopyPass>("CopyOffscreen");
+			res = copyFrame->Copy(rhi::CopyPass::CopyData{ ._src{frameTexture}, ._dst{swapchainTexture} });
+			ASSERT(res);
+			renderGraph.AddPass(copyFrame);
+		}
 
 		auto presentPass = rhi->Create<rhi::PresentPass>("Present");
 		presentPass->SetSwapchainTexture(swapchainTexture);
-		passes.push_back(presentPass);
+		renderGraph.AddPass(presentPass);
 
-		auto submission = rhi->Submit(std::move(passes), "Execute");
-		bool res = submission->Prepare();
+		auto submission = renderGraph.Submit(rhi, "Execute");
+		res = submission->Prepare();
 		ASSERT(res);
 		res = submission->Execute();
 		ASSERT(res);
-		res = submission->WaitUntilFinished();
-		ASSERT(res);
 
 		++frame;
 	}
 
+	rhi->WaitIdle();
+
 	double runtime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
 	std::cout << "Run time " << runtime << " seconds, " << frame << " frames, " << frame / runtime << " fps.\n";
+	rhi::Rhi::FrameStats const &frameStats = rhi->_frameStats;
+	if (frameStats._frames && frameStats._finishedFrames) {
+		std::cout << "Frames in flight " << rhi->GetFramesInFlight()
+			<< ", frame time " << runtime * 1000 / frame << " ms"
+			<< ", cpu wait " << frameStats._waitTime * 1000 / frameStats._frames << " ms"
+			<< ", latency " << frameStats._latency * 1000 / frameStats._finishedFrames << " ms"
+			<< ", submits " << (double)frameStats._queueSubmits / frameStats._frames
+			<< ", cmd buffers " << (double)frameStats._cmdBuffers / frameStats._frames << " per frame.\n";
+	}
+	std::cout << "Render graph compiles " << renderGraph._stats._compiles << ", cache hits " << renderGraph._stats._cacheHits << ".\n";
 	std::cout << "Bye!\n"; 
 
 	return 0;
@@ -128,6 +128,58 @@ bool BlendFuncState::operator==(BlendFuncState const &other) const
 		&& _colorWriteMask == other._colorWriteMask;
 }
 
+RenderState RenderState::GetStatic(DynamicState dynamic) const
+{
+	RenderState state = *this;
+	RenderState const defaults;
+	if (!!(dynamic & DynamicState::Viewport))
+		state._viewport = defaults._viewport;
+	if (!!(dynamic & DynamicState::Scissor))
+		state._scissor = defaults._scissor;
+	if (!!(dynamic & DynamicState::DepthBias)) {
+		state._depthBias._constantFactor = defaults._depthBias._constantFactor;
+		state._depthBias._clamp = defaults._depthBias._clamp;
+		state._depthBias._slopeFactor = defaults._depthBias._slopeFactor;
+	}
+	if (!!(dynamic & DynamicState::DepthBiasEnable))
+		state._depthBias._enable = defaults._depthBias._enable;
+	if (!!(dynamic & DynamicState::BlendColor))
+		state._blendColor = defaults._blendColor;
+	if (!!(dynamic & DynamicState::DepthBounds)) {
+		state._depthState._minDepthBounds = defaults._depthState._minDepthBounds;
+		state._depthState._maxDepthBounds = defaults._depthState._maxDepthBounds;
+	}
+	if (!!(dynamic & DynamicState::DepthTest)) {
+		state._depthState._depthTestEnable = defaults._depthState._depthTestEnable;
+		state._depthState._depthWriteEnable = defaults._depthState._depthWriteEnable;
+		state._depthState._depthCompareFunc = defaults._depthState._depthCompareFunc;
+		state._depthState._depthBoundsTestEnable = defaults._depthState._depthBoundsTestEnable;
+	}
+	if (!!(dynamic & DynamicState::Cull))
+		state._cullState = defaults._cullState;
+	for (size_t f = 0; f < state._stencilState.size(); ++f) {
+		StencilFuncState &stencil = state._stencilState[f];
+		StencilFuncState const &stencilDefaults = defaults._stencilState[f];
+		if (!!(dynamic & DynamicState::StencilValues)) {
+			stencil._compareMask = stencilDefaults._compareMask;
+			stencil._writeMask = stencilDefaults._writeMask;
+			stencil._reference = stencilDefaults._reference;
+		}
+		if (!!(dynamic & DynamicState::StencilOps)) {
+			stencil._failFunc = stencilDefaults._failFunc;
+			stencil._passFunc = stencilDefaults._passFunc;
+			stencil._depthFailFunc = stencilDefaults._depthFailFunc;
+			stencil._compareFunc = stencilDefaults._compareFunc;
+		}
+	}
+	if (!!(dynamic & DynamicState::StencilOps))
+		state._stencilEnable = defaults._stencilEnable;
+	// the number of render targets stays part of the pipeline
+	if (!!(dynamic & DynamicState::Blend))
+		std::fill(state._blendStates.begin(), state._blendStates.end(), BlendFuncState());
+	return state;
+}
+
 size_t RenderState::GetHash() const
 {
 	size_t hash = _viewport.GetHash();
@@ -231,6 +283,28 @@ size_t VertexInputData::GetHash() const
 	return hash;
 }
 
+size_t SpecializationConstant::GetHash() const
+{
+	size_t hash = utl::GetHash(_id);
+	hash = utl::GetHash(_value, hash);
+	return hash;
+}
+
+void PipelineData::SetSpecialization(SpecializationConstant constant)
+{
+	auto it = std::lower_bound(_specialization.begin(), _specialization.end(), constant._id, [](auto &c, uint32_t id) { return c._id < id; });
+	if (it != _specialization.end() && it->_id == constant._id)
+		*it = constant;
+	else
+		_specialization.insert(it, constant);
+}
+
+uint32_t PipelineData::GetSpecialization(uint32_t id, uint32_t defaultValue) const
+{
+	auto it = std::lower_bound(_specialization.begin(), _specialization.end(), id, [](auto &c, uint32_t id) { return c._id < id; });
+	return it != _specialization.end() && it->_id == id ? it->_value : defaultValue;
+}
+
 bool PipelineData::IsCompute() const 
 { 
 	return _shaders.size() == 1 && _shaders[0]->_kind == ShaderKind::Compute; 
@@ -249,7 +323,14 @@ void PipelineData::FillRenderTargetFormats(GraphicsPass *renderPass)
 glm::ivec3 PipelineData::GetComputeGroupSize() const
 {
 	Shader *compute = GetShader(ShaderKind::Compute);
-	return compute ? compute->_groupSize : glm::ivec3(0);
+	if (!compute)
+		return glm::ivec3(0);
+	glm::ivec3 groupSize = compute->_groupSize;
+	for (int32_t d = 0; d < 3; ++d) {
+		if (compute->_groupSizeConstants[d] != ~0u)
+			groupSize[d] = (int32_t)GetSpecialization(compute->_groupSizeConstants[d], groupSize[d]);
+	}
+	return groupSize;
 }
 
 size_t PipelineData::GetHash() const
@@ -259,6 +340,8 @@ size_t PipelineData::GetHash() const
 	hash = utl::GetHash(_renderTargetFormats, hash);
 	hash = utl::GetHash(_vertexInputs, hash);
 	hash = utl::GetHash(_primitiveKind, hash);
+	hash = utl::GetHash(_dynamicBuffers, hash);
+	hash = utl::GetHash(_specialization, hash);
 	return hash;
 }
 
@@ -314,12 +397,59 @@ bool ResourceRef::IsViewValid()
 	return _view.IsValidFor(resource->_descriptor);
 }
 
+struct FormatBlock {
+	glm::ivec2 _size{ 1 };
+	uint32_t _bytes = 0;
+};
+
+static std::unordered_map<Format, FormatBlock> const s_compressedFormatBlocks{ {
+		{ Format::BC1,                { { 4, 4 }, 8  } },
+		{ Format::BC1_srgb,           { { 4, 4 }, 8  } },
+		{ Format::BC2,                { { 4, 4 }, 16 } },
+		{ Format::BC2_srgb,           { { 4, 4 }, 16 } },
+		{ Format::BC3,                { { 4, 4 }, 16 } },
+		{ Format::BC3_srgb,           { { 4, 4 }, 16 } },
+		{ Format::BC4,                { { 4, 4 }, 8  } },
+		{ Format::BC5,                { { 4, 4 }, 16 } },
+		{ Format::BC6H_uf,            { { 4, 4 }, 16 } },
+		{ Format::BC7,                { { 4, 4 }, 16 } },
+		{ Format::BC7_srgb,           { { 4, 4 }, 16 } },
+		{ Format::ETC2_R8G8B8,        { { 4, 4 }, 8  } },
+		{ Format::ETC2_R8G8B8_srgb,   { { 4, 4 }, 8  } },
+		{ Format::ETC2_R8G8B8A8,      { { 4, 4 }, 16 } },
+		{ Format::ETC2_R8G8B8A8_srgb, { { 4, 4 }, 16 } },
+		{ Format::ASTC_4x4,           { { 4, 4 }, 16 } },
+		{ Format::ASTC_4x4_srgb,      { { 4, 4 }, 16 } },
+		{ Format::ASTC_6x6,           { { 6, 6 }, 16 } },
+		{ Format::ASTC_6x6_srgb,      { { 6, 6 }, 16 } },
+		{ Format::ASTC_8x8,           { { 8, 8 }, 16 } },
+		{ Format::ASTC_8x8_srgb,      { { 8, 8 }, 16 } },
+	} };
+
 uint32_t GetFormatSize(Format fmt)
 {
+	if (IsCompressed(fmt)) {
+		auto it = s_compressedFormatBlocks.find(fmt);
+		return it != s_compressedFormatBlocks.end() ? it->second._bytes : 0;
+	}
 	TypeInfo const *type = s_format2TypeInfo[fmt];
 	return type ? type->_size : 0;
 }
 
+glm::ivec2 GetFormatBlockSize(Format fmt)
+{
+	auto it = s_compressedFormatBlocks.find(fmt);
+	return it != s_compressedFormatBlocks.end() ? it->second._size : glm::ivec2(1);
+}
+
+uint32_t GetFormatRegionSize(Format fmt, glm::ivec3 size)
+{
+	glm::ivec2 blockSize = GetFormatBlockSize(fmt);
+	size = glm::max(size, glm::ivec3(1));
+	glm::ivec2 numBlocks = (glm::ivec2(size) + blockSize - 1) / blockSize;
+	return GetFormatSize(fmt) * numBlocks.x * numBlocks.y * size.z;
+}
+
 int8_t GetMaxMipLevels(glm::ivec3 dims)
 {
 	uint32_t maxDim = utl::VecMaxElem(dims);
@@ -62,6 +62,29 @@ enum class Format : int32_t {
 	B8G8R8A8,
 	B8G8R8A8_srgb,
 
+	// block compressed, usable where the device supports them
+	BC1,
+	BC1_srgb,
+	BC2,
+	BC2_srgb,
+	BC3,
+	BC3_srgb,
+	BC4,
+	BC5,
+	BC6H_uf,
+	BC7,
+	BC7_srgb,
+	ETC2_R8G8B8,
+	ETC2_R8G8B8_srgb,
+	ETC2_R8G8B8A8,
+	ETC2_R8G8B8A8_srgb,
+	ASTC_4x4,
+	ASTC_4x4_srgb,
+	ASTC_6x6,
+	ASTC_6x6_srgb,
+	ASTC_8x8,
+	ASTC_8x8_srgb,
+
 	D32,
 	D32S8,
 	D24S8,
@@ -69,6 +92,9 @@ enum class Format : int32_t {
 
 	Count,
 
+	CompressedFirst = BC1,
+	CompressedLast = ASTC_8x8_srgb,
+
 	DepthFirst = D32,
 	DepthLast = D24S8,
 	StencilFirst = D32S8,
@@ -82,6 +108,8 @@ static inline std::unordered_map<Format, TypeInfo const *> s_format2TypeInfo{ {
 		{ Format::R8, TypeInfo::Get<uint8_t>() },
 		{ Format::R16_u, TypeInfo::Get<uint16_t>() },
 		{ Format::R32_u, TypeInfo::Get<uint32_t>() },
+		{ Format::R8G8, TypeInfo::Get<glm::u8vec2>() },
+		{ Format::R8G8B8, TypeInfo::Get<glm::u8vec3>() },
 		{ Format::R8G8B8A8, TypeInfo::Get<glm::u8vec4>() },
 		{ Format::R8G8B8A8_srgb, TypeInfo::Get<glm::u8vec4>() },
 		{ Format::B8G8R8A8, TypeInfo::Get<uint32_t>() },
@@ -90,16 +118,34 @@ static inline std::unordered_map<Format, TypeInfo const *> s_format2TypeInfo{ {
 		{ Format::S8, TypeInfo::Get<uint8_t>() },
 	} };
 
+// Size in bytes of a texel, or of a block of texels for compressed formats
 uint32_t GetFormatSize(Format fmt);
+// Texels in a block of a compressed format, 1x1 for the others
+glm::ivec2 GetFormatBlockSize(Format fmt);
+// Size in bytes of a tightly packed region, compressed formats store whole blocks at the region's edges
+uint32_t GetFormatRegionSize(Format fmt, glm::ivec3 size);
 
 int8_t GetMaxMipLevels(glm::ivec3 dims);
 glm::ivec3 GetMipLevelSize(glm::ivec3 dims, int32_t mipLevel);
 
+// How the cpu uses the memory of a resource with cpuAccess usage
+enum class HostAccess : int8_t {
+	// picked from the usage, mapped only while accessed
+	Auto,
+	// sequential writes of data the device copies or reads once, mapped for the resource's lifetime
+	Upload,
+	// sequential writes of data the device reads directly, in device local memory when the host can see it (ReBAR)
+	Dynamic,
+	// random reads of the device's results, in cached memory and mapped for the resource's lifetime
+	Readback,
+};
+
 struct ResourceDescriptor {
 	ResourceUsage _usage;
 	Format _format = Format::Invalid;
 	glm::ivec4 _dimensions{ 0 };
 	int8_t _mipLevels = 1;
+	HostAccess _hostAccess = HostAccess::Auto;
 
 	void SetMaxMipLevels() { _mipLevels = GetMaxMipLevels(_dimensions); }
 
@@ -110,6 +156,8 @@ struct ResourceDescriptor {
 
 	bool IsCube() const { return IsCube(_dimensions); }
 	static bool IsCube(glm::ivec4 dims);
+
+	bool operator==(ResourceDescriptor const &other) const = default;
 };
 
 struct ResourceView {
@@ -130,7 +178,8 @@ struct ResourceView {
 	static ResourceView FromDescriptor(ResourceDescriptor const &desc, int8_t minMip, int8_t numMips = std::numeric_limits<int8_t>::max());
 };
 
-using ResourceEnum = std::function<void(Resource *, ResourceUsage)>;
+// Called with each resource a pass uses, the view limits the usage to a range of its subresources
+using ResourceEnum = std::function<void(Resource *, ResourceUsage, ResourceView const &)>;
 
 struct ResourceRef {
 	std::shared_ptr<Bindable> _bindable;
@@ -152,6 +201,44 @@ inline bool IsDepthStencil(Format fmt) {
 	return Format::DepthStencilFirst <= fmt && fmt <= Format::DepthStencilLast;
 }
 
+inline bool IsCompressed(Format fmt) {
+	return Format::CompressedFirst <= fmt && fmt <= Format::CompressedLast;
+}
+
+// The format with the same layout that stores the values as they are
+inline Format GetLinearFormat(Format fmt) {
+	switch (fmt) {
+		case Format::R8G8B8A8_srgb:
+			return Format::R8G8B8A8;
+		case Format::B8G8R8A8_srgb:
+			return Format::B8G8R8A8;
+		case Format::BC1_srgb:
+			return Format::BC1;
+		case Format::BC2_srgb:
+			return Format::BC2;
+		case Format::BC3_srgb:
+			return Format::BC3;
+		case Format::BC7_srgb:
+			return Format::BC7;
+		case Format::ETC2_R8G8B8_srgb:
+			return Format::ETC2_R8G8B8;
+		case Format::ETC2_R8G8B8A8_srgb:
+			return Format::ETC2_R8G8B8A8;
+		case Format::ASTC_4x4_srgb:
+			return Format::ASTC_4x4;
+		case Format::ASTC_6x6_srgb:
+			return Format::ASTC_6x6;
+		case Format::ASTC_8x8_srgb:
+			return Format::ASTC_8x8;
+		default:
+			return fmt;
+	}
+}
+
+inline bool IsSrgb(Format fmt) {
+	return GetLinearFormat(fmt) != fmt;
+}
+
 enum class ShaderKind: int8_t {
 	Invalid = -1,
 	Vertex,
@@ -160,6 +247,15 @@ enum class ShaderKind: int8_t {
 	Count,
 };
 
+// Queue a submission executes on, devices without a separate one alias it to the universal queue
+enum class QueueKind : int8_t {
+	Invalid = -1,
+	Universal,
+	Compute,
+	Transfer,
+	Count,
+};
+
 enum class PresentMode : int8_t {
 	Invalid = -1,
 	Immediate,
@@ -331,7 +427,37 @@ struct BlendFuncState {
 	bool operator==(BlendFuncState const &other) const;
 };
 
+// Parts of the render state set with each draw instead of being compiled into the pipelines
+// The rhi sets the parts its device supports, pipelines that only differ in them share a device pipeline
+enum class DynamicState : uint32_t {
+	None = 0,
+	Viewport = 1 << 0,
+	Scissor = 1 << 1,
+	// the bias factors and clamp
+	DepthBias = 1 << 2,
+	BlendColor = 1 << 3,
+	DepthBounds = 1 << 4,
+	// the compare and write masks and the reference values
+	StencilValues = 1 << 5,
+	Cull = 1 << 6,
+	// the test and write enables, the compare function and the bounds test enable
+	DepthTest = 1 << 7,
+	// the test enable and the stencil functions
+	StencilOps = 1 << 8,
+	DepthBiasEnable = 1 << 9,
+	// the blend enables, functions and write masks of the render targets
+	Blend = 1 << 10,
+
+	// supported by all devices
+	Basic = Viewport | Scissor | DepthBias | BlendColor | DepthBounds | StencilValues,
+};
+
+DEFINE_ENUM_BIT_OPERATORS(DynamicState)
+
 struct RenderState {
+	// With the dynamic parts at their defaults, pipelines are keyed and compiled with it
+	RenderState GetStatic(DynamicState dynamic) const;
+
 	Viewport _viewport;
 	utl::RectI _scissor{glm::ivec2(0), glm::ivec2(1024*1024)};
 	CullState _cullState;
@@ -367,6 +493,15 @@ struct VertexInputData {
 	size_t GetHash() const;
 };
 
+// The value of a shader specialization constant, bool constants are 0 or 1
+struct SpecializationConstant {
+	uint32_t _id = 0;
+	uint32_t _value = 0;
+
+	bool operator ==(SpecializationConstant const &other) const = default;
+	size_t GetHash() const;
+};
+
 struct Shader;
 struct GraphicsPass;
 struct PipelineData {
@@ -375,6 +510,24 @@ struct PipelineData {
 	std::vector<Format> _renderTargetFormats;
 	std::vector<VertexInputData> _vertexInputs;
 	PrimitiveKind _primitiveKind = PrimitiveKind::TriangleList;
+	// buffer params bound with an offset given per draw or dispatch, so one resource set can serve many of them
+	std::vector<std::string> _dynamicBuffers;
+	// shared by all the shaders, sorted by id, the constants not given keep the values in the shaders
+	std::vector<SpecializationConstant> _specialization;
+
+	template <typename T>
+	void SetSpecialization(uint32_t id, T value) {
+		// constants are 32 bit words and smaller types would need sign extension, bools are widened to 0 or 1
+		static_assert((std::is_same_v<T, bool> || sizeof(T) == sizeof(uint32_t)) && std::is_trivially_copyable_v<T>);
+		SpecializationConstant constant{ ._id = id };
+		if constexpr (std::is_same_v<T, bool>)
+			constant._value = value;
+		else
+			memcpy(&constant._value, &value, sizeof(T));
+		SetSpecialization(constant);
+	}
+	void SetSpecialization(SpecializationConstant constant);
+	uint32_t GetSpecialization(uint32_t id, uint32_t defaultValue) const;
 
 	bool IsEmpty() const { return _shaders.empty(); }
 	bool IsCompute() const;
@@ -433,6 +586,9 @@ struct hash<rhi::RenderState> { size_t operator()(rhi::RenderState const &r) con
 template<>
 struct hash<rhi::ShaderData> { size_t operator()(rhi::ShaderData const &s) const { return s.GetHash(); } };
 
+template<>
+struct hash<rhi::SpecializationConstant> { size_t operator()(rhi::SpecializationConstant const &s) const { return s.GetHash(); } };
+
 template<>
 struct hash<rhi::VertexInputData> { size_t operator()(rhi::VertexInputData const &v) const { return v.GetHash(); } };
 
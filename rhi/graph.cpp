@@ -0,0 +1,253 @@
+#include "graph.h"
+#include "rhi.h"
+#include "pass.h"
+#include "resource.h"
+#include "submit.h"
+
+namespace rhi {
+
+void RenderGraph::AddPass(std::shared_ptr<Pass> pass)
+{
+	PassNode &node = _nodes.emplace_back();
+	node._pass = std::move(pass);
+	std::unordered_map<Resource *, uint32_t> accessIndices;
+	node._pass->EnumResources([&](Resource *resource, ResourceUsage usage, ResourceView const &view) {
+		auto [it, inserted] = accessIndices.insert({ resource, (uint32_t)node._accesses.size() });
+		if (inserted) {
+			// the key has the order resources first appear in, so the ones that change between frames, like the swapchain
+			// images, give the same key
+			uint32_t ordinal = _resourceOrdinals.insert({ resource, (uint32_t)_resourceOrdinals.size() }).first->second;
+			node._accesses.push_back(PassAccess{ ._resource = resource, ._ordinal = ordinal, ._usage = usage });
+		} else {
+			node._accesses[it->second]._usage |= usage;
+		}
+	});
+}
+
+void RenderGraph::SetTransient(Resource *resource, bool transient)
+{
+	if (transient)
+		_transient.insert(resource);
+	else
+		_transient.erase(resource);
+}
+
+std::shared_ptr<Texture> RenderGraph::CreateTransientTexture(Rhi *rhi, ResourceDescriptor const &desc, std::string name)
+{
+	if (!_transientHeap)
+		_transientHeap = rhi->Create<TransientHeap>("TransientHeap");
+	auto texture = _transientHeap->CreateTexture(desc, name);
+	if (!texture)
+		return nullptr;
+	SetTransient(texture.get());
+	_transientLifetimes[texture.get()] = TransientLifetime{ ._first = (uint32_t)_nodes.size() };
+	return texture;
+}
+
+void RenderGraph::ReleaseTransient(Texture *texture)
+{
+	auto it = _transientLifetimes.find(texture);
+	ASSERT(it != _transientLifetimes.end() && it->second._last == ~0u);
+	ASSERT(it->second._first < _nodes.size());
+	it->second._last = (uint32_t)_nodes.size() - 1;
+	_transientHeap->Release(texture);
+}
+
+std::shared_ptr<Submission> RenderGraph::Submit(Rhi *rhi, std::string name)
+{
+	++_numSubmits;
+	for (auto &[resource, lifetime] : _transientLifetimes) {
+		lifetime._last = std::min(lifetime._last, (uint32_t)_nodes.size() - 1);
+	}
+	std::vector<size_t> key = GetTopologyKey();
+	auto it = _compiled.find(key);
+	if (it == _compiled.end()) {
+		if (_compiled.size() >= _maxCompiled) {
+			auto itOldest = std::min_element(_compiled.begin(), _compiled.end(), [](auto const &c0, auto const &c1) {
+				return c0.second._lastUse < c1.second._lastUse;
+			});
+			_compiled.erase(itOldest);
+		}
+		it = _compiled.insert({ std::move(key), Compile() }).first;
+		++_stats._compiles;
+	} else {
+		++_stats._cacheHits;
+	}
+	it->second._lastUse = _numSubmits;
+
+	std::vector<std::shared_ptr<Pass>> passes;
+	for (uint32_t index : it->second._order) {
+		passes.push_back(std::move(_nodes[index]._pass));
+	}
+	_stats._lastCulledPasses = (uint32_t)(_nodes.size() - passes.size());
+	_nodes.clear();
+	_resourceOrdinals.clear();
+
+	// the heap's memory is placed from scratch for the next frame, the barriers of the textures' first uses
+	// wait for the work of this one
+	for (auto &[resource, lifetime] : _transientLifetimes) {
+		_transient.erase(resource);
+	}
+	_transientLifetimes.clear();
+	if (_transientHeap)
+		_transientHeap->Reset();
+
+	auto sub = rhi->Submit(std::move(passes), name);
+	sub->_mergeTransitions = true;
+
+	return sub;
+}
+
+std::vector<size_t> RenderGraph::GetTopologyKey()
+{
+	std::vector<size_t> key;
+	for (auto &node : _nodes) {
+		key.push_back((size_t)node._pass->GetTypeInfo());
+		key.push_back(node._accesses.size());
+		for (auto &access : node._accesses) {
+			key.push_back(access._ordinal);
+			key.push_back(access._usage._flags);
+			key.push_back(_transient.contains(access._resource));
+			auto itLifetime = _transientLifetimes.find(access._resource);
+			if (itLifetime != _transientLifetimes.end()) {
+				key.push_back(itLifetime->second._first);
+				key.push_back(itLifetime->second._last);
+			}
+		}
+	}
+	return key;
+}
+
+RenderGraph::Compiled RenderGraph::Compile()
+{
+	uint32_t numNodes = (uint32_t)_nodes.size();
+
+	// walking back from the last pass, a pass is kept if it has no writes, writes a resource that outlives the graph,
+	// or writes something a kept pass after it reads
+	std::vector<bool> alive(numNodes, false);
+	std::unordered_set<Resource *> readResources;
+	for (int32_t n = (int32_t)numNodes - 1; n >= 0; --n) {
+		PassNode &node = _nodes[n];
+		bool hasWrites = false, isAlive = false;
+		for (auto &access : node._accesses) {
+			if (!access._usage.write)
+				continue;
+			hasWrites = true;
+			if (!_transient.contains(access._resource) || readResources.contains(access._resource)) {
+				isAlive = true;
+				break;
+			}
+		}
+		if (hasWrites && !isAlive)
+			continue;
+		alive[n] = true;
+		for (auto &access : node._accesses) {
+			if (access._usage.read)
+				readResources.insert(access._resource);
+		}
+	}
+
+	// dependencies between the kept passes: reads and writes after a write, writes after reads
+	struct ResourceState {
+		int32_t _lastWriter = -1;
+		std::vector<uint32_t> _readers;
+	};
+	std::unordered_map<Resource *, ResourceState> resourceStates;
+	std::vector<std::vector<uint32_t>> dependencies(numNodes), dependents(numNodes);
+	for (uint32_t n = 0; n < numNodes; ++n) {
+		if (!alive[n])
+			continue;
+		auto addDependency = [&](uint32_t dep) {
+			if (dep == n || std::find(dependencies[n].begin(), dependencies[n].end(), dep) != dependencies[n].end())
+				return;
+			dependencies[n].push_back(dep);
+			dependents[dep].push_back(n);
+		};
+		for (auto &access : _nodes[n]._accesses) {
+			ResourceState &state = resourceStates[access._resource];
+			if (state._lastWriter >= 0)
+				addDependency(state._lastWriter);
+			if (access._usage.write) {
+				for (uint32_t reader : state._readers) {
+					addDependency(reader);
+				}
+				state._readers.clear();
+				state._lastWriter = n;
+			} else {
+				state._readers.push_back(n);
+			}
+		}
+	}
+
+	// a transient texture may share memory with the ones released before its creation, so the passes using it
+	// have to stay after the passes using those
+	std::vector<uint32_t> firstRelease(numNodes, ~0u);
+	for (uint32_t n = 0; n < numNodes; ++n) {
+		for (auto &access : _nodes[n]._accesses) {
+			auto itLifetime = _transientLifetimes.find(access._resource);
+			if (itLifetime == _transientLifetimes.end())
+				continue;
+			ASSERT(itLifetime->second._first <= n && n <= itLifetime->second._last);
+			firstRelease[n] = std::min(firstRelease[n], itLifetime->second._last);
+		}
+	}
+	for (uint32_t n = 0; n < numNodes; ++n) {
+		if (!alive[n])
+			continue;
+		uint32_t lastCreated = 0;
+		for (auto &access : _nodes[n]._accesses) {
+			auto itLifetime = _transientLifetimes.find(access._resource);
+			if (itLifetime != _transientLifetimes.end())
+				lastCreated = std::max(lastCreated, itLifetime->second._first);
+		}
+		for (uint32_t m = 0; m < std::min(lastCreated, n); ++m) {
+			if (!alive[m] || firstRelease[m] >= lastCreated)
+				continue;
+			if (std::find(dependencies[n].begin(), dependencies[n].end(), m) != dependencies[n].end())
+				continue;
+			dependencies[n].push_back(m);
+			dependents[m].push_back(n);
+		}
+	}
+
+	// list scheduling, of the ready passes the one whose producers were scheduled the longest ago goes first,
+	// so the barriers waiting on a producer end up as far from it as possible
+	Compiled compiled;
+	std::vector<int32_t> positions(numNodes, -1);
+	std::vector<uint32_t> numPending(numNodes);
+	std::vector<uint32_t> ready;
+	for (uint32_t n = 0; n < numNodes; ++n) {
+		if (!alive[n])
+			continue;
+		numPending[n] = (uint32_t)dependencies[n].size();
+		if (!numPending[n])
+			ready.push_back(n);
+	}
+	while (!ready.empty()) {
+		auto itBest = ready.end();
+		int32_t bestLatest = std::numeric_limits<int32_t>::max();
+		for (auto it = ready.begin(); it != ready.end(); ++it) {
+			int32_t latest = -1;
+			for (uint32_t dep : dependencies[*it]) {
+				latest = std::max(latest, positions[dep]);
+			}
+			if (latest < bestLatest || latest == bestLatest && *it < *itBest) {
+				itBest = it;
+				bestLatest = latest;
+			}
+		}
+		uint32_t n = *itBest;
+		ready.erase(itBest);
+		positions[n] = (int32_t)compiled._order.size();
+		compiled._order.push_back(n);
+		for (uint32_t dependent : dependents[n]) {
+			if (!--numPending[dependent])
+				ready.push_back(dependent);
+		}
+	}
+	ASSERT((ptrdiff_t)compiled._order.size() == std::count(alive.begin(), alive.end(), true));
+
+	return compiled;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "base.h"
+
+namespace rhi {
+
+struct Rhi;
+struct Pass;
+struct Resource;
+struct Texture;
+struct TransientHeap;
+struct Submission;
+
+// Builds a submission out of passes and the resources they read and write, as reported by Pass::EnumResources
+// Passes whose writes nobody reads are culled and independent passes are reordered away from their producers
+// The compiled order is cached by the graph's topology, so building the graph every frame stays cheap
+struct RenderGraph {
+	struct PassAccess {
+		Resource *_resource = nullptr;
+		// order of the resource's first appearance in the graph, the topology key uses it instead of the address
+		uint32_t _ordinal = 0;
+		ResourceUsage _usage;
+	};
+
+	struct PassNode {
+		std::shared_ptr<Pass> _pass;
+		// the pass's usages combined per resource, in the order the pass enumerates them
+		std::vector<PassAccess> _accesses;
+	};
+
+	struct Compiled {
+		// indices of the passes that weren't culled, in execution order
+		std::vector<uint32_t> _order;
+		uint64_t _lastUse = 0;
+	};
+
+	// Range of the graph's passes that may use a transient texture
+	struct TransientLifetime {
+		uint32_t _first = 0, _last = ~0u;
+	};
+
+	struct Stats {
+		uint64_t _compiles = 0;
+		uint64_t _cacheHits = 0;
+		uint32_t _lastCulledPasses = 0;
+	};
+
+	void AddPass(std::shared_ptr<Pass> pass);
+	// Writes to transient resources only matter if a later pass reads them, writes to other resources are always kept
+	void SetTransient(Resource *resource, bool transient = true);
+
+	// Creates a texture that shares memory with the transient textures released before it
+	// It can be used from the next pass added until it's released, or until the end of the graph
+	std::shared_ptr<Texture> CreateTransientTexture(Rhi *rhi, ResourceDescriptor const &desc, std::string name = "");
+	void ReleaseTransient(Texture *texture);
+
+	// Compiles the added passes or reuses the cached result for the same topology, and submits them
+	// The graph is left empty for the next frame's passes
+	std::shared_ptr<Submission> Submit(Rhi *rhi, std::string name = "");
+
+	std::vector<size_t> GetTopologyKey();
+	Compiled Compile();
+
+	std::vector<PassNode> _nodes;
+	std::unordered_map<Resource *, uint32_t> _resourceOrdinals;
+	std::unordered_set<Resource *> _transient;
+	std::shared_ptr<TransientHeap> _transientHeap;
+	std::unordered_map<Resource *, TransientLifetime> _transientLifetimes;
+	std::unordered_map<std::vector<size_t>, Compiled> _compiled;
+	uint32_t _maxCompiled = 8;
+	uint64_t _numSubmits = 0;
+	Stats _stats;
+};
+
+}
\ No newline at end of file
@@ -20,20 +20,57 @@ static auto s_regTypes = TypeInfo::AddInitializer("pass", [] {
 });
 
 
+static uint32_t GetNumDynamicOffsets(std::span<std::shared_ptr<ResourceSet>> resourceSets)
+{
+	uint32_t numOffsets = 0;
+	for (auto &set : resourceSets) {
+		numOffsets += set->GetSetDescription()->GetNumDynamicOffsets();
+	}
+	return numOffsets;
+}
+
 bool GraphicsPass::Init(std::span<RenderTargetData> rts, utl::BoxF const &viewport)
 {
 	_renderTargets.insert(_renderTargets.end(), rts.begin(), rts.end());
 	glm::ivec2 rtSize = _renderTargets[0]._texture->_descriptor._dimensions;
 	utl::BoxF rtLimits = utl::BoxF::FromMinAndSize(glm::vec3(0), glm::vec3(rtSize, 1.0f));
 	_viewport = rtLimits.GetIntersection(viewport);
+	_contexts.resize(1);
+	return true;
+}
+
+bool GraphicsPass::InitContexts(uint32_t numContexts)
+{
+	ASSERT(numContexts > 0);
+	for (auto &context : _contexts) {
+		if (context._pipelines.size())
+			return false;
+	}
+	_contexts.resize(numContexts);
 	return true;
 }
 
-bool GraphicsPass::Draw(DrawData const &draw)
+uint32_t GraphicsPass::AddContext()
 {
-	_pipelines.insert(draw._pipeline);
+	_contexts.emplace_back();
+	return (uint32_t)_contexts.size() - 1;
+}
+
+bool GraphicsPass::Draw(DrawData const &draw, uint32_t context)
+{
+	ASSERT(context < _contexts.size());
+	if (GetNumDynamicOffsets(draw._resourceSets) != draw._dynamicOffsets.size()) {
+		ASSERT(0);
+		return false;
+	}
+	if (draw._pushConstants.size() > draw._pipeline->_pushConstants.GetEnd()) {
+		ASSERT(0);
+		return false;
+	}
+	RecordContext &recordContext = _contexts[context];
+	recordContext._pipelines.insert(draw._pipeline);
 	for (auto &set : draw._resourceSets) {
-		_resourceSets.insert(set);
+		recordContext._resourceSets.insert(set);
 	}
 	return true;
 }
@@ -43,10 +80,12 @@ void GraphicsPass::EnumResources(ResourceEnum enumFn)
 	for (auto &target : _renderTargets) {
 		ResourceUsage usage{ target._texture->_descriptor._usage & ResourceUsage{.rt=1, .ds=1} | ResourceUsage{.write=1} };
 		ASSERT(bool(usage & ResourceUsage{ .rt = 1, .ds = 1 }));
-		enumFn(target._texture.get(), usage);
+		enumFn(target._texture.get(), usage, ResourceView::FromDescriptor(target._texture->_descriptor, 0));
 	}
-	for (auto &set : _resourceSets) {
-		set->EnumResources(enumFn);
+	for (auto &context : _contexts) {
+		for (auto &set : context._resourceSets) {
+			set->EnumResources(enumFn);
+		}
 	}
 }
 
@@ -68,10 +107,10 @@ std::shared_ptr<Swapchain> PresentPass::GetSwapchain()
 void PresentPass::EnumResources(ResourceEnum enumFn)
 {
 	ASSERT(bool(_swapchainTexture->_descriptor._usage & ResourceUsage{ .present=1 }));
-	enumFn(_swapchainTexture.get(), ResourceUsage{.present=1, .read=1});
+	enumFn(_swapchainTexture.get(), ResourceUsage{.present=1, .read=1}, ResourceView::FromDescriptor(_swapchainTexture->_descriptor, 0));
 }
 
-bool ComputePass::Init(Pipeline *pipeline, std::span<std::shared_ptr<ResourceSet>> resourceSets, glm::ivec3 numGroups)
+bool ComputePass::Init(Pipeline *pipeline, std::span<std::shared_ptr<ResourceSet>> resourceSets, glm::ivec3 numGroups, std::span<uint32_t> dynamicOffsets, std::span<uint8_t const> pushConstants)
 {
 	ASSERT(!_pipeline);
 	ASSERT(_resourceSets.empty());
@@ -82,6 +121,12 @@ bool ComputePass::Init(Pipeline *pipeline, std::span<std::shared_ptr<ResourceSet
 	_pipeline = static_pointer_cast<Pipeline>(pipeline->shared_from_this());
 	_resourceSets.insert(_resourceSets.end(), resourceSets.begin(), resourceSets.end());
 	_numGroups = numGroups;
+	if (GetNumDynamicOffsets(resourceSets) != dynamicOffsets.size())
+		return false;
+	_dynamicOffsets.assign(dynamicOffsets.begin(), dynamicOffsets.end());
+	if (pushConstants.size() > pipeline->_pushConstants.GetEnd())
+		return false;
+	_pushConstants.assign(pushConstants.begin(), pushConstants.end());
 
 
 	// should we check resource sets are suitable for the pipeline? that numgroups are valid?
@@ -106,9 +151,28 @@ bool CopyPass::Copy(CopyData copy)
 		return false;
 	if (!srcRes->_descriptor._usage.copySrc || !dstRes->_descriptor._usage.copyDst) 
 		return false;
-	// Only allow multiple copies per pass if they have the same source / destination resources
-	if (_copies.size() > 0 && (srcRes != _copies[0]._src._bindable.get() || dstRes != _copies[0]._dst._bindable.get()))
+	// A resource can only be both a source and a destination in copies within itself, which record their own barriers
+	enum : uint8_t { RoleSrc = 1, RoleDst = 2, RoleInternal = 4 };
+	uint8_t srcRoles = 0, dstRoles = 0;
+	for (auto &other : _copies) {
+		bool otherInternal = other._src._bindable == other._dst._bindable;
+		auto addRoles = [&](Resource *res, uint8_t &roles) {
+			if (other._src._bindable.get() == res)
+				roles |= otherInternal ? RoleInternal : RoleSrc;
+			if (other._dst._bindable.get() == res)
+				roles |= otherInternal ? RoleInternal : RoleDst;
+		};
+		addRoles(srcRes, srcRoles);
+		addRoles(dstRes, dstRoles);
+	}
+	bool rolesMatch = srcRes == dstRes ? !(srcRoles & ~RoleInternal) : !(srcRoles & ~RoleSrc) && !(dstRoles & ~RoleDst);
+	if (!rolesMatch)
 		return false;
+	// filled buffers get no barrier between the fill and the copies
+	for (auto &fill : _fills) {
+		if (fill._dst._bindable.get() == srcRes || fill._dst._bindable.get() == dstRes)
+			return false;
+	}
 
 	CopyType cpType = copy.GetCopyType();
 	if (!cpType.srcTex && !cpType.dstTex || cpType.srcTex && cpType.dstTex && NeedsMatchingTextures(copy)) {
@@ -119,12 +183,21 @@ bool CopyPass::Copy(CopyData copy)
 		// texture and buffer
 		auto &refBuf = cpType.srcTex ? copy._dst : copy._src;
 		auto &refTex = cpType.srcTex ? copy._src : copy._dst;
-		uint32_t pixSize = GetFormatSize(refTex._view._format);
-		uint32_t rowSize = pixSize * refTex._view._region.GetSize()[0];
-		uint32_t sliceSize = rowSize * refTex._view._region.GetSize()[1];
+		glm::ivec2 blockSize = GetFormatBlockSize(refTex._view._format);
+		if (blockSize != glm::ivec2(1)) {
+			// compressed formats copy whole blocks, a region can only end partway through a block at the edge of the mip
+			Resource *texRes = cpType.srcTex ? srcRes : dstRes;
+			glm::ivec2 mipSize(texRes->_descriptor.GetMipDims(refTex._view._mipRange._min));
+			glm::ivec2 rgnMin(refTex._view._region._min);
+			glm::ivec2 rgnEnd = rgnMin + glm::ivec2(refTex._view._region.GetSize());
+			if (any(notEqual(rgnMin % blockSize, glm::ivec2(0))))
+				return false;
+			if (any(notEqual(rgnEnd % blockSize, glm::ivec2(0)) && notEqual(rgnEnd, mipSize)))
+				return false;
+		}
 		// 3d images can't be arrays, so we take the size of either the 3rd dimension, or array slices, whichever is greater
 		glm::ivec4 texRgnSize = glm::max(refTex._view._region.GetSize(), glm::ivec4(1));
-		uint32_t transferSize = sliceSize * std::max(texRgnSize[2], texRgnSize[3]);
+		uint32_t transferSize = GetFormatRegionSize(refTex._view._format, glm::ivec3(texRgnSize.x, texRgnSize.y, std::max(texRgnSize[2], texRgnSize[3])));
 		// not enough buffer space for all requested pixels?
 		if (refBuf._view._region.GetSize()[0] < transferSize)
 			return false;
@@ -152,6 +225,26 @@ bool CopyPass::Copy(CopyData copy)
 	return true;
 }
 
+bool CopyPass::Fill(ResourceRef dst, uint32_t value)
+{
+	Buffer *buffer = Cast<Buffer>(dst._bindable.get());
+	if (!buffer || !buffer->_descriptor._usage.copyDst)
+		return false;
+	if (!dst.ValidateView())
+		return false;
+	// fills write whole 32 bit words
+	if (dst._view._region._min[0] % 4 || dst._view._region.GetSize()[0] % 4)
+		return false;
+	for (auto &copy : _copies) {
+		if (copy._src._bindable == dst._bindable || copy._dst._bindable == dst._bindable)
+			return false;
+	}
+
+	_fills.push_back(FillData{ ._dst = std::move(dst), ._value = value });
+
+	return true;
+}
+
 bool CopyPass::CopyTopToLowerMips(std::shared_ptr<Texture> tex)
 {
 	if (_name.empty())
@@ -195,9 +288,11 @@ bool CopyPass::CopyMips(std::shared_ptr<Texture> src, std::shared_ptr<Texture> d
 void CopyPass::EnumResources(ResourceEnum enumFn)
 {
 	for (auto &copy : _copies) {
-		enumFn(static_cast<Resource *>(copy._src._bindable.get()), ResourceUsage{ .copySrc = 1, .read = 1  });
-		if (copy._dst._bindable != copy._src._bindable)
-			enumFn(static_cast<Resource *>(copy._dst._bindable.get()), ResourceUsage{ .copyDst = 1, .write = 1 });
+		enumFn(static_cast<Resource *>(copy._src._bindable.get()), ResourceUsage{ .copySrc = 1, .read = 1 }, copy._src._view);
+		enumFn(static_cast<Resource *>(copy._dst._bindable.get()), ResourceUsage{ .copyDst = 1, .write = 1 }, copy._dst._view);
+	}
+	for (auto &fill : _fills) {
+		enumFn(static_cast<Resource *>(fill._dst._bindable.get()), ResourceUsage{ .copyDst = 1, .write = 1 }, fill._dst._view);
 	}
 }
 
@@ -14,6 +14,8 @@ struct ResourceSet;
 struct Pass : public RhiOwned {
 
 	virtual void EnumResources(ResourceEnum enumFn) = 0;
+	// Passes that change the usage of a subresource partway through record the barriers for that themselves
+	virtual bool RecordsInternalTransitions() const { return false; }
 
 	virtual bool Prepare(Submission *sub) = 0;
 	virtual bool Execute(Submission *sub) = 0;
@@ -36,6 +38,10 @@ struct GraphicsPass : public Pass {
 	struct DrawData {
 		std::shared_ptr<Pipeline> _pipeline;
 		std::span<std::shared_ptr<ResourceSet>> _resourceSets;
+		// offsets of the dynamic buffers in the resource sets, ordered by set and binding
+		std::span<uint32_t> _dynamicOffsets;
+		// laid out like the pipeline's push constant blocks, from their start
+		std::span<uint8_t const> _pushConstants;
 		std::span<BufferStream> _vertexStreams;
 		BufferStream _indexStream;
 		utl::IntervalU _indices{ 0, 2 };
@@ -43,9 +49,22 @@ struct GraphicsPass : public Pass {
 		uint32_t _vertexOffset = 0;
 	};
 
+	// Draws recorded in a context, each context can be filled by a different thread and they're executed in order
+	struct RecordContext {
+		std::unordered_set<std::shared_ptr<Pipeline>> _pipelines;
+		std::unordered_set<std::shared_ptr<ResourceSet>> _resourceSets;
+	};
+
 	virtual bool Init(std::span<RenderTargetData> rts, utl::BoxF const &viewport = utl::BoxF::GetMaximum());
+	// Splits the pass into a number of recording contexts, has to be called before any draws are made
+	virtual bool InitContexts(uint32_t numContexts);
+	// Adds a context after the existing ones, not while they're being recorded, returns its index
+	virtual uint32_t AddContext();
+	// Finishes recording a context, on the thread that recorded it, once it's done with it
+	virtual bool EndContext(uint32_t context) { return true; }
+	uint32_t GetNumContexts() const { return (uint32_t)_contexts.size(); }
 
-	virtual bool Draw(DrawData const &draw);
+	virtual bool Draw(DrawData const &draw, uint32_t context = 0);
 
 	void EnumResources(ResourceEnum enumFn) override;
 
@@ -53,13 +72,12 @@ struct GraphicsPass : public Pass {
 
 	std::vector<RenderTargetData> _renderTargets;
 	utl::BoxF _viewport;
-	std::unordered_set<std::shared_ptr<Pipeline>> _pipelines;
-	std::unordered_set<std::shared_ptr<ResourceSet>> _resourceSets;
+	std::vector<RecordContext> _contexts;
 
 };
 
 struct ComputePass : public Pass {
-	virtual bool Init(Pipeline *pipeline, std::span<std::shared_ptr<ResourceSet>> resourceSets, glm::ivec3 numGroups);
+	virtual bool Init(Pipeline *pipeline, std::span<std::shared_ptr<ResourceSet>> resourceSets, glm::ivec3 numGroups, std::span<uint32_t> dynamicOffsets = {}, std::span<uint8_t const> pushConstants = {});
 
 	void EnumResources(ResourceEnum enumFn) override;
 
@@ -67,6 +85,8 @@ struct ComputePass : public Pass {
 
 	std::shared_ptr<Pipeline> _pipeline;
 	std::vector<std::shared_ptr<ResourceSet>> _resourceSets;
+	std::vector<uint32_t> _dynamicOffsets;
+	std::vector<uint8_t> _pushConstants;
 	glm::ivec3 _numGroups{ 0 };
 };
 
@@ -82,18 +102,26 @@ struct CopyPass : public Pass {
 		ResourceRef _src, _dst;
 		CopyType GetCopyType() const;
 	};
+	struct FillData {
+		ResourceRef _dst;
+		uint32_t _value;
+	};
 
 	virtual bool Copy(CopyData copy);
+	// Fills a buffer range with a 32 bit value, before any of the pass's copies
+	virtual bool Fill(ResourceRef dst, uint32_t value);
 	bool CopyTopToLowerMips(std::shared_ptr<Texture> tex);
 	bool CopyMips(std::shared_ptr<Texture> src, std::shared_ptr<Texture> dst, int8_t srcMip = 0, int8_t dstMip = 0, int8_t numMips = std::numeric_limits<int8_t>::max());
 
 	virtual bool NeedsMatchingTextures(CopyData &copy) = 0;
 
 	void EnumResources(ResourceEnum enumFn) override;
+	bool RecordsInternalTransitions() const override { return true; }
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<CopyPass>(); }
 
 	std::vector<CopyData> _copies;
+	std::vector<FillData> _fills;
 };
 
 struct Swapchain;
@@ -56,6 +56,15 @@ ShaderParam const *Shader::GetParam(std::string name) const
 	return nullptr;
 }
 
+ShaderConstant const *Shader::GetConstant(std::string name) const
+{
+	for (auto &constant : _constants) {
+		if (constant._name == name)
+			return &constant;
+	}
+	return nullptr;
+}
+
 ShaderData Shader::GetShaderData() const
 {
 	return ShaderData{ ._name = _name, ._kind = _kind };
@@ -71,6 +80,16 @@ uint32_t ResourceSetDescription::GetNumEntries() const
 	return numEntries;
 }
 
+uint32_t ResourceSetDescription::GetNumDynamicOffsets() const
+{
+	uint32_t numOffsets = 0;
+	for (auto &res : _params) {
+		if (res._dynamic)
+			numOffsets += res._numEntries;
+	}
+	return numOffsets;
+}
+
 int32_t ResourceSetDescription::GetParamIndex(std::string name, ShaderParam::Kind kind) const
 {
 	for (int32_t i = 0; i < _params.size(); ++i) {
@@ -140,10 +159,12 @@ void ResourceSet::EnumResources(ResourceEnum enumFn)
 		ResourceUsage paramUsage = param.GetUsage();
 		if (paramUsage) {
 			for (uint32_t e = 0; e < param._numEntries; ++e) {
-				Resource *resource = Cast<Resource>(_resourceRefs[resIndex + e]._bindable.get());
+				ResourceRef &ref = _resourceRefs[resIndex + e];
+				Resource *resource = Cast<Resource>(ref._bindable.get());
 				if (!resource)
 					continue;
-				enumFn(resource, paramUsage);
+				// a dynamic buffer may be used anywhere past the view's offset
+				enumFn(resource, paramUsage, param._dynamic ? ResourceView::FromDescriptor(resource->_descriptor, 0) : ref._view);
 			}
 		}
 		resIndex += param._numEntries;
@@ -152,6 +173,15 @@ void ResourceSet::EnumResources(ResourceEnum enumFn)
 }
 
 bool Pipeline::Init(PipelineData const &pipelineData, GraphicsPass *renderPass)
+{
+	if (!InitLayout(pipelineData, renderPass))
+		return false;
+	bool compiled = Compile(renderPass);
+	SetCompiled(compiled);
+	return compiled;
+}
+
+bool Pipeline::InitLayout(PipelineData const &pipelineData, GraphicsPass *renderPass)
 {
 	ASSERT(_pipelineData.IsEmpty());
 	_pipelineData = pipelineData;
@@ -162,9 +192,22 @@ bool Pipeline::Init(PipelineData const &pipelineData, GraphicsPass *renderPass)
 			if (param._kind == ShaderParam::VertexLayout)
 				continue;
 
+			if (param._kind == ShaderParam::PushConstants) {
+				uint32_t offset = param._type->_members.size() ? (uint32_t)param._type->_members[0]._var._offset : 0;
+				uint32_t end = (uint32_t)param._type->_size;
+				if (_pushConstants._shaderKindsMask) {
+					end = std::max(end, _pushConstants.GetEnd());
+					offset = std::min(offset, _pushConstants._offset);
+				}
+				_pushConstants._offset = offset;
+				_pushConstants._size = end - offset;
+				_pushConstants._shaderKindsMask |= 1u << (int8_t)shader->_kind;
+				continue;
+			}
+
 			ResourceSetDescription &setDesc = utl::GetFromVec(_resourceSetDescriptions, param._set);
 			ResourceSetDescription::Param &paramDesc = utl::GetFromVec(setDesc._params, param._binding);
-			uint32_t numEntries = param.GetNumEntries();
+			uint32_t numEntries = param.GetNumEntries(&_pipelineData);
 			if (paramDesc._numEntries) {
 				if (paramDesc._name != param._name || paramDesc._kind != param._kind || paramDesc._numEntries != numEntries) {
 					LOG("Pipeline '%s' contains shader '%s' with parameter '%s' (%d entries) that doesn't match previous definitions, can't build resource set for the pipeline", _name, shader->_name, param._name, numEntries);
@@ -179,9 +222,76 @@ bool Pipeline::Init(PipelineData const &pipelineData, GraphicsPass *renderPass)
 		}
 	}
 
+	for (auto &bufName : _pipelineData._dynamicBuffers) {
+		bool found = false;
+		for (auto &setDesc : _resourceSetDescriptions) {
+			for (auto &paramDesc : setDesc._params) {
+				if (paramDesc._name != bufName)
+					continue;
+				if (!paramDesc.IsBuffer()) {
+					LOG("Pipeline '%s' has dynamic buffer '%s' that isn't a buffer parameter", _name, bufName);
+					return false;
+				}
+				paramDesc._dynamic = true;
+				found = true;
+			}
+		}
+		if (!found) {
+			LOG("Pipeline '%s' has dynamic buffer '%s' that none of its shaders use", _name, bufName);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Pipeline::SetCompiled(bool compiled)
+{
+	std::vector<std::shared_ptr<Pipeline>> dependents;
+	{
+		std::lock_guard lock(_dependentsMutex);
+		_state = compiled ? State::Ready : State::Failed;
+		dependents.swap(_dependents);
+	}
+	_state.notify_all();
+	// variants only take the source's device pipeline, they don't need the pass
+	for (auto &dependent : dependents) {
+		dependent->SetCompiled(compiled && dependent->Compile(nullptr));
+	}
+}
+
+bool Pipeline::AddDependent(std::shared_ptr<Pipeline> dependent)
+{
+	std::lock_guard lock(_dependentsMutex);
+	if (_state != State::Compiling)
+		return false;
+	_dependents.push_back(std::move(dependent));
 	return true;
 }
 
+bool Pipeline::WaitReady() const
+{
+	for (State state = _state; state == State::Compiling; state = _state)
+		_state.wait(state);
+	return _state == State::Ready;
+}
+
+Pipeline *Pipeline::GetUsable()
+{
+	if (IsReady())
+		return this;
+	if (_fallback && _fallback->IsReady())
+		return _fallback.get();
+	return nullptr;
+}
+
+bool Pipeline::CanFallBackTo(Pipeline const &fallback) const
+{
+	return _resourceSetDescriptions == fallback._resourceSetDescriptions
+		&& _pushConstants == fallback._pushConstants
+		&& _pipelineData._vertexInputs == fallback._pipelineData._vertexInputs;
+}
+
 ShaderParam const *Pipeline::GetShaderParam(uint32_t setIndex, uint32_t bindingIndex)
 {
 	ASSERT(setIndex < _resourceSetDescriptions.size());
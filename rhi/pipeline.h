@@ -16,20 +16,34 @@ struct ShaderParam {
 		UAVTexture,
 		Sampler,
 		VertexLayout,
+		PushConstants,
 		Count
 	};
 
-	uint32_t GetNumEntries() const {
-		return std::max((uint32_t)_type->_arraySize, 1u);
+	// Arrays sized by a specialization constant have the pipeline's value of it
+	uint32_t GetNumEntries(PipelineData const *pipelineData = nullptr) const {
+		uint32_t numEntries = (uint32_t)_type->_arraySize;
+		if (pipelineData && _arraySizeConstant != ~0u)
+			numEntries = pipelineData->GetSpecialization(_arraySizeConstant, numEntries);
+		return std::max(numEntries, 1u);
 	}
 
 	std::string _name;
 	TypeInfo const *_type = nullptr;
 	Kind _kind = Invalid;
 	uint32_t _set = ~0u, _binding = ~0u;
+	// id of the specialization constant the outermost array size comes from, the type has its default value
+	uint32_t _arraySizeConstant = ~0u;
 	std::vector<std::shared_ptr<TypeInfo>> _ownTypes;
 };
 
+struct ShaderConstant {
+	std::string _name;
+	uint32_t _id = 0;
+	TypeInfo const *_type = nullptr;
+	uint32_t _defaultValue = 0;
+};
+
 struct Shader : public RhiOwned {
 	virtual bool Load(ShaderData const &shaderData, std::vector<uint8_t> const &content);
 
@@ -38,12 +52,17 @@ struct Shader : public RhiOwned {
 	uint32_t GetNumParams(ShaderParam::Kind kind) const;
 	ShaderParam const *GetParam(ShaderParam::Kind kind, uint32_t index = 0) const;
 	ShaderParam const *GetParam(std::string name) const;
+	ShaderConstant const *GetConstant(std::string name) const;
 
 	ShaderData GetShaderData() const;
 
 	ShaderKind _kind = ShaderKind::Invalid;
 	std::vector<ShaderParam> _params;
+	// specialization constants
+	std::vector<ShaderConstant> _constants;
+	// the default group size, the dimensions that come from specialization constants have their ids set
 	glm::ivec3 _groupSize{ 0 };
+	glm::uvec3 _groupSizeConstants{ ~0u };
 };
 
 struct ResourceSetDescription {
@@ -52,18 +71,25 @@ struct ResourceSetDescription {
 		ShaderParam::Kind _kind = ShaderParam::Invalid;
 		uint32_t _numEntries = 0;
 		uint32_t _shaderKindsMask = 0;
+		// buffers whose offset is given when the set is bound, one for each entry
+		bool _dynamic = false;
 
 		bool IsImage() const;
 		bool IsBuffer() const;
 		bool IsSampler() const;
 
 		ResourceUsage GetUsage() const;
+
+		bool operator ==(Param const &other) const = default;
 	};
 
 	uint32_t GetNumEntries() const;
+	uint32_t GetNumDynamicOffsets() const;
 	int32_t GetParamIndex(std::string name, ShaderParam::Kind kind = ShaderParam::Invalid) const;
 
 	std::vector<Param> _params;
+
+	bool operator ==(ResourceSetDescription const &other) const = default;
 };
 
 
@@ -94,7 +120,30 @@ struct ResourceSet : public utl::Any {
 };
 
 struct Pipeline : public RhiOwned {
+	enum class State : uint8_t {
+		Compiling,
+		Ready,
+		Failed,
+	};
+
+	// InitLayout followed by Compile, Rhi::GetPipelineAsync runs Compile on a worker thread
 	virtual bool Init(PipelineData const &pipelineData, GraphicsPass *renderPass = nullptr);
+	// Everything resource sets need, they can be allocated while the pipeline is compiling
+	virtual bool InitLayout(PipelineData const &pipelineData, GraphicsPass *renderPass);
+	// Creates the device pipeline, may be called on any thread
+	virtual bool Compile(GraphicsPass *renderPass) = 0;
+
+	// Marks the pipeline compiled and compiles the variants waiting for it
+	void SetCompiled(bool compiled);
+	// The dependent gets compiled once this pipeline is, returns false when it already is
+	bool AddDependent(std::shared_ptr<Pipeline> dependent);
+	bool IsReady() const { return _state == State::Ready; }
+	// Blocks until the pipeline is compiled, returns false if compiling failed
+	bool WaitReady() const;
+	// The pipeline to draw with, the fallback while this one is compiling, null when there's neither
+	Pipeline *GetUsable();
+	// Whether the pipeline can be drawn with the resource sets, push constants and vertex streams of this one
+	bool CanFallBackTo(Pipeline const &fallback) const;
 
 	virtual std::shared_ptr<ResourceSet> AllocResourceSet(uint32_t setIndex) = 0;
 
@@ -103,8 +152,25 @@ struct Pipeline : public RhiOwned {
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<Pipeline>(); }
 
+	// The push constant blocks of all the shaders merged in a single range, visible to all of them
+	struct PushConstantRange {
+		uint32_t _offset = 0, _size = 0;
+		uint32_t _shaderKindsMask = 0;
+
+		uint32_t GetEnd() const { return _offset + _size; }
+		bool operator ==(PushConstantRange const &other) const = default;
+	};
+
 	PipelineData _pipelineData;
 	std::vector<ResourceSetDescription> _resourceSetDescriptions;
+	PushConstantRange _pushConstants;
+	std::atomic<State> _state = State::Compiling;
+	// has to have the same layout, the resource sets of this pipeline are bound with it, see CanFallBackTo
+	std::shared_ptr<Pipeline> _fallback;
+	// differs only in dynamic state, its device pipeline is shared
+	std::shared_ptr<Pipeline> _source;
+	std::mutex _dependentsMutex;
+	std::vector<std::shared_ptr<Pipeline>> _dependents;
 };
 
 inline ResourceSetDescription const *ResourceSet::GetSetDescription() const {
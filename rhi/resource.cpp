@@ -17,27 +17,73 @@ static auto s_regTypes = TypeInfo::AddInitializer("resource", [] {
 		.Base<Bindable>();
 	TypeInfo::Register<Swapchain>().Name("Swapchain")
 		.Base<RhiOwned>();
+	TypeInfo::Register<TransientHeap>().Name("TransientHeap")
+		.Base<RhiOwned>();
 });
 
 
 bool Resource::Init(ResourceDescriptor const &desc)
 {
 	_descriptor = desc;
-	_state.create = 1;
 	return true;
 }
 
+void Resource::InitStates()
+{
+	_states.assign(GetNumMips() * GetNumLayers(), ResourceUsage{ .create = 1 });
+}
+
+ResourceView Resource::GetSubresourceView(utl::IntervalI mips, utl::IntervalI layers) const
+{
+	ResourceView view = ResourceView::FromDescriptor(_descriptor, (int8_t)mips._min, (int8_t)mips.GetSize());
+	// resources without array layers still get a single layer in the view, so ranges can be compared uniformly
+	view._region._min[3] = layers._min;
+	view._region._max[3] = layers._max;
+	return view;
+}
+
+void Resource::EnumSubresources(ResourceView const &view, std::function<void(uint32_t)> enumFn) const
+{
+	if (_states.size() == 1) {
+		enumFn(0);
+		return;
+	}
+
+	utl::IntervalI mips = utl::IntervalI{ view._mipRange._min, view._mipRange._max }.GetIntersection(utl::IntervalI{ 0, (int32_t)GetNumMips() - 1 });
+	utl::IntervalI layers{ 0, 0 };
+	if (_descriptor._dimensions[3] > 0)
+		layers = utl::IntervalI{ view._region._min[3], view._region._max[3] }.GetIntersection(utl::IntervalI{ 0, (int32_t)GetNumLayers() - 1 });
+	for (int32_t layer = layers._min; layer <= layers._max; ++layer) {
+		for (int32_t mip = mips._min; mip <= mips._max; ++mip) {
+			enumFn(GetSubresourceIndex(mip, layer));
+		}
+	}
+}
+
 bool Buffer::Init(ResourceDescriptor const &desc)
 {
 	if (!Resource::Init(desc))
 		return false;
 	ASSERT(_descriptor._dimensions[0] > 0);
+	if (_descriptor._hostAccess != HostAccess::Auto && !_descriptor._usage.cpuAccess)
+		return false;
 	_descriptor._dimensions = glm::ivec4(_descriptor._dimensions[0], 0, 0, 0);
 	_descriptor._mipLevels = 0;
+	InitStates();
 
 	return true;
 }
 
+std::span<uint8_t> Buffer::MapRange(size_t offset, size_t size)
+{
+	std::span<uint8_t> mapped = GetPersistentMapping();
+	if (offset + size > mapped.size()) {
+		ASSERT(0);
+		return std::span<uint8_t>();
+	}
+	return mapped.subspan(offset, size);
+}
+
 bool Texture::Init(ResourceDescriptor const &desc)
 {
 	if (!Resource::Init(desc))
@@ -45,6 +91,7 @@ bool Texture::Init(ResourceDescriptor const &desc)
 	ASSERT(_descriptor._dimensions[0] > 0);
 	if (_descriptor._mipLevels == 0)
 		_descriptor.SetMaxMipLevels();
+	InitStates();
 
 	return true;
 }
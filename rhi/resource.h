@@ -25,9 +25,24 @@ struct SwapchainDescriptor {
 
 struct Resource : public Bindable {
 	ResourceDescriptor _descriptor;
-	ResourceUsage _state{};
+	// textures have a state for each mip of each array layer, buffers have a single one
+	std::vector<ResourceUsage> _states;
+	// the frame of the last submission that used the resource
+	uint64_t _lastUsedFrame = 0;
 
 	virtual bool Init(ResourceDescriptor const &desc);
+	void InitStates();
+
+	uint32_t GetNumMips() const { return std::max<int32_t>(_descriptor._mipLevels, 1); }
+	uint32_t GetNumLayers() const { return std::max<int32_t>(_descriptor._dimensions[3], 1); }
+	uint32_t GetSubresourceIndex(uint32_t mip, uint32_t layer) const { return layer * GetNumMips() + mip; }
+	// The view covering the given mips and array layers, used to describe subresource ranges
+	ResourceView GetSubresourceView(utl::IntervalI mips, utl::IntervalI layers) const;
+
+	void SetState(ResourceUsage state) { std::fill(_states.begin(), _states.end(), state); }
+
+	// Calls enumFn with the index of each subresource the view covers
+	void EnumSubresources(ResourceView const &view, std::function<void(uint32_t)> enumFn) const;
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<Resource>(); }
 };
@@ -38,9 +53,18 @@ struct Buffer : public Resource {
 
 	size_t GetSize() const { return _descriptor._dimensions[0]; }
 
+	// Maps the whole buffer, device writes are made visible on Map and host writes on Unmap
 	virtual std::span<uint8_t> Map() = 0;
 	virtual bool Unmap() = 0;
 
+	// The range inside the mapping of a buffer mapped for its lifetime, accesses to it are synchronized explicitly
+	std::span<uint8_t> MapRange(size_t offset, size_t size);
+	virtual std::span<uint8_t> GetPersistentMapping() = 0;
+	// Makes host writes to the range visible to the device, needed before the work reading them is submitted
+	virtual bool FlushRange(size_t offset, size_t size) = 0;
+	// Makes device writes to the range visible to host reads, after the work writing them has finished
+	virtual bool InvalidateRange(size_t offset, size_t size) = 0;
+
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<Buffer>(); }
 };
 
@@ -51,6 +75,22 @@ struct Texture : public Resource {
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<Texture>(); }
 
 	std::weak_ptr<RhiOwned> _owner;
+	// the memory is shared with other textures of a TransientHeap
+	bool _aliased = false;
+};
+
+// Memory shared by transient textures, a new texture is placed over memory that only released textures used
+// Memory and textures are kept for the following frames, which usually place the same textures the same way
+struct TransientHeap : public RhiOwned {
+	// The texture's contents are undefined at the start of each use, since other textures may have overwritten them
+	// The memory is reused from frame to frame ordered by barriers alone, so the textures can only be used on the universal queue
+	virtual std::shared_ptr<Texture> CreateTexture(ResourceDescriptor const &desc, std::string name) = 0;
+	// The texture's memory can be reused by textures created after this, it may only be used by work submitted before them
+	virtual void Release(Texture *texture) = 0;
+	// Releases the textures still in use and starts placing from scratch
+	virtual void Reset() = 0;
+
+	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<TransientHeap>(); }
 };
 
 struct Sampler : public Bindable {
@@ -1,6 +1,7 @@
 #include "rhi.h"
 #include "pipeline.h"
 #include "utl/file.h"
+#include "utl/thread_pool.h"
 
 namespace rhi {
 
@@ -26,12 +27,15 @@ bool Rhi::Init(Settings const &settings, int32_t deviceIndex)
         return false;
 
     _deviceIndex = deviceIndex;
+    _frames.resize(std::max(_settings._framesInFlight, 1u));
 
     return true;
 }
 
 void Rhi::ClearCachedData()
 {
+    WaitPipelinesCompiled();
+    std::unique_lock lock(_cacheLock);
     _pipelines.clear();
     _shaders.clear();
 }
@@ -57,7 +61,16 @@ std::shared_ptr<RhiOwned> Rhi::Create(TypeInfo const *type, std::string name)
     ASSERT(toCreate);
     if (!toCreate)
         return std::shared_ptr<RhiOwned>();
-    auto obj = std::shared_ptr<RhiOwned>(toCreate->ConstructAs<RhiOwned>(nullptr, true));
+    std::atomic<uint32_t> *count;
+    {
+        std::lock_guard lock(_objectCountsMutex);
+        count = &_objectCounts[toCreate];
+    }
+    ++*count;
+    auto obj = std::shared_ptr<RhiOwned>(toCreate->ConstructAs<RhiOwned>(nullptr, true), [count](RhiOwned *o) {
+        --*count;
+        delete o;
+    });
     if (!obj->InitRhi(this, name))
         obj = nullptr;
     return obj;
@@ -70,38 +83,262 @@ std::shared_ptr<Shader> Rhi::GetShader(std::string path, ShaderKind kind)
         ._kind = kind,
     };
 
-    auto it = _shaders.find(shaderData);
-    if (it == _shaders.end()) {
-        auto shader = Create<Shader>();
-        if (!shader->Load(shaderData, utl::ReadFile(path)))
-            return nullptr;
-        it = _shaders.insert({ shaderData, std::move(shader) }).first;
+    {
+        std::shared_lock lock(_cacheLock);
+        auto it = _shaders.find(shaderData);
+        if (it != _shaders.end())
+            return it->second;
     }
-    return it->second;
+
+    // loaded outside the lock, if another thread loads the same shader meanwhile its copy is kept
+    auto shader = Create<Shader>();
+    if (!shader->Load(shaderData, utl::ReadFile(path)))
+        return nullptr;
+    std::unique_lock lock(_cacheLock);
+    return _shaders.insert({ shaderData, std::move(shader) }).first->second;
 }
 
 std::shared_ptr<Pipeline> Rhi::GetPipeline(PipelineData const &pipelineData, GraphicsPass *renderPass)
+{
+    auto pipeline = GetOrCreatePipeline(pipelineData, renderPass, nullptr, false);
+    // it may have been requested asynchronously and still be compiling
+    if (!pipeline || !pipeline->WaitReady())
+        return nullptr;
+    return pipeline;
+}
+
+std::shared_ptr<Pipeline> Rhi::GetPipelineAsync(PipelineData const &pipelineData, GraphicsPass *renderPass, std::shared_ptr<Pipeline> fallback)
+{
+    return GetOrCreatePipeline(pipelineData, renderPass, std::move(fallback), true);
+}
+
+std::shared_ptr<Pipeline> Rhi::GetOrCreatePipeline(PipelineData const &pipelineData, GraphicsPass *renderPass, std::shared_ptr<Pipeline> fallback, bool async)
 {
     PipelineData pipeData = pipelineData;
     pipeData.FillRenderTargetFormats(renderPass);
 
-    auto it = _pipelines.find(pipeData);
-    if (it == _pipelines.end()) {
-        auto pipeline = New<Pipeline>("", pipeData, renderPass);
-        if (!pipeline)
+    {
+        std::shared_lock lock(_cacheLock);
+        auto it = _pipelines.find(pipeData);
+        if (it != _pipelines.end()) {
+            // the pipeline keeps the fallback it was first requested with
+            ASSERT(!fallback || !it->second->_fallback || it->second->_fallback == fallback);
+            return it->second;
+        }
+    }
+
+    // pipelines that differ only in dynamic state share the device pipeline of the one with that state at its defaults
+    std::shared_ptr<Pipeline> source;
+    RenderState staticState = pipeData._renderState.GetStatic(_dynamicState);
+    if (!(staticState == pipeData._renderState)) {
+        PipelineData sourceData = pipeData;
+        sourceData._renderState = staticState;
+        source = GetOrCreatePipeline(sourceData, renderPass, nullptr, async);
+        if (!source)
             return nullptr;
-        it = _pipelines.insert({pipeData, std::move(pipeline)}).first;
     }
-    return it->second;
+
+    auto pipeline = Create<Pipeline>();
+    if (!pipeline)
+        return nullptr;
+    pipeline->_fallback = std::move(fallback);
+    // set before the layout, which variants take from the source
+    pipeline->_source = std::move(source);
+    if (!pipeline->InitLayout(pipeData, renderPass)) {
+        ASSERT(0);
+        return nullptr;
+    }
+    // the fallback is drawn with the resource sets and vertex streams meant for this pipeline
+    if (pipeline->_fallback && !pipeline->CanFallBackTo(*pipeline->_fallback)) {
+        LOG("Fallback of pipeline with shaders '%s' has a different layout", pipeData._shaders.size() ? pipeData._shaders[0]->_name : std::string());
+        return nullptr;
+    }
+
+    {
+        std::unique_lock lock(_cacheLock);
+        auto [it, inserted] = _pipelines.insert({ pipeData, pipeline });
+        if (!inserted)
+            return it->second;
+    }
+
+    // sharing the device pipeline of the source is cheap enough to do right away, or as soon as the source is compiled
+    if (pipeline->_source) {
+        if (!pipeline->_source->AddDependent(pipeline))
+            pipeline->SetCompiled(pipeline->Compile(renderPass));
+        return pipeline;
+    }
+
+    if (!async || !_settings._threadPool) {
+        pipeline->SetCompiled(pipeline->Compile(renderPass));
+        return pipeline;
+    }
+
+    // the pass the pipeline is made compatible with has to live until it's compiled
+    std::shared_ptr<GraphicsPass> pass = renderPass ? std::static_pointer_cast<GraphicsPass>(renderPass->shared_from_this()) : nullptr;
+    ++_compilingPipelines;
+    _settings._threadPool->Run([this, pipeline, pass]() mutable {
+        bool compiled = pipeline->Compile(pass.get());
+        if (!compiled)
+            LOG("Failed compiling pipeline with shaders '%s'", pipeline->_pipelineData._shaders.size() ? pipeline->_pipelineData._shaders[0]->_name : std::string());
+        pipeline->SetCompiled(compiled);
+        // released before the rhi can see the compilation as done and get destroyed
+        pipeline = nullptr;
+        pass = nullptr;
+        if (--_compilingPipelines == 0)
+            _compilingPipelines.notify_all();
+    });
+    return pipeline;
+}
+
+void Rhi::WaitPipelinesCompiled()
+{
+    for (uint32_t compiling = _compilingPipelines; compiling; compiling = _compilingPipelines)
+        _compilingPipelines.wait(compiling);
+}
+
+bool Rhi::IsFormatSupported(Format fmt, ResourceUsage usage)
+{
+    static constexpr ResourceUsage imageOps{ .srv = 1, .uav = 1, .rt = 1, .ds = 1, .copySrc = 1, .copyDst = 1 };
+    ResourceUsage needed = usage & imageOps;
+    return (GetFormatImageUsage(fmt, usage) & needed) == needed;
+}
+
+auto Rhi::GetMemoryStats(bool detailed) -> MemoryStats
+{
+    MemoryStats stats;
+    for (size_t k = 0; k < stats._resources.size(); ++k) {
+        stats._resources[k]._count = _resourceCounts[k];
+        stats._resources[k]._bytes = (uint64_t)_resourceBytes[k].load();
+    }
+    {
+        std::lock_guard lock(_objectCountsMutex);
+        for (auto &[type, count] : _objectCounts) {
+            if (count)
+                stats._objects.push_back({ type, count.load() });
+        }
+    }
+    {
+        std::shared_lock lock(_cacheLock);
+        for (auto &[data, pipeline] : _pipelines) {
+            ++stats._pipelines;
+            if (pipeline->_source)
+                ++stats._pipelineVariants;
+        }
+    }
+    std::sort(stats._objects.begin(), stats._objects.end(), [](auto const &o0, auto const &o1) { return o0.second > o1.second; });
+    return stats;
+}
+
+char const *Rhi::GetResourceKindName(ResourceKind kind)
+{
+    static char const *s_names[] = { "RenderTarget", "ShaderResource", "VertexIndex", "Staging", "Transient", "Other" };
+    static_assert(std::size(s_names) == (size_t)ResourceKind::Count);
+    return s_names[(size_t)kind];
 }
 
-std::shared_ptr<Submission> Rhi::Submit(std::vector<std::shared_ptr<Pass>> &&passes, std::string name)
+auto Rhi::GetResourceKind(ResourceUsage usage) -> ResourceKind
+{
+    if (usage.cpuAccess)
+        return ResourceKind::Staging;
+    if (usage.rt || usage.ds)
+        return ResourceKind::RenderTarget;
+    if (usage.vb || usage.ib)
+        return ResourceKind::VertexIndex;
+    if (usage.srv || usage.uav)
+        return ResourceKind::ShaderResource;
+    return ResourceKind::Other;
+}
+
+void Rhi::CountResourceMemory(ResourceKind kind, int32_t count, int64_t bytes)
+{
+    _resourceCounts[(size_t)kind] += count;
+    _resourceBytes[(size_t)kind] += bytes;
+}
+
+std::shared_ptr<Submission> Rhi::Submit(std::vector<std::shared_ptr<Pass>> &&passes, std::string name, QueueKind queue)
 {
     auto sub = Create<Submission>(name);
     sub->_passes = std::move(passes);
+    sub->_queue = queue;
+
+    FrameContext &frame = GetCurrentFrame();
+    frame._submissions.push_back(sub);
+    frame._finished = false;
+
     return sub;
 }
 
+bool Rhi::BeginFrame()
+{
+    Clock::time_point now = Clock::now();
+    for (auto &frame : _frames) {
+        if (!frame._finished && IsFrameFinished(frame))
+            FinishFrame(frame, GetFrameFinishTime(frame, now));
+    }
+
+    FrameContext &prevFrame = GetCurrentFrame();
+    _frameStats._prevFrameQueueSubmits = prevFrame._queueSubmits;
+    _frameStats._prevFrameCmdBuffers = prevFrame._cmdBuffers;
+
+    ++_frameNumber;
+    FrameContext &frame = GetCurrentFrame();
+    if (!frame._finished) {
+        if (!WaitFrame(frame))
+            return false;
+        Clock::time_point waitEnd = Clock::now();
+        _frameStats._waitTime += std::chrono::duration<double>(waitEnd - now).count();
+        FinishFrame(frame, GetFrameFinishTime(frame, waitEnd));
+    }
+
+    frame._submissions.clear();
+    frame._frameNumber = _frameNumber;
+    frame._beginTime = now;
+    frame._queueSubmits = 0;
+    frame._cmdBuffers = 0;
+    ++_frameStats._frames;
+
+    return true;
+}
+
+void Rhi::CountQueueSubmit(uint32_t numCmdBuffers)
+{
+    FrameContext &frame = GetCurrentFrame();
+    ++frame._queueSubmits;
+    frame._cmdBuffers += numCmdBuffers;
+    if (!_frameNumber)
+        return;
+    ++_frameStats._queueSubmits;
+    _frameStats._cmdBuffers += numCmdBuffers;
+}
+
+bool Rhi::IsFrameFinished(FrameContext &frame)
+{
+    for (auto &sub : frame._submissions) {
+        if (!sub->IsFinishedExecuting())
+            return false;
+    }
+    return true;
+}
+
+bool Rhi::WaitFrame(FrameContext &frame)
+{
+    bool res = true;
+    for (auto &sub : frame._submissions) {
+        res = sub->WaitUntilFinished() && res;
+    }
+    return res;
+}
+
+void Rhi::FinishFrame(FrameContext &frame, Clock::time_point time)
+{
+    frame._finished = true;
+    // the frame before the first BeginFrame() holds initialization work, it's not counted
+    if (!frame._frameNumber)
+        return;
+    ++_frameStats._finishedFrames;
+    _frameStats._latency += std::chrono::duration<double>(time - frame._beginTime).count();
+}
+
 TypeInfo const *Rhi::GetDerivedTypeWithTag(TypeInfo const *base)
 {
     {
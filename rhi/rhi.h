@@ -3,6 +3,11 @@
 #include "resource.h"
 #include "pass.h"
 #include "submit.h"
+#include <chrono>
+
+namespace utl {
+struct ThreadPool;
+}
 
 namespace rhi {
 
@@ -20,7 +25,98 @@ struct Rhi : public std::enable_shared_from_this<Rhi>, public utl::Any {
 		char const *_appName = nullptr;
 		glm::uvec3 _appVersion{ 0 };
 		bool _enableValidation = false;
+		uint32_t _framesInFlight = 2;
 		std::shared_ptr<WindowData> _window;
+		// device memory moved by each defragmentation pass, 0 disables defragmentation
+		uint64_t _defragBytesPerPass = 16 * 1024 * 1024;
+		// directory for data kept between runs, like the pipeline cache, nothing is kept when empty
+		std::string _cacheDir;
+		// pipelines requested asynchronously compile on it, without one they compile on the calling thread
+		utl::ThreadPool *_threadPool = nullptr;
+	};
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	// A slot in the ring of frames that can be in flight on the GPU at the same time
+	struct FrameContext {
+		uint64_t _frameNumber = 0;
+		bool _finished = true;
+		Clock::time_point _beginTime;
+		// submissions are kept alive until the frame's GPU work is finished
+		std::vector<std::shared_ptr<Submission>> _submissions;
+		uint32_t _queueSubmits = 0;
+		uint32_t _cmdBuffers = 0;
+	};
+
+	// Device local memory in use and the amount the process can use without degrading performance
+	struct MemoryBudget {
+		uint64_t _usage = 0;
+		uint64_t _budget = 0;
+	};
+
+	// Resources are counted by the kind of their usage
+	enum class ResourceKind : uint8_t {
+		RenderTarget,
+		ShaderResource,
+		VertexIndex,
+		// resources the host accesses
+		Staging,
+		// memory of the transient heaps, the textures placed in it aren't counted separately
+		Transient,
+		Other,
+		Count
+	};
+
+	struct MemoryStats {
+		// Allocations the driver makes through the host allocation callbacks
+		struct Host {
+			uint64_t _allocations = 0;
+			uint64_t _frees = 0;
+			uint64_t _bytes = 0;
+			uint64_t _internalBytes = 0;
+		};
+		struct Heap {
+			bool _deviceLocal = false;
+			uint64_t _size = 0;
+			MemoryBudget _budget;
+			// device memory blocks and the allocations placed in them
+			uint32_t _blocks = 0;
+			uint32_t _allocations = 0;
+			uint64_t _blockBytes = 0;
+			uint64_t _allocationBytes = 0;
+			// only filled in detailed stats
+			uint32_t _freeRanges = 0;
+			uint64_t _largestFreeRange = 0;
+		};
+		struct Resources {
+			uint32_t _count = 0;
+			uint64_t _bytes = 0;
+		};
+
+		Host _host;
+		std::vector<Heap> _heaps;
+		std::array<Resources, (size_t)ResourceKind::Count> _resources;
+		// live objects created by the rhi, by type
+		std::vector<std::pair<TypeInfo const *, uint32_t>> _objects;
+		// cached pipelines, the variants share the device pipeline and layout of their source
+		uint32_t _pipelines = 0;
+		uint32_t _pipelineVariants = 0;
+		uint64_t _defragBytesMoved = 0;
+		uint64_t _defragBytesFreed = 0;
+	};
+
+	struct FrameStats {
+		uint64_t _frames = 0;
+		uint64_t _finishedFrames = 0;
+		// time the CPU spent blocked on a frame slot that was still in flight
+		double _waitTime = 0;
+		// sum of the times from a frame's start until its GPU work was observed to be finished
+		double _latency = 0;
+		// queue submit calls and command buffers submitted with them, in total and for the previous frame
+		uint64_t _queueSubmits = 0;
+		uint64_t _cmdBuffers = 0;
+		uint32_t _prevFrameQueueSubmits = 0;
+		uint32_t _prevFrameCmdBuffers = 0;
 	};
 
 	virtual ~Rhi();
@@ -54,11 +150,41 @@ struct Rhi : public std::enable_shared_from_this<Rhi>, public utl::Any {
 
 	std::shared_ptr<Shader> GetShader(std::string path, ShaderKind kind);
 	std::shared_ptr<Pipeline> GetPipeline(PipelineData const &pipelineData, GraphicsPass *renderPass = nullptr);
+	// Returns before the pipeline is compiled, until it's ready draws use the fallback or are skipped, compute passes wait for it
+	// The fallback has to have the same resource sets, push constants and vertex inputs, a cached pipeline keeps its first one
+	std::shared_ptr<Pipeline> GetPipelineAsync(PipelineData const &pipelineData, GraphicsPass *renderPass = nullptr, std::shared_ptr<Pipeline> fallback = nullptr);
+	void WaitPipelinesCompiled();
+
+	// Submissions on different queues may run concurrently, the ones using the same resources are synchronized
+	std::shared_ptr<Submission> Submit(std::vector<std::shared_ptr<Pass>> &&passes, std::string name = "", QueueKind queue = QueueKind::Universal);
+
+	// Advances to the next slot of the frame ring, only blocking if that slot's GPU work isn't finished yet
+	virtual bool BeginFrame();
+	FrameContext &GetCurrentFrame() { return _frames[_frameNumber % _frames.size()]; }
+	uint32_t GetFramesInFlight() const { return (uint32_t)_frames.size(); }
+
+	void CountQueueSubmit(uint32_t numCmdBuffers);
 
-	std::shared_ptr<Submission> Submit(std::vector<std::shared_ptr<Pass>> &&passes, std::string name = "");
+	virtual bool IsFrameFinished(FrameContext &frame);
+	virtual bool WaitFrame(FrameContext &frame);
+	// When the frame's GPU work was first seen finished, if that's known to be earlier than the time it's observed at now
+	virtual Clock::time_point GetFrameFinishTime(FrameContext &frame, Clock::time_point observed) { return observed; }
 
 	virtual bool WaitIdle() = 0;
 
+	// The usages images of the format support, the usage picks the image tiling
+	virtual ResourceUsage GetFormatImageUsage(Format fmt, ResourceUsage usage) = 0;
+	bool IsFormatSupported(Format fmt, ResourceUsage usage);
+
+	virtual MemoryBudget GetMemoryBudget() = 0;
+
+	// Cheap enough to call every frame, detailed stats walk all the allocations of the device
+	virtual MemoryStats GetMemoryStats(bool detailed = false);
+	static char const *GetResourceKindName(ResourceKind kind);
+	static ResourceKind GetResourceKind(ResourceUsage usage);
+	// Called by the implementations when they allocate or free the memory of resources
+	void CountResourceMemory(ResourceKind kind, int32_t count, int64_t bytes);
+
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<Rhi>(); }
 
 	TypeInfo const *GetDerivedTypeWithTag(TypeInfo const *base);
@@ -69,11 +195,26 @@ struct Rhi : public std::enable_shared_from_this<Rhi>, public utl::Any {
 
 	Settings _settings;
 	int32_t _deviceIndex = -1;
+	uint64_t _frameNumber = 0;
+	std::vector<FrameContext> _frames;
+	FrameStats _frameStats;
+	// the parts of the render state the device takes with each draw, set on init
+	DynamicState _dynamicState = DynamicState::Basic;
 protected:
+	void FinishFrame(FrameContext &frame, Clock::time_point time);
+	std::shared_ptr<Pipeline> GetOrCreatePipeline(PipelineData const &pipelineData, GraphicsPass *renderPass, std::shared_ptr<Pipeline> fallback, bool async);
+
 	std::shared_mutex _rwLock;
+	// declared before the cached objects, which decrement their type's count when they're destroyed
+	std::mutex _objectCountsMutex;
+	std::unordered_map<TypeInfo const *, std::atomic<uint32_t>> _objectCounts;
+	std::array<std::atomic<uint32_t>, (size_t)ResourceKind::Count> _resourceCounts{};
+	std::array<std::atomic<int64_t>, (size_t)ResourceKind::Count> _resourceBytes{};
 	std::unordered_map<TypeInfo const *, TypeInfo const *> _derivedTypes;
+	std::shared_mutex _cacheLock;
 	std::unordered_map<ShaderData, std::shared_ptr<Shader>> _shaders;
 	std::unordered_map<PipelineData, std::shared_ptr<Pipeline>> _pipelines;
+	std::atomic<uint32_t> _compilingPipelines = 0;
 };
 
 struct RhiVk;
@@ -1,6 +1,7 @@
 #include "submit.h"
 #include "pass.h"
 #include "resource.h"
+#include "rhi.h"
 
 namespace rhi {
 
@@ -19,6 +20,8 @@ bool Submission::Init(std::vector<std::shared_ptr<Pass>> &&passes)
 bool Submission::Prepare()
 {
 	_passTransitions = ExtractResourceUse();
+	if (_mergeTransitions)
+		MergeTransitions();
 
 	for (auto &pass : _passes) {
 		if (!pass->Prepare(this))
@@ -41,51 +44,141 @@ bool Submission::Execute()
 
 PassResourceTransitions Submission::ExtractResourceUse()
 {
+	// usage of a subresource in a pass, the first and last usage only differ if the pass changes it partway through
+	struct SubresourceUse {
+		ResourceUsage _first, _last;
+	};
 	struct ResourceUse {
-		Resource *_resource = nullptr;
+		// subresource states as of the pass being processed
+		std::vector<ResourceUsage> _states;
+		std::vector<SubresourceUse> _passUses;
 		Pass *_pass = nullptr;
-		ResourceUsage _usage;
-		ResourceUse *_prevUse = nullptr;
 	};
 
-	std::deque<ResourceUse> usedResources;
-	std::unordered_map<Resource *, ResourceUse *> lastUses;
+	std::unordered_map<Resource *, ResourceUse> resourceUses;
+	std::vector<Resource *> passResources;
 	PassResourceTransitions passTransitions;
 
 	for (auto &pass : _passes) {
-		pass->EnumResources([&](Resource *resource, ResourceUsage usage) {
+		passResources.clear();
+		pass->EnumResources([&](Resource *resource, ResourceUsage usage, ResourceView const &view) {
 			ASSERT((resource->_descriptor._usage & usage & ResourceUsage::Operations()) == (usage & ResourceUsage::Operations()));
-			ResourceUse *&lastUse = lastUses[resource];
-			if (lastUse && lastUse->_pass == pass.get()) {
-				lastUse->_usage |= usage;
-				ASSERT(!(lastUse->_usage.read && lastUse->_usage.write));
-				return;
-			} 
-			usedResources.push_back(ResourceUse{
-				._resource = resource,
-				._pass = pass.get(),
-				._usage = usage,
-				._prevUse = lastUse
+			ResourceUse &resUse = resourceUses[resource];
+			if (resUse._states.empty())
+				resUse._states = resource->_states;
+			if (resUse._pass != pass.get()) {
+				resUse._pass = pass.get();
+				resUse._passUses.assign(resUse._states.size(), SubresourceUse{});
+				passResources.push_back(resource);
+			}
+			resource->EnumSubresources(view, [&](uint32_t sub) {
+				SubresourceUse &use = resUse._passUses[sub];
+				if (!use._first) {
+					use._first = use._last = usage;
+					return;
+				}
+				if (!(use._last.write || usage.write) || use._last == usage) {
+					if (use._first == use._last)
+						use._first |= usage;
+					use._last |= usage;
+					return;
+				}
+				ASSERT(pass->RecordsInternalTransitions());
+				use._last = usage;
 			});
-			lastUse = &usedResources.back();
 		});
-	}
 
-	for (auto [res, lastUse] : lastUses) {
-		for (ResourceUse *use = lastUse; use; use = use->_prevUse) {
-			ResourceUsage prevUsage = use->_prevUse ? use->_prevUse->_usage : use->_resource->_state;
-			if (prevUsage == use->_usage && !(prevUsage.write && use->_usage.write))
-				continue;
-			passTransitions[use->_pass].push_back(ResourceTransition{
-				._resource = use->_resource,
-				._prevUsage = prevUsage,
-				._usage = use->_usage,
-			});
+		for (Resource *resource : passResources) {
+			ResourceUse &resUse = resourceUses[resource];
+			std::vector<ResourceTransition> &transitions = passTransitions[pass.get()];
+			size_t resTransitionsStart = transitions.size();
+			uint32_t numMips = resource->GetNumMips();
+			for (uint32_t layer = 0; layer < resource->GetNumLayers(); ++layer) {
+				for (uint32_t mip = 0; mip < numMips; ++mip) {
+					uint32_t sub = resource->GetSubresourceIndex(mip, layer);
+					SubresourceUse &use = resUse._passUses[sub];
+					if (!use._first)
+						continue;
+					ResourceUsage prevUsage = resUse._states[sub];
+					resUse._states[sub] = use._last;
+					if (prevUsage == use._first && !(prevUsage.write && use._first.write))
+						continue;
+
+					// neighbouring subresources with the same transition are merged, first along the mips, then along the layers
+					ResourceTransition *last = transitions.size() > resTransitionsStart ? &transitions.back() : nullptr;
+					if (last && last->_prevUsage == prevUsage && last->_usage == use._first && last->_view._region._max[3] == (int32_t)layer && last->_view._mipRange._max == (int8_t)mip - 1) {
+						++last->_view._mipRange._max;
+						continue;
+					}
+					transitions.push_back(ResourceTransition{
+						._resource = resource,
+						._view = resource->GetSubresourceView(utl::IntervalI{ (int32_t)mip, (int32_t)mip }, utl::IntervalI{ (int32_t)layer, (int32_t)layer }),
+						._prevUsage = prevUsage,
+						._usage = use._first,
+					});
+				}
+			}
+
+			for (size_t t = resTransitionsStart + 1; t < transitions.size(); ) {
+				ResourceTransition &transition = transitions[t];
+				auto itPrevLayer = std::find_if(transitions.begin() + resTransitionsStart, transitions.begin() + t, [&](ResourceTransition const &prev) {
+					return prev._prevUsage == transition._prevUsage && prev._usage == transition._usage &&
+						prev._view._mipRange == transition._view._mipRange && prev._view._region._max[3] + 1 == transition._view._region._min[3];
+				});
+				if (itPrevLayer == transitions.begin() + t) {
+					++t;
+					continue;
+				}
+				itPrevLayer->_view._region._max[3] = transition._view._region._max[3];
+				transitions.erase(transitions.begin() + t);
+			}
 		}
-		res->_state = lastUse->_usage;
+	}
+
+	_usedResources.clear();
+	for (auto &[resource, resUse] : resourceUses) {
+		_usedResources.push_back(resource);
+		resource->_states = std::move(resUse._states);
+		resource->_lastUsedFrame = _rhi->_frameNumber;
 	}
 
 	return passTransitions;
 }
 
+void Submission::MergeTransitions()
+{
+	// only transitions matching one in the earlier barrier are moved, so that barrier doesn't wait for anything new
+	// the pass before can't use the resource, and presentation is left alone to keep the acquire wait late
+	std::unordered_set<Resource *> prevResources;
+	for (uint32_t p = 1; p < _passes.size(); ++p) {
+		auto itTransitions = _passTransitions.find(_passes[p].get());
+		auto itPrevTransitions = _passTransitions.find(_passes[p - 1].get());
+		if (itTransitions == _passTransitions.end() || itPrevTransitions == _passTransitions.end() || itPrevTransitions->second.empty())
+			continue;
+
+		prevResources.clear();
+		_passes[p - 1]->EnumResources([&](Resource *resource, ResourceUsage usage, ResourceView const &view) {
+			prevResources.insert(resource);
+		});
+
+		std::vector<ResourceTransition> &prevTransitions = itPrevTransitions->second;
+		size_t numPrevTransitions = prevTransitions.size();
+		std::erase_if(itTransitions->second, [&](ResourceTransition const &transition) {
+			if (transition._prevUsage.present || transition._usage.present || prevResources.contains(transition._resource))
+				return false;
+			// the first use of an aliased texture discards memory another texture may still use in the earlier pass
+			auto *texture = Cast<Texture>(transition._resource);
+			if (transition._prevUsage.create && texture && texture->_aliased)
+				return false;
+			bool matches = std::any_of(prevTransitions.begin(), prevTransitions.begin() + numPrevTransitions, [&](ResourceTransition const &prev) {
+				return prev._prevUsage == transition._prevUsage && prev._usage == transition._usage;
+			});
+			if (!matches)
+				return false;
+			prevTransitions.push_back(transition);
+			return true;
+		});
+	}
+}
+
 }
\ No newline at end of file
@@ -9,6 +9,8 @@ struct Resource;
 
 struct ResourceTransition {
 	Resource *_resource = nullptr;
+	// the range of mips and array layers that transition
+	ResourceView _view;
 	ResourceUsage _prevUsage, _usage;
 };
 using PassResourceTransitions = std::unordered_map<Pass *, std::vector<ResourceTransition>>;
@@ -25,11 +27,16 @@ struct Submission : public RhiOwned {
 	virtual bool WaitUntilFinished() = 0;
 
 	PassResourceTransitions ExtractResourceUse();
+	// Moves transitions into the barrier of the pass before theirs, when they're identical to one already there
+	void MergeTransitions();
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<Submission>(); }
 
 	std::vector<std::shared_ptr<Pass>> _passes;
 	PassResourceTransitions _passTransitions;
+	std::vector<Resource *> _usedResources;
+	bool _mergeTransitions = false;
+	QueueKind _queue = QueueKind::Universal;
 };
 
 }
\ No newline at end of file
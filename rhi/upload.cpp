@@ -0,0 +1,108 @@
+#include "upload.h"
+#include "rhi.h"
+#include "pass.h"
+#include "resource.h"
+#include "utl/mathutl.h"
+
+namespace rhi {
+
+bool UploadRing::Init(Rhi *rhi, size_t blockSize)
+{
+	_rhi = rhi;
+	_blockSize = blockSize;
+	_frames.resize(_rhi->GetFramesInFlight());
+	return true;
+}
+
+auto UploadRing::GetFrameBlocks() -> FrameBlocks &
+{
+	FrameBlocks &frame = _frames[_rhi->_frameNumber % _frames.size()];
+	if (frame._frameNumber != _rhi->_frameNumber) {
+		// the ring only comes back to a slot after waiting for its frame's work
+		frame._current = 0;
+		frame._offset = 0;
+		frame._frameNumber = _rhi->_frameNumber;
+	}
+	return frame;
+}
+
+auto UploadRing::Alloc(size_t size, size_t alignment) -> Allocation
+{
+	FrameBlocks &frame = GetFrameBlocks();
+	for (; frame._current < frame._blocks.size(); ++frame._current, frame._offset = 0) {
+		Block &block = frame._blocks[frame._current];
+		size_t offset = utl::RoundUp(frame._offset, alignment);
+		if (offset + size > block._mapped.size())
+			continue;
+		frame._offset = offset + size;
+		return Allocation{
+			._buffer = block._buffer,
+			._offset = offset,
+			._data = block._mapped.subspan(offset, size),
+		};
+	}
+
+	// larger allocations get a block of their own, which is reused for smaller ones later
+	Block block;
+	block._buffer = _rhi->New<Buffer>("UploadRing" + std::to_string(frame._blocks.size()), ResourceDescriptor{
+		._usage{.copySrc = 1, .cpuAccess = 1},
+		._dimensions{ (int32_t)std::max(size, _blockSize), 0, 0, 0 },
+		._hostAccess = HostAccess::Upload,
+	});
+	if (!block._buffer)
+		return Allocation();
+	block._mapped = block._buffer->GetPersistentMapping();
+	if (block._mapped.empty())
+		return Allocation();
+	frame._blocks.push_back(std::move(block));
+	frame._current = (uint32_t)frame._blocks.size() - 1;
+	frame._offset = size;
+
+	return Allocation{
+		._buffer = frame._blocks.back()._buffer,
+		._offset = 0,
+		._data = frame._blocks.back()._mapped.subspan(0, size),
+	};
+}
+
+std::span<uint8_t> UploadRing::Upload(std::shared_ptr<Buffer> const &dst, size_t dstOffset, size_t size)
+{
+	Allocation alloc = Alloc(size);
+	if (!alloc._buffer)
+		return std::span<uint8_t>();
+
+	if (!_copyPass) {
+		_copyPass = _rhi->Create<CopyPass>("UploadRing");
+		if (!_copyPass)
+			return std::span<uint8_t>();
+	}
+	bool res = _copyPass->Copy(CopyPass::CopyData{
+		._src{ alloc._buffer, ResourceView{ ._region = utl::Box4I::FromMinAndSize(glm::ivec4((int32_t)alloc._offset, 0, 0, 0), glm::ivec4((int32_t)size, 0, 0, 0)) } },
+		._dst{ dst, ResourceView{ ._region = utl::Box4I::FromMinAndSize(glm::ivec4((int32_t)dstOffset, 0, 0, 0), glm::ivec4((int32_t)size, 0, 0, 0)) } },
+	});
+	if (!res)
+		return std::span<uint8_t>();
+
+	return alloc._data;
+}
+
+std::shared_ptr<CopyPass> UploadRing::TakeCopyPass()
+{
+	Flush();
+	return std::move(_copyPass);
+}
+
+bool UploadRing::Flush()
+{
+	FrameBlocks &frame = GetFrameBlocks();
+	bool res = true;
+	for (uint32_t b = 0; b < frame._blocks.size() && b <= frame._current; ++b) {
+		Block &block = frame._blocks[b];
+		size_t end = b < frame._current ? block._mapped.size() : frame._offset;
+		if (end > 0)
+			res = block._buffer->FlushRange(0, end) && res;
+	}
+	return res;
+}
+
+}
\ No newline at end of file
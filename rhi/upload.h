@@ -0,0 +1,56 @@
+#pragma once
+
+#include "base.h"
+
+namespace rhi {
+
+struct Rhi;
+struct Buffer;
+struct CopyPass;
+
+// Sub-allocates the data uploaded each frame linearly out of large persistently mapped buffers
+// Every slot of the frame ring has its own buffers, reused once the ring comes back to the slot and its work is finished
+// The copies to the destination buffers are batched in a single copy pass per frame
+struct UploadRing {
+	struct Allocation {
+		std::shared_ptr<Buffer> _buffer;
+		size_t _offset = 0;
+		std::span<uint8_t> _data;
+	};
+
+	bool Init(Rhi *rhi, size_t blockSize = s_defaultBlockSize);
+
+	// Space that stays valid until the frame ring comes back to the current slot
+	Allocation Alloc(size_t size, size_t alignment = s_defaultAlignment);
+	// Space for new contents of a region of the buffer, copied there by the frame's copy pass
+	std::span<uint8_t> Upload(std::shared_ptr<Buffer> const &dst, size_t dstOffset, size_t size);
+	// The pass with the copies recorded so far, the following uploads start a new one
+	// The data written so far is flushed, so the pass can be submitted right away
+	std::shared_ptr<CopyPass> TakeCopyPass();
+	// Makes the data written so far this frame visible to the device
+	bool Flush();
+
+	struct Block {
+		std::shared_ptr<Buffer> _buffer;
+		std::span<uint8_t> _mapped;
+	};
+	struct FrameBlocks {
+		std::vector<Block> _blocks;
+		uint32_t _current = 0;
+		size_t _offset = 0;
+		uint64_t _frameNumber = ~0ull;
+	};
+
+	FrameBlocks &GetFrameBlocks();
+
+	Rhi *_rhi = nullptr;
+	size_t _blockSize = 0;
+	std::vector<FrameBlocks> _frames;
+	std::shared_ptr<CopyPass> _copyPass;
+
+	static constexpr size_t s_defaultBlockSize = 4 * 1024 * 1024;
+	// enough for the offsets of copies and uniform buffer data
+	static constexpr size_t s_defaultAlignment = 256;
+};
+
+}
\ No newline at end of file
@@ -10,43 +10,118 @@ static auto s_regTypes = TypeInfo::AddInitializer("base_vk", [] {
 });
 
 
-CmdRecorderVk::~CmdRecorderVk()
+CmdPoolVk::~CmdPoolVk()
 {
-    // buffers are freed by this call as well
-    _rhi->_device.destroyCommandPool(_cmdPool, _rhi->AllocCallbacks());
+    // buffers are freed with the pool as well
+    if (_rhi)
+        _rhi->_device.destroyCommandPool(_pool, _rhi->AllocCallbacks());
 }
 
-bool CmdRecorderVk::Init(RhiVk *rhi, uint32_t queueFamily)
+bool CmdPoolVk::Init(RhiVk *rhi, uint32_t queueFamily)
 {
+    ASSERT(!_rhi);
     _rhi = rhi;
     _queueFamily = queueFamily;
     vk::CommandPoolCreateInfo poolInfo{
-        vk::CommandPoolCreateFlags(),
+        vk::CommandPoolCreateFlagBits::eTransient,
         _queueFamily,
     };
-    if (_rhi->_device.createCommandPool(&poolInfo, _rhi->AllocCallbacks(), &_cmdPool) != vk::Result::eSuccess)
+    if (_rhi->_device.createCommandPool(&poolInfo, _rhi->AllocCallbacks(), &_pool) != vk::Result::eSuccess)
+        return false;
+
+    return true;
+}
+
+bool CmdPoolVk::Reset(uint64_t frameNumber)
+{
+    // buffers that are still being recorded into, or waiting to be submitted, keep the pool from being recycled this time
+    if (_numUnsubmitted) {
+        _frameNumber = frameNumber;
+        return true;
+    }
+
+    // the frame ring should already have waited for the slot, this only blocks for work submitted after its frame ended
+    if (!_rhi->WaitCounter(_lastUseCounter))
         return false;
 
+    if (_rhi->_device.resetCommandPool(_pool) != vk::Result::eSuccess)
+        return false;
+
+    _numBorrowed.fill(0);
+    _frameNumber = frameNumber;
+
+    return true;
+}
+
+vk::CommandBuffer CmdPoolVk::Borrow(vk::CommandBufferLevel level)
+{
+    uint32_t levelIndex = (uint32_t)level;
+    auto &buffers = _buffers[levelIndex];
+    uint32_t &numBorrowed = _numBorrowed[levelIndex];
+    if (numBorrowed == buffers.size()) {
+        vk::CommandBufferAllocateInfo bufInfo{
+            _pool,
+            level,
+            1,
+        };
+        vk::CommandBuffer buffer;
+        if (_rhi->_device.allocateCommandBuffers(&bufInfo, &buffer) != vk::Result::eSuccess)
+            return vk::CommandBuffer();
+        buffers.push_back(buffer);
+    }
+
+    return buffers[numBorrowed++];
+}
+
+void CmdPoolVk::UpdateLastUse(uint64_t counter)
+{
+    uint64_t lastUse = _lastUseCounter;
+    while (lastUse < counter && !_lastUseCounter.compare_exchange_weak(lastUse, counter));
+}
+
+
+CmdRecorderVk::~CmdRecorderVk()
+{
+    // buffers that were never submitted don't keep the pools from being reset
+    if (!_lastUseCounter) {
+        for (CmdPoolVk *pool : _pools) {
+            --pool->_numUnsubmitted;
+        }
+    }
+}
+
+bool CmdRecorderVk::Init(RhiVk *rhi, uint32_t queueFamily)
+{
+    _rhi = rhi;
+    _queueFamily = queueFamily;
     return true;
 }
 
 void CmdRecorderVk::Clear()
 {
-    _rhi->_device.freeCommandBuffers(_cmdPool, _cmdBuffers);
+    // the buffers go back to their pools when the pools are reset
     _cmdBuffers.clear();
 }
 
 vk::CommandBuffer CmdRecorderVk::AllocCmdBuffer(vk::CommandBufferLevel level, std::string name)
 {
-    vk::CommandBufferAllocateInfo bufInfo{
-        _cmdPool,
-        level,
-        1,
-    };
-    vk::CommandBuffer buffer;
-    if (_rhi->_device.allocateCommandBuffers(&bufInfo, &buffer) != vk::Result::eSuccess)
+    CmdPoolVk *pool = _rhi->GetCmdPool(_queueFamily);
+    if (!pool)
+        return vk::CommandBuffer();
+
+    vk::CommandBuffer buffer = pool->Borrow(level);
+    if (!buffer)
         return vk::CommandBuffer();
 
+    if (std::find(_pools.begin(), _pools.end(), pool) == _pools.end()) {
+        _pools.push_back(pool);
+        // the pool isn't reset until the buffer is stamped with the counter of the submission executing it
+        if (!_lastUseCounter)
+            ++pool->_numUnsubmitted;
+    }
+    if (_lastUseCounter)
+        pool->UpdateLastUse(_lastUseCounter);
+
     _rhi->SetDebugName(vk::ObjectType::eCommandBuffer, (uint64_t)(VkCommandBuffer)buffer, name.c_str());
 
     _cmdBuffers.push_back(buffer);
@@ -87,6 +162,7 @@ bool CmdRecorderVk::EndCmds(vk::CommandBuffer cmds)
 bool CmdRecorderVk::Execute(Submission *sub)
 {
     auto *subVk = static_cast<SubmissionVk *>(sub);
+    SetLastUseCounter(subVk->_executeSignalValue);
 
     ExecuteDataVk exec;
     exec._cmds.insert(exec._cmds.end(), _cmdBuffers.begin(), _cmdBuffers.end());
@@ -96,6 +172,17 @@ bool CmdRecorderVk::Execute(Submission *sub)
     return true;
 }
 
+void CmdRecorderVk::SetLastUseCounter(uint64_t counter)
+{
+    ASSERT(counter);
+    for (CmdPoolVk *pool : _pools) {
+        pool->UpdateLastUse(counter);
+        if (!_lastUseCounter)
+            --pool->_numUnsubmitted;
+    }
+    _lastUseCounter = counter;
+}
+
 bool TimelineSemaphoreVk::Init(RhiVk *rhi, std::string name, uint64_t initValue)
 {
     ASSERT(!_rhi);
@@ -172,6 +259,76 @@ vk::PipelineStageFlags GetPipelineStages(ResourceUsage usage)
     return flags;
 }
 
+vk::PipelineStageFlags2 GetPipelineStages2(ResourceUsage usage)
+{
+    // initial and presentation states are ordered by semaphores and need no stages
+    vk::PipelineStageFlags2 flags;
+    if (usage.rt)
+        flags |= vk::PipelineStageFlagBits2::eColorAttachmentOutput;
+    if (usage.ds)
+        flags |= vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests;
+    if (usage.uav)
+        flags |= vk::PipelineStageFlagBits2::eComputeShader;
+    if (usage.vb)
+        flags |= vk::PipelineStageFlagBits2::eVertexAttributeInput;
+    if (usage.ib)
+        flags |= vk::PipelineStageFlagBits2::eIndexInput;
+    if (usage.srv)
+        flags |=
+            vk::PipelineStageFlagBits2::eVertexShader |
+            vk::PipelineStageFlagBits2::eFragmentShader |
+            vk::PipelineStageFlagBits2::eComputeShader;
+    if (usage.copySrc || usage.copyDst)
+        flags |= vk::PipelineStageFlagBits2::eCopy | vk::PipelineStageFlagBits2::eBlit;
+    if (usage.cpuAccess)
+        flags |= vk::PipelineStageFlagBits2::eHost;
+
+    return flags;
+}
+
+vk::AccessFlags2 GetAccess2(ResourceUsage usage)
+{
+    // only the accesses matching the usage's direction, unlike the legacy masks
+    vk::AccessFlags2 flags;
+    if (usage.read) {
+        if (usage.ib)
+            flags |= vk::AccessFlagBits2::eIndexRead;
+        if (usage.vb)
+            flags |= vk::AccessFlagBits2::eVertexAttributeRead;
+        if (usage.srv)
+            flags |= vk::AccessFlagBits2::eShaderSampledRead | vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eUniformRead;
+        if (usage.copySrc || usage.copyDst)
+            flags |= vk::AccessFlagBits2::eTransferRead;
+        if (usage.cpuAccess)
+            flags |= vk::AccessFlagBits2::eHostRead;
+    }
+    if (usage.write) {
+        if (usage.copySrc || usage.copyDst)
+            flags |= vk::AccessFlagBits2::eTransferWrite;
+        if (usage.cpuAccess)
+            flags |= vk::AccessFlagBits2::eHostWrite;
+    }
+    // storage resources are read by loads and atomics even when they're only declared as written
+    if (usage.uav) {
+        flags |= vk::AccessFlagBits2::eShaderStorageRead;
+        if (usage.write)
+            flags |= vk::AccessFlagBits2::eShaderStorageWrite;
+    }
+    // attachments are read by loads and blending even when written
+    if (usage.rt) {
+        flags |= vk::AccessFlagBits2::eColorAttachmentRead;
+        if (usage.write)
+            flags |= vk::AccessFlagBits2::eColorAttachmentWrite;
+    }
+    if (usage.ds) {
+        flags |= vk::AccessFlagBits2::eDepthStencilAttachmentRead;
+        if (usage.write)
+            flags |= vk::AccessFlagBits2::eDepthStencilAttachmentWrite;
+    }
+
+    return flags;
+}
+
 vk::AccessFlags GetAllAccess(ResourceUsage usage)
 {
     vk::AccessFlags flags;
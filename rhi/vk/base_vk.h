@@ -32,6 +32,8 @@
 
 #include "vk_mem_alloc.h"
 
+#include <thread>
+
 #include "../base.h"
 #include "utl/enumutl.h"
 
@@ -39,9 +41,40 @@ namespace rhi {
 
 struct RhiVk;
 struct Submission;
+
+// A command pool owned by a single thread for one slot of the frame ring, its buffers are recycled in bulk
+struct CmdPoolVk {
+	~CmdPoolVk();
+
+	bool Init(RhiVk *rhi, uint32_t queueFamily);
+	bool Reset(uint64_t frameNumber);
+
+	vk::CommandBuffer Borrow(vk::CommandBufferLevel level);
+	void UpdateLastUse(uint64_t counter);
+
+	RhiVk *_rhi = nullptr;
+	uint32_t _queueFamily = ~0;
+	vk::CommandPool _pool;
+	// allocated buffers and the number of them already borrowed this frame, per command buffer level
+	std::array<std::vector<vk::CommandBuffer>, 2> _buffers;
+	std::array<uint32_t, 2> _numBorrowed{};
+	uint64_t _frameNumber = ~0ull;
+	std::atomic<uint64_t> _lastUseCounter = 0;
+	// recorders with buffers from the pool that aren't stamped with a submission's counter yet, the pool isn't reset while
+	// there are any
+	std::atomic<uint32_t> _numUnsubmitted = 0;
+	// the last frame the pool was handed out in, set under the rhi's lock of the pools
+	uint64_t _lastHandedOutFrame = 0;
+};
+
+// Records into command buffers borrowed from the ring of per-thread pools in RhiVk
 struct CmdRecorderVk {
+	CmdRecorderVk() = default;
+	CmdRecorderVk(CmdRecorderVk &&other) = default;
 	~CmdRecorderVk();
 
+	CmdRecorderVk &operator=(CmdRecorderVk &&other) = delete;
+
 	bool Init(RhiVk *rhi, uint32_t queueFamily);
 
 	void Clear();
@@ -53,10 +86,13 @@ struct CmdRecorderVk {
 
 	bool Execute(Submission *sub);
 
+	void SetLastUseCounter(uint64_t counter);
+
 	RhiVk *_rhi = nullptr;
 	uint32_t _queueFamily = ~0;
 	std::vector<vk::CommandBuffer> _cmdBuffers;
-	vk::CommandPool _cmdPool;
+	std::vector<CmdPoolVk *> _pools;
+	uint64_t _lastUseCounter = 0;
 };
 
 struct TimelineSemaphoreVk {
@@ -71,19 +107,23 @@ struct TimelineSemaphoreVk {
 
 	RhiVk *_rhi = nullptr;
 	vk::Semaphore _semaphore;
-	std::atomic<uint64_t> _value;
 	std::string _name;
 };
 
 struct SemaphoreReferenceVk {
 	vk::Semaphore _semaphore;
 	vk::PipelineStageFlags _stages;
+	// the wait stages when submitting with synchronization2, if empty they're taken from _stages
+	vk::PipelineStageFlags2 _stages2;
 	uint64_t _counter = ~0ull;
 };
 
 struct ResourceStateVk {
 	vk::AccessFlags _access;
 	vk::PipelineStageFlags _stages;
+	// precise masks for synchronization2 barriers
+	vk::AccessFlags2 _access2;
+	vk::PipelineStageFlags2 _stages2;
 	vk::ImageLayout _layout;
 	SemaphoreReferenceVk _semaphore;
 };
@@ -100,9 +140,17 @@ struct ResourceTransitionVk {
 struct ResourceVk {
 	virtual ~ResourceVk() {}
 	virtual ResourceTransitionVk GetTransitionData(ResourceUsage prevUsage, ResourceUsage usage) = 0;
+
+	// timeline value and queue of the last submission that used the resource
+	uint64_t _lastUseCounter = 0;
+	QueueKind _lastUseQueue = QueueKind::Universal;
+	// queue whose family owns the contents, as of the submissions prepared so far
+	QueueKind _ownerQueue = QueueKind::Universal;
 };
 
 vk::PipelineStageFlags GetPipelineStages(ResourceUsage usage);
+vk::PipelineStageFlags2 GetPipelineStages2(ResourceUsage usage);
+vk::AccessFlags2 GetAccess2(ResourceUsage usage);
 vk::ImageAspectFlags GetImageAspect(Format fmt);
 vk::ImageSubresourceLayers GetImageSubresourceLayers(ResourceView const &view, uint32_t mipLevel = ~0u);
 vk::ImageTiling GetImageTiling(ResourceUsage usage);
@@ -146,6 +194,9 @@ inline vk::AccessFlags GetAccess(ResourceUsage usage) {
 			access = GetReadAccess(usage);
 	} else if (usage.write)
 		access = GetWriteAccess(usage);
+	// storage resources are read by loads and atomics even when they're only declared as written
+	if (usage.uav)
+		access |= vk::AccessFlagBits::eShaderRead;
 	return access;
 }
 
@@ -175,20 +226,41 @@ inline vk::Viewport GetViewport(utl::BoxF const &vp) {
 ResourceUsage GetUsageFromFormatFeatures(vk::FormatFeatureFlags fmtFlags);
 
 static inline const utl::ValueRemapper<vk::Format, Format> s_vk2Format{ {
-		{ vk::Format::eUndefined,          Format::Invalid       },
-		{ vk::Format::eR8G8B8A8Unorm,      Format::R8G8B8A8      },
-		{ vk::Format::eR8G8B8A8Srgb,       Format::R8G8B8A8_srgb },
-		{ vk::Format::eB8G8R8A8Unorm,      Format::B8G8R8A8      },
-		{ vk::Format::eB8G8R8A8Srgb,       Format::B8G8R8A8_srgb },
-		{ vk::Format::eR8Unorm,            Format::R8            },
-		{ vk::Format::eR8G8Unorm,          Format::R8G8          },
-		{ vk::Format::eR8G8B8Unorm,        Format::R8G8B8        },
-		{ vk::Format::eR16Uint,            Format::R16_u         },
-		{ vk::Format::eR32Uint,            Format::R32_u         },
-		{ vk::Format::eD24UnormS8Uint,     Format::D24S8         },
-		{ vk::Format::eD32SfloatS8Uint,    Format::D32S8         },
-		{ vk::Format::eD32Sfloat,          Format::D32           },
-		{ vk::Format::eS8Uint,             Format::S8            },
+		{ vk::Format::eUndefined,              Format::Invalid            },
+		{ vk::Format::eR8G8B8A8Unorm,          Format::R8G8B8A8           },
+		{ vk::Format::eR8G8B8A8Srgb,           Format::R8G8B8A8_srgb      },
+		{ vk::Format::eB8G8R8A8Unorm,          Format::B8G8R8A8           },
+		{ vk::Format::eB8G8R8A8Srgb,           Format::B8G8R8A8_srgb      },
+		{ vk::Format::eR8Unorm,                Format::R8                 },
+		{ vk::Format::eR8G8Unorm,              Format::R8G8               },
+		{ vk::Format::eR8G8B8Unorm,            Format::R8G8B8             },
+		{ vk::Format::eR16Uint,                Format::R16_u              },
+		{ vk::Format::eR32Uint,                Format::R32_u              },
+		{ vk::Format::eBc1RgbaUnormBlock,      Format::BC1                },
+		{ vk::Format::eBc1RgbaSrgbBlock,       Format::BC1_srgb           },
+		{ vk::Format::eBc2UnormBlock,          Format::BC2                },
+		{ vk::Format::eBc2SrgbBlock,           Format::BC2_srgb           },
+		{ vk::Format::eBc3UnormBlock,          Format::BC3                },
+		{ vk::Format::eBc3SrgbBlock,           Format::BC3_srgb           },
+		{ vk::Format::eBc4UnormBlock,          Format::BC4                },
+		{ vk::Format::eBc5UnormBlock,          Format::BC5                },
+		{ vk::Format::eBc6HUfloatBlock,        Format::BC6H_uf            },
+		{ vk::Format::eBc7UnormBlock,          Format::BC7                },
+		{ vk::Format::eBc7SrgbBlock,           Format::BC7_srgb           },
+		{ vk::Format::eEtc2R8G8B8UnormBlock,   Format::ETC2_R8G8B8        },
+		{ vk::Format::eEtc2R8G8B8SrgbBlock,    Format::ETC2_R8G8B8_srgb   },
+		{ vk::Format::eEtc2R8G8B8A8UnormBlock, Format::ETC2_R8G8B8A8      },
+		{ vk::Format::eEtc2R8G8B8A8SrgbBlock,  Format::ETC2_R8G8B8A8_srgb },
+		{ vk::Format::eAstc4x4UnormBlock,      Format::ASTC_4x4           },
+		{ vk::Format::eAstc4x4SrgbBlock,       Format::ASTC_4x4_srgb      },
+		{ vk::Format::eAstc6x6UnormBlock,      Format::ASTC_6x6           },
+		{ vk::Format::eAstc6x6SrgbBlock,       Format::ASTC_6x6_srgb      },
+		{ vk::Format::eAstc8x8UnormBlock,      Format::ASTC_8x8           },
+		{ vk::Format::eAstc8x8SrgbBlock,       Format::ASTC_8x8_srgb      },
+		{ vk::Format::eD24UnormS8Uint,         Format::D24S8              },
+		{ vk::Format::eD32SfloatS8Uint,        Format::D32S8              },
+		{ vk::Format::eD32Sfloat,              Format::D32                },
+		{ vk::Format::eS8Uint,                 Format::S8                 },
 	} };
 
 static inline const utl::ValueRemapper<VkImageUsageFlags, ResourceUsage, true> s_vkImageUsage2ResourceUsage{ {
@@ -14,7 +14,12 @@ static auto s_regTypes = TypeInfo::AddInitializer("buffer_vk", [] {
 BufferVk::~BufferVk()
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	vmaDestroyBuffer(rhi->_vma, _buffer, _vmaAlloc);
+	if (_vmaAlloc) {
+		VmaAllocationInfo allocInfo;
+		vmaGetAllocationInfo(rhi->_vma, _vmaAlloc, &allocInfo);
+		rhi->CountResourceMemory(Rhi::GetResourceKind(_descriptor._usage), -1, -(int64_t)allocInfo.size);
+	}
+	rhi->Retire(_lastUseCounter, _buffer, _vmaAlloc);
 }
 
 vk::BufferUsageFlags GetBufferUsage(ResourceUsage usage)
@@ -54,7 +59,37 @@ bool BufferVk::Init(ResourceDescriptor const &desc)
 		queueFamilies.data(),
 	};
 	VmaAllocationCreateInfo allocInfo = rhi->GetVmaAllocCreateInfo(this);
-	if ((vk::Result)vmaCreateBuffer(rhi->_vma, (VkBufferCreateInfo*)&bufInfo, &allocInfo, (VkBuffer*)&_buffer, &_vmaAlloc, nullptr) != vk::Result::eSuccess)
+	VmaAllocationInfo allocResult;
+	if ((vk::Result)vmaCreateBuffer(rhi->_vma, (VkBufferCreateInfo*)&bufInfo, &allocInfo, (VkBuffer*)&_buffer, &_vmaAlloc, &allocResult) != vk::Result::eSuccess)
+		return false;
+	if (allocInfo.flags & VMA_ALLOCATION_CREATE_MAPPED_BIT) {
+		ASSERT(allocResult.pMappedData);
+		_mapped = std::span((uint8_t *)allocResult.pMappedData, GetSize());
+	}
+	rhi->CountResourceMemory(Rhi::GetResourceKind(_descriptor._usage), 1, allocResult.size);
+
+	rhi->SetDebugName(vk::ObjectType::eBuffer, (uint64_t)(VkBuffer)_buffer, _name.c_str());
+	rhi->SetDebugName(_vmaAlloc, _name.c_str());
+
+	return true;
+}
+
+bool BufferVk::Init(ResourceDescriptor const &desc, VmaAllocation vmaAlloc, vk::DeviceSize offset)
+{
+	if (!Buffer::Init(desc))
+		return false;
+
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	auto queueFamilies = rhi->GetQueueFamilyIndices(_descriptor._usage);
+	vk::BufferCreateInfo bufInfo{
+		vk::BufferCreateFlags(),
+		GetSize(),
+		GetBufferUsage(_descriptor._usage),
+		vk::SharingMode::eExclusive,
+		(uint32_t)queueFamilies.size(),
+		queueFamilies.data(),
+	};
+	if ((vk::Result)vmaCreateAliasingBuffer2(rhi->_vma, vmaAlloc, offset, (VkBufferCreateInfo*)&bufInfo, (VkBuffer*)&_buffer) != vk::Result::eSuccess)
 		return false;
 
 	rhi->SetDebugName(vk::ObjectType::eBuffer, (uint64_t)(VkBuffer)_buffer, _name.c_str());
@@ -65,17 +100,45 @@ bool BufferVk::Init(ResourceDescriptor const &desc)
 std::span<uint8_t> BufferVk::Map()
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	void *mapped = nullptr;
-	if ((vk::Result)vmaMapMemory(rhi->_vma, _vmaAlloc, &mapped) != vk::Result::eSuccess)
+	std::span<uint8_t> mapped = _mapped;
+	if (mapped.empty()) {
+		void *mappedPtr = nullptr;
+		if ((vk::Result)vmaMapMemory(rhi->_vma, _vmaAlloc, &mappedPtr) != vk::Result::eSuccess)
+			return std::span<uint8_t>();
+		mapped = std::span((uint8_t *)mappedPtr, GetSize());
+	}
+	// buffers only written by the host don't need the device's writes
+	HostAccess access = _descriptor._hostAccess;
+	if (access != HostAccess::Upload && access != HostAccess::Dynamic && !InvalidateRange(0, GetSize()))
 		return std::span<uint8_t>();
-	return std::span((uint8_t *)mapped, GetSize());
+	return mapped;
 }
 
 bool BufferVk::Unmap()
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	vmaUnmapMemory(rhi->_vma, _vmaAlloc);
-	return true;
+	bool res = _descriptor._hostAccess == HostAccess::Readback || FlushRange(0, GetSize());
+	if (_mapped.empty())
+		vmaUnmapMemory(rhi->_vma, _vmaAlloc);
+	return res;
+}
+
+std::span<uint8_t> BufferVk::GetPersistentMapping()
+{
+	return _mapped;
+}
+
+bool BufferVk::FlushRange(size_t offset, size_t size)
+{
+	// a no-op for host coherent memory
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	return (vk::Result)vmaFlushAllocation(rhi->_vma, _vmaAlloc, offset, size) == vk::Result::eSuccess;
+}
+
+bool BufferVk::InvalidateRange(size_t offset, size_t size)
+{
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	return (vk::Result)vmaInvalidateAllocation(rhi->_vma, _vmaAlloc, offset, size) == vk::Result::eSuccess;
 }
 
 ResourceTransitionVk BufferVk::GetTransitionData(ResourceUsage prevUsage, ResourceUsage usage)
@@ -92,6 +155,8 @@ ResourceStateVk BufferVk::GetState(ResourceUsage usage)
 	ResourceStateVk state;
 	state._access = GetAccess(usage);
 	state._stages = GetPipelineStages(usage);
+	state._access2 = GetAccess2(usage);
+	state._stages2 = GetPipelineStages2(usage);
 	return state;
 }
 
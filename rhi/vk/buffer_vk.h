@@ -9,10 +9,16 @@ struct BufferVk final : Buffer, ResourceVk {
 	~BufferVk() override;
 
 	bool Init(ResourceDescriptor const &desc) override;
+	// Creates the buffer over an allocation it doesn't own
+	bool Init(ResourceDescriptor const &desc, VmaAllocation vmaAlloc, vk::DeviceSize offset);
 
 	std::span<uint8_t> Map() override;
 	bool Unmap() override;
 
+	std::span<uint8_t> GetPersistentMapping() override;
+	bool FlushRange(size_t offset, size_t size) override;
+	bool InvalidateRange(size_t offset, size_t size) override;
+
 	ResourceTransitionVk GetTransitionData(ResourceUsage prevUsage, ResourceUsage usage) override;
 	ResourceStateVk GetState(ResourceUsage usage);
 
@@ -20,6 +26,8 @@ struct BufferVk final : Buffer, ResourceVk {
 
 	vk::Buffer _buffer;
 	VmaAllocation _vmaAlloc = {};
+	// set for the host access modes that keep the buffer mapped
+	std::span<uint8_t> _mapped;
 };
 
 }
\ No newline at end of file
@@ -16,12 +16,23 @@ bool ComputePassVk::Prepare(Submission *sub)
 {
 	ASSERT(all(greaterThan(_pipeline->_pipelineData.GetComputeGroupSize(), glm::ivec3(0))));
 
+	// later passes consume the dispatch's output, it can't be skipped while the pipeline is compiling
+	if (!_pipeline->WaitReady())
+		return false;
+
 	auto subVk = static_cast<SubmissionVk *>(sub);
+	for (auto &set : _resourceSets) {
+		static_cast<ResourceSetVk *>(set.get())->SetLastUseCounter(subVk->_executeSignalValue);
+	}
+	static_cast<PipelineVk *>(_pipeline.get())->SetLastUseCounter(subVk->_executeSignalValue);
 
 	_cmds = subVk->_recorder.BeginCmds(_name);
 	if (!_cmds)
 		return false;
 
+	if (!subVk->RecordTransitions(this, _cmds))
+		return false;
+
 	auto *pipeVk = static_cast<PipelineVk *>(_pipeline.get());
 	_cmds.bindPipeline(vk::PipelineBindPoint::eCompute, pipeVk->_pipeline);
 
@@ -30,8 +41,8 @@ bool ComputePassVk::Prepare(Submission *sub)
 		auto *setVk = static_cast<ResourceSetVk *>(set.get());
 		descSets.push_back(setVk->_descSet._set);
 	}
-	std::array<uint32_t, 0> noDynamicOffsets;
-	_cmds.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeVk->_layout, 0, descSets, noDynamicOffsets);
+	_cmds.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeVk->_layout, 0, descSets, _dynamicOffsets);
+	pipeVk->PushConstants(_cmds, _pushConstants);
 
 	_cmds.dispatch(_numGroups.x, _numGroups.y, _numGroups.z);
 
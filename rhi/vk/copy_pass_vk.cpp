@@ -3,6 +3,7 @@
 #include "buffer_vk.h"
 #include "texture_vk.h"
 #include "submit_vk.h"
+#include "utl/mathutl.h"
 
 namespace rhi {
 
@@ -18,49 +19,58 @@ bool CopyPassVk::NeedsMatchingTextures(CopyData &copy)
 	return !CanBlit(copy);
 }
 
-void RecordTransferBarrier(vk::CommandBuffer cmds, uint32_t queueFamily, ResourceRef &ref, bool toDst)
+void CopyPassVk::RecordInternalBarriers(CopyData &copy, std::vector<ResourceUsage> &subresourceStates)
 {
-	vk::AccessFlags srcAccess = toDst ? vk::AccessFlagBits::eTransferRead : vk::AccessFlagBits::eTransferWrite;
-	vk::AccessFlags dstAccess = toDst ? vk::AccessFlagBits::eTransferWrite : vk::AccessFlagBits::eTransferRead;
-	if (auto *texVk = Cast<TextureVk>(ref._bindable.get())) {
-		vk::ImageMemoryBarrier imgBarrier{
-			srcAccess,
-			dstAccess,
-			toDst ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::eTransferDstOptimal,
-			toDst ? vk::ImageLayout::eTransferDstOptimal : vk::ImageLayout::eTransferSrcOptimal,
-			queueFamily,
-			queueFamily,
-			texVk->_image,
-			GetViewSubresourceRange(ref._view),
-		};
-		cmds.pipelineBarrier(
-			vk::PipelineStageFlagBits::eTransfer,
-			vk::PipelineStageFlagBits::eTransfer,
-			vk::DependencyFlags(),
-			nullptr,
-			nullptr,
-			imgBarrier);
-	} else if (auto *bufVk = Cast<BufferVk>(ref._bindable.get())) {
-		vk::BufferMemoryBarrier bufBarrier{
-			srcAccess,
-			dstAccess,
-			queueFamily,
-			queueFamily,
-			bufVk->_buffer,
-			(vk::DeviceSize)ref._view._region._min[0],
-			(vk::DeviceSize)ref._view._region.GetSize()[0],
-		};
-		cmds.pipelineBarrier(
-			vk::PipelineStageFlagBits::eTransfer,
-			vk::PipelineStageFlagBits::eTransfer,
-			vk::DependencyFlags(),
-			nullptr,
-			bufBarrier,
-			nullptr);
-
-	} else {
-		ASSERT(0);
-	}
+	auto *resource = static_cast<Resource *>(copy._dst._bindable.get());
+	auto *texVk = Cast<TextureVk>(resource);
+	auto *bufVk = Cast<BufferVk>(resource);
+	std::vector<vk::ImageMemoryBarrier> imageBarriers;
+	std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+	auto addBarriers = [&](ResourceRef &ref, ResourceUsage usage) {
+		resource->EnumSubresources(ref._view, [&](uint32_t sub) {
+			ResourceUsage &state = subresourceStates[sub];
+			// subresources that weren't touched yet are already in their first usage in the pass
+			if (state && state != usage) {
+				if (texVk) {
+					uint32_t numMips = resource->GetNumMips();
+					imageBarriers.push_back(vk::ImageMemoryBarrier{
+						GetAccess(state),
+						GetAccess(usage),
+						GetImageLayout(state),
+						GetImageLayout(usage),
+						vk::QueueFamilyIgnored,
+						vk::QueueFamilyIgnored,
+						texVk->_image,
+						vk::ImageSubresourceRange{ GetImageAspect(resource->_descriptor._format), sub % numMips, 1, sub / numMips, 1 },
+					});
+				} else if (bufVk) {
+					bufferBarriers.push_back(vk::BufferMemoryBarrier{
+						GetAccess(state),
+						GetAccess(usage),
+						vk::QueueFamilyIgnored,
+						vk::QueueFamilyIgnored,
+						bufVk->_buffer,
+						0,
+						vk::WholeSize,
+					});
+				}
+			}
+			state = usage;
+		});
+	};
+	addBarriers(copy._src, ResourceUsage{ .copySrc = 1, .read = 1 });
+	addBarriers(copy._dst, ResourceUsage{ .copyDst = 1, .write = 1 });
+
+	if (imageBarriers.empty() && bufferBarriers.empty())
+		return;
+
+	_cmds.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		nullptr,
+		bufferBarriers,
+		imageBarriers);
 }
 
 bool CopyPassVk::Prepare(Submission *sub)
@@ -70,11 +80,25 @@ bool CopyPassVk::Prepare(Submission *sub)
 	if (!_cmds)
 		return false;
 
+	if (!subVk->RecordTransitions(this, _cmds))
+		return false;
+
+	for (auto &fill : _fills) {
+		auto *buf = static_cast<BufferVk *>(fill._dst._bindable.get());
+		_cmds.fillBuffer(buf->_buffer, fill._dst._view._region._min[0], fill._dst._view._region.GetSize()[0], fill._value);
+	}
+
+	// copies within a resource only get barriers for the subresources a previous copy in the pass used differently
+	std::unordered_map<Resource *, std::vector<ResourceUsage>> subresourceStates;
 	for (auto &copy : _copies) {
 		CopyType cpType = copy.GetCopyType();
 
-		if (copy._src._bindable == copy._dst._bindable) 
-			RecordTransferBarrier(_cmds, subVk->_recorder._queueFamily, copy._dst, true);
+		if (copy._src._bindable == copy._dst._bindable) {
+			auto *resource = static_cast<Resource *>(copy._dst._bindable.get());
+			auto &states = subresourceStates[resource];
+			states.resize(resource->_states.size());
+			RecordInternalBarriers(copy, states);
+		}
 
 		if (!cpType.srcTex && !cpType.dstTex) {
 			CopyBufToBuf(copy);
@@ -85,14 +109,13 @@ bool CopyPassVk::Prepare(Submission *sub)
 		} else {
 			ASSERT(cpType.srcTex && cpType.dstTex);
 
-			if (CanBlit(copy))
+			// blits are graphics commands, on transfer and compute queues textures can only be copied
+			if (CanBlit(copy) && (subVk->GetQueueData()._flags & vk::QueueFlagBits::eGraphics))
 				BlitTexToTex(copy);
 			else
 				CopyTexToTex(copy);
 		}
 
-		if (copy._src._bindable == copy._dst._bindable)
-			RecordTransferBarrier(_cmds, subVk->_recorder._queueFamily, copy._dst, false);
 	}
 
 	if (!subVk->_recorder.EndCmds(_cmds))
@@ -171,14 +194,24 @@ bool CopyPassVk::CanBlit(CopyData &copy)
 	return (srcFeatures & vk::FormatFeatureFlagBits::eBlitSrc) && (dstFeatures & vk::FormatFeatureFlagBits::eBlitDst);
 }
 
+// The buffer side of a copy is tightly packed, its rows are in texels and cover whole blocks of compressed formats
+static uint32_t GetBufferRowLength(ResourceView const &texView)
+{
+	return utl::RoundUp<uint32_t>(std::max(texView._region.GetSize()[0], 1), GetFormatBlockSize(texView._format).x);
+}
+
+static uint32_t GetBufferImageHeight(ResourceView const &texView)
+{
+	return utl::RoundUp<uint32_t>(std::max(texView._region.GetSize()[1], 1), GetFormatBlockSize(texView._format).y);
+}
+
 void CopyPassVk::CopyTexToBuf(CopyData &copy)
 {
 	ASSERT(copy._src._view._mipRange.GetSize() == 1);
-	uint32_t pixSize = GetFormatSize(copy._src._view._format);
 	vk::BufferImageCopy region{
 		(vk::DeviceSize)copy._dst._view._region._min[0],
-		pixSize * copy._src._view._region.GetSize()[0],
-		(uint32_t)copy._src._view._region.GetSize()[1],
+		GetBufferRowLength(copy._src._view),
+		GetBufferImageHeight(copy._src._view),
 		GetImageSubresourceLayers(copy._src._view),
 		GetOffset3D(copy._src._view._region._min),
 		GetExtent3D(copy._src._view._region.GetSize()),
@@ -193,8 +226,8 @@ void CopyPassVk::CopyBufToTex(CopyData &copy)
 	ASSERT(copy._dst._view._mipRange.GetSize() == 1);
 	vk::BufferImageCopy region{
 		(vk::DeviceSize)copy._src._view._region._min[0],
-		(uint32_t)copy._dst._view._region.GetSize()[0],
-		(uint32_t)copy._dst._view._region.GetSize()[1],
+		GetBufferRowLength(copy._dst._view),
+		GetBufferImageHeight(copy._dst._view),
 		GetImageSubresourceLayers(copy._dst._view),
 		GetOffset3D(copy._dst._view._region._min),
 		GetExtent3D(copy._dst._view._region.GetSize()),
@@ -22,6 +22,8 @@ struct CopyPassVk final : CopyPass {
 
 	bool CanBlit(CopyData &copy);
 
+	void RecordInternalBarriers(CopyData &copy, std::vector<ResourceUsage> &subresourceStates);
+
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<CopyPassVk>(); }
 
 	vk::CommandBuffer _cmds;
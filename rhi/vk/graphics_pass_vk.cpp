@@ -17,8 +17,8 @@ static auto s_regTypes = TypeInfo::AddInitializer("graphics_pass_vk", [] {
 GraphicsPassVk::~GraphicsPassVk()
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	rhi->_device.destroyFramebuffer(_framebuffer, rhi->AllocCallbacks());
-	rhi->_device.destroyRenderPass(_renderPass, rhi->AllocCallbacks());
+	rhi->Retire(_lastUseCounter, _framebuffer);
+	rhi->Retire(_lastUseCounter, _renderPass);
 }
 
 bool GraphicsPassVk::InitRhi(Rhi *rhi, std::string name)
@@ -44,48 +44,113 @@ bool GraphicsPassVk::Init(std::span<RenderTargetData> rts, utl::BoxF const &view
 	if (!InitFramebuffer())
 		return false;
 
-	vk::CommandBuffer cmds = _recorder.BeginCmds(_name);
-	if (!cmds)
+	if (!InitContexts(1))
 		return false;
 
-	std::vector<vk::ClearValue> clearValues;
-	for (auto &rt : _renderTargets) {
-		if (rt._texture->_descriptor._usage.ds) {
-			clearValues.emplace_back(vk::ClearDepthStencilValue(rt._clearValue[0], (uint32_t)rt._clearValue[1]));
-		} else {
-			clearValues.emplace_back(vk::ClearColorValue(rt._clearValue[0], rt._clearValue[1], rt._clearValue[2], rt._clearValue[3]));
-		}
+	return true;
+}
+
+bool GraphicsPassVk::InitContexts(uint32_t numContexts)
+{
+	if (!GraphicsPass::InitContexts(numContexts))
+		return false;
+
+	auto rhi = static_cast<RhiVk *>(_rhi);
+	_contextRecorders.resize(numContexts);
+	_contextStatePipelines.assign(numContexts, nullptr);
+	_contextThreads.assign(numContexts, std::thread::id());
+	_contextsEnded.assign(numContexts, false);
+	for (auto &recorder : _contextRecorders) {
+		if (!recorder.Init(rhi, _recorder._queueFamily))
+			return false;
 	}
-	vk::RenderPassBeginInfo passInfo{
+
+	return true;
+}
+
+uint32_t GraphicsPassVk::AddContext()
+{
+	uint32_t context = GraphicsPass::AddContext();
+	_contextRecorders.emplace_back().Init(static_cast<RhiVk *>(_rhi), _recorder._queueFamily);
+	_contextStatePipelines.push_back(nullptr);
+	_contextThreads.push_back(std::thread::id());
+	_contextsEnded.push_back(false);
+	return context;
+}
+
+bool GraphicsPassVk::EndContext(uint32_t context)
+{
+	ASSERT(!_contextsEnded[context]);
+	_contextsEnded[context] = true;
+	CmdRecorderVk &recorder = _contextRecorders[context];
+	if (recorder._cmdBuffers.empty())
+		return true;
+	ASSERT(_contextThreads[context] == std::this_thread::get_id());
+	return recorder._cmdBuffers.back().end() == vk::Result::eSuccess;
+}
+
+vk::CommandBuffer GraphicsPassVk::GetCmds(uint32_t context)
+{
+	CmdRecorderVk &recorder = _contextRecorders[context];
+	if (_contextsEnded[context]) {
+		ASSERT(0);
+		return vk::CommandBuffer();
+	}
+	if (recorder._cmdBuffers.size())
+		return recorder._cmdBuffers.back();
+
+	vk::CommandBuffer cmds = recorder.AllocCmdBuffer(vk::CommandBufferLevel::eSecondary, _name + "_" + std::to_string(context));
+	if (!cmds)
+		return vk::CommandBuffer();
+
+	vk::CommandBufferInheritanceInfo inheritInfo{
 		_renderPass,
+		0,
 		_framebuffer,
-		vk::Rect2D(vk::Offset2D(0, 0), GetExtent2D(GetMinTargetSize())),
-		clearValues,
 	};
-	cmds.beginRenderPass(passInfo, vk::SubpassContents::eInline);
+	vk::CommandBufferBeginInfo cmdBegin{
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+		&inheritInfo,
+	};
+	if (cmds.begin(cmdBegin) != vk::Result::eSuccess)
+		return vk::CommandBuffer();
 
+	// dynamic state isn't inherited from the primary buffer
 	cmds.setViewport(0, GetViewport(_viewport));
+	_contextStatePipelines[context] = nullptr;
+	_contextThreads[context] = std::this_thread::get_id();
 
-	return true;
+	return cmds;
 }
 
-bool GraphicsPassVk::Draw(DrawData const &draw)
+bool GraphicsPassVk::Draw(DrawData const &draw, uint32_t context)
 {
-	if (!GraphicsPass::Draw(draw))
+	if (!GraphicsPass::Draw(draw, context))
 		return false;
 
-	vk::CommandBuffer cmds = _recorder._cmdBuffers.back();
+	vk::CommandBuffer cmds = GetCmds(context);
+	if (!cmds)
+		return false;
 
 	auto *pipeVk = static_cast<PipelineVk *>(draw._pipeline.get());
-	cmds.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeVk->_pipeline);
+	// a pipeline that's still compiling is drawn with its fallback, or the draw is skipped
+	auto *usableVk = static_cast<PipelineVk *>(pipeVk->GetUsable());
+	if (!usableVk)
+		return true;
+	cmds.bindPipeline(vk::PipelineBindPoint::eGraphics, usableVk->_pipeline);
+	// the dynamic state is kept between draws, consecutive draws with the same pipeline only set it once
+	if (_contextStatePipelines[context] != pipeVk) {
+		pipeVk->SetDynamicState(cmds);
+		_contextStatePipelines[context] = pipeVk;
+	}
 
 	std::vector<vk::DescriptorSet> descSets;
-	for (auto &set : _resourceSets) {
+	for (auto &set : draw._resourceSets) {
 		auto *setVk = static_cast<ResourceSetVk *>(set.get());
 		utl::GetFromVec(descSets, setVk->_setIndex) = setVk->_descSet._set;
 	}
-	std::array<uint32_t, 0> noDynamicOffsets;
-	cmds.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeVk->_layout, 0, descSets, noDynamicOffsets);
+	cmds.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeVk->_layout, 0, descSets, draw._dynamicOffsets);
+	pipeVk->PushConstants(cmds, draw._pushConstants);
 
 	if (pipeVk->_pipelineData._vertexInputs.size() != draw._vertexStreams.size())
 		return false;
@@ -225,7 +290,65 @@ glm::ivec4 GraphicsPassVk::GetMinTargetSize()
 
 bool GraphicsPassVk::Prepare(Submission *sub)
 {
-	vk::CommandBuffer cmds = _recorder._cmdBuffers.back();
+	// the pass's own command buffers are recorded for the universal family
+	ASSERT(static_cast<SubmissionVk *>(sub)->GetQueueData()._family == static_cast<RhiVk *>(_rhi)->_universalQueue._family);
+
+	// everything the pass references is stamped when it's prepared, so it's kept until the GPU is done with it
+	auto subVk = static_cast<SubmissionVk *>(sub);
+	_lastUseCounter = subVk->_executeSignalValue;
+	for (uint32_t i = 0; i < _contexts.size(); ++i) {
+		for (auto &set : _contexts[i]._resourceSets) {
+			static_cast<ResourceSetVk *>(set.get())->SetLastUseCounter(_lastUseCounter);
+		}
+		for (auto &pipeline : _contexts[i]._pipelines) {
+			static_cast<PipelineVk *>(pipeline.get())->SetLastUseCounter(_lastUseCounter);
+		}
+		_contextRecorders[i].SetLastUseCounter(_lastUseCounter);
+	}
+	_recorder.SetLastUseCounter(_lastUseCounter);
+
+	// command buffers are ended on the threads that recorded them, only the ones recorded here can still be open
+	std::vector<vk::CommandBuffer> contextCmds;
+	for (uint32_t i = 0; i < _contextRecorders.size(); ++i) {
+		CmdRecorderVk &recorder = _contextRecorders[i];
+		if (recorder._cmdBuffers.empty())
+			continue;
+		if (!_contextsEnded[i]) {
+			if (_contextThreads[i] != std::this_thread::get_id()) {
+				ASSERT(0);
+				return false;
+			}
+			if (!EndContext(i))
+				return false;
+		}
+		contextCmds.push_back(recorder._cmdBuffers.back());
+	}
+
+	vk::CommandBuffer cmds = _recorder.BeginCmds(_name);
+	if (!cmds)
+		return false;
+
+	if (!subVk->RecordTransitions(this, cmds))
+		return false;
+
+	std::vector<vk::ClearValue> clearValues;
+	for (auto &rt : _renderTargets) {
+		if (rt._texture->_descriptor._usage.ds) {
+			clearValues.emplace_back(vk::ClearDepthStencilValue(rt._clearValue[0], (uint32_t)rt._clearValue[1]));
+		} else {
+			clearValues.emplace_back(vk::ClearColorValue(rt._clearValue[0], rt._clearValue[1], rt._clearValue[2], rt._clearValue[3]));
+		}
+	}
+	vk::RenderPassBeginInfo passInfo{
+		_renderPass,
+		_framebuffer,
+		vk::Rect2D(vk::Offset2D(0, 0), GetExtent2D(GetMinTargetSize())),
+		clearValues,
+	};
+	cmds.beginRenderPass(passInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+
+	if (contextCmds.size())
+		cmds.executeCommands(contextCmds);
 
 	cmds.endRenderPass();
 
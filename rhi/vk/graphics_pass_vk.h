@@ -10,8 +10,14 @@ struct GraphicsPassVk final : GraphicsPass {
 
 	bool InitRhi(Rhi *rhi, std::string name) override;
 	bool Init(std::span<RenderTargetData> rts, utl::BoxF const &viewport = utl::BoxF::GetMaximum()) override;
+	bool InitContexts(uint32_t numContexts) override;
+	uint32_t AddContext() override;
+	bool EndContext(uint32_t context) override;
 
-	bool Draw(DrawData const &draw) override;
+	bool Draw(DrawData const &draw, uint32_t context = 0) override;
+
+	// The secondary command buffer of a context, begun on first use from the thread recording the context
+	vk::CommandBuffer GetCmds(uint32_t context);
 
 	bool Prepare(Submission *sub) override;
 	bool Execute(Submission *sub) override;
@@ -26,6 +32,13 @@ struct GraphicsPassVk final : GraphicsPass {
 	vk::RenderPass _renderPass;
 	vk::Framebuffer _framebuffer;
 	CmdRecorderVk _recorder;
+	std::vector<CmdRecorderVk> _contextRecorders;
+	// the pipeline whose render state was last set in each context's command buffer
+	std::vector<Pipeline const *> _contextStatePipelines;
+	// the thread that began each context's command buffer, and whether it ended it
+	std::vector<std::thread::id> _contextThreads;
+	std::vector<uint8_t> _contextsEnded;
+	uint64_t _lastUseCounter = 0;
 };
 
 }
\ No newline at end of file
@@ -6,6 +6,9 @@
 #include "graphics_pass_vk.h"
 
 #include "utl/mathutl.h"
+#include "utl/algo.h"
+#include "utl/file.h"
+#include <filesystem>
 
 #include "shaderc/shaderc.hpp"
 #include "spirv_cross/spirv_reflect.hpp"
@@ -201,9 +204,25 @@ void FillBlendState(RenderState const &data, vk::PipelineColorBlendStateCreateIn
 		.setBlendConstants({ data._blendColor[0], data._blendColor[1], data._blendColor[2], data._blendColor[3] });
 }
 
-void FillDynamicState(RenderState const &data, vk::PipelineDynamicStateCreateInfo &dynamicState, std::vector<vk::DynamicState> &dynamicStates)
+void FillDynamicState(DynamicState dynamic, vk::PipelineDynamicStateCreateInfo &dynamicState, std::vector<vk::DynamicState> &dynamicStates)
 {
-	dynamicStates.push_back(vk::DynamicState::eViewport);
+	static std::vector<std::pair<DynamicState, std::vector<vk::DynamicState>>> s_dynamic2Vk{
+		{ DynamicState::Viewport, { vk::DynamicState::eViewport } },
+		{ DynamicState::Scissor, { vk::DynamicState::eScissor } },
+		{ DynamicState::DepthBias, { vk::DynamicState::eDepthBias } },
+		{ DynamicState::BlendColor, { vk::DynamicState::eBlendConstants } },
+		{ DynamicState::DepthBounds, { vk::DynamicState::eDepthBounds } },
+		{ DynamicState::StencilValues, { vk::DynamicState::eStencilCompareMask, vk::DynamicState::eStencilWriteMask, vk::DynamicState::eStencilReference } },
+		{ DynamicState::Cull, { vk::DynamicState::eCullModeEXT, vk::DynamicState::eFrontFaceEXT } },
+		{ DynamicState::DepthTest, { vk::DynamicState::eDepthTestEnableEXT, vk::DynamicState::eDepthWriteEnableEXT, vk::DynamicState::eDepthCompareOpEXT, vk::DynamicState::eDepthBoundsTestEnableEXT } },
+		{ DynamicState::StencilOps, { vk::DynamicState::eStencilTestEnableEXT, vk::DynamicState::eStencilOpEXT } },
+		{ DynamicState::DepthBiasEnable, { vk::DynamicState::eDepthBiasEnableEXT } },
+		{ DynamicState::Blend, { vk::DynamicState::eColorBlendEnableEXT, vk::DynamicState::eColorBlendEquationEXT, vk::DynamicState::eColorWriteMaskEXT } },
+	};
+	for (auto &[state, vkStates] : s_dynamic2Vk) {
+		if (!!(dynamic & state))
+			dynamicStates.insert(dynamicStates.end(), vkStates.begin(), vkStates.end());
+	}
 
 	dynamicState
 		.setDynamicStateCount(static_cast<uint32_t>(dynamicStates.size()))
@@ -211,13 +230,13 @@ void FillDynamicState(RenderState const &data, vk::PipelineDynamicStateCreateInf
 }
 
 
-vk::DescriptorType GetDescriptorType(ShaderParam::Kind kind)
+vk::DescriptorType GetDescriptorType(ShaderParam::Kind kind, bool dynamic = false)
 {
 	switch (kind) {
 		case ShaderParam::UniformBuffer:
-			return vk::DescriptorType::eUniformBuffer;
+			return dynamic ? vk::DescriptorType::eUniformBufferDynamic : vk::DescriptorType::eUniformBuffer;
 		case ShaderParam::UAVBuffer:
-			return vk::DescriptorType::eStorageBuffer;
+			return dynamic ? vk::DescriptorType::eStorageBufferDynamic : vk::DescriptorType::eStorageBuffer;
 		case ShaderParam::Texture:
 			return vk::DescriptorType::eSampledImage;
 		case ShaderParam::UAVTexture:
@@ -311,7 +330,7 @@ auto DescriptorSetAllocatorVk::Allocate(vk::DescriptorSetLayout layout) -> Set
 		setInfo.descriptorPool = _pools[_lastUsedPool];
 		vk::Result res = _rhi->_device.allocateDescriptorSets(&setInfo, &set._set);
 		if (res == vk::Result::eSuccess) {
-			set._allocator = this;
+			set._allocator = shared_from_this();
 			set._pool = _pools[_lastUsedPool];
 			return set;
 		} 
@@ -351,6 +370,16 @@ static std::unordered_map<ShaderKind, vk::ShaderStageFlagBits> s_shaderKind2Vk{
 	{ ShaderKind::Compute, vk::ShaderStageFlagBits::eCompute },
 };
 
+vk::ShaderStageFlags GetShaderStageFlags(uint32_t shaderKindsMask)
+{
+	vk::ShaderStageFlags stageFlags;
+	for (uint32_t i = 0; i < (uint32_t)ShaderKind::Count; ++i) {
+		if (shaderKindsMask & (1 << i))
+			stageFlags |= s_shaderKind2Vk[(ShaderKind)i];
+	}
+	return stageFlags;
+}
+
 
 ShaderVk::~ShaderVk()
 {
@@ -390,6 +419,7 @@ ShaderParam GetShaderParam(spirv_cross::Compiler const &refl, spirv_cross::Resou
 		._binding = getBinding(res.id),
 	};
 
+	bool supported = true;
 	std::function<TypeInfo const *(spirv_cross::SPIRType const &)> getType;
 	getType = [&](spirv_cross::SPIRType const &type) {
 		TypeInfo const *typeInfo = nullptr;
@@ -416,7 +446,8 @@ ShaderParam GetShaderParam(spirv_cross::Compiler const &refl, spirv_cross::Resou
 					structInfo->_members.push_back({ ._name = memberName, ._var = {._type = memberTypeInfo, ._offset = memberOffset } });
 				}
 				if (structInfo->_members.size()) {
-					ASSERT(structInfo->_members[0]._var._offset == 0);
+					// push constant blocks of different stages may start past the beginning of the range
+					ASSERT(structInfo->_members[0]._var._offset == 0 || kind == ShaderParam::PushConstants);
 					structInfo->_align = structInfo->_members[0]._var._type->_align;
 				}
 				typeInfo = structInfo;
@@ -483,14 +514,22 @@ ShaderParam GetShaderParam(spirv_cross::Compiler const &refl, spirv_cross::Resou
 		ASSERT(typeInfo);
 
 		for (size_t i = 0; i < type.array.size(); ++i) {
-			ASSERT(type.array_size_literal[i] && "Arrays with specialization constants not supported");
+			// sizes that come from specialization constants get the constant's default value
+			bool specSize = !type.array_size_literal[i] && refl.has_decoration(type.array[i], spv::DecorationSpecId);
+			if (!type.array_size_literal[i] && !specSize) {
+				// sizes computed from constants have no id to specialize them by
+				LOG("Shader parameter '%s' has an array size that isn't a literal or a specialization constant", param._name);
+				supported = false;
+				return typeInfo;
+			}
+			uint32_t arraySize = specSize ? refl.get_constant(type.array[i]).scalar() : type.array[i];
 
 			param._ownTypes.emplace_back(std::make_shared<TypeInfo>());
 			TypeInfo *arrayType = param._ownTypes.back().get();
 
 			arrayType->_bases.push_back({ ._type = typeInfo, ._offset = 0 });
 			arrayType->_isArray = true;
-			arrayType->_arraySize = type.array[i];
+			arrayType->_arraySize = arraySize;
 			arrayType->_align = typeInfo->_align;
 			arrayType->_size = typeInfo->_size * arrayType->_arraySize;
 
@@ -502,10 +541,47 @@ ShaderParam GetShaderParam(spirv_cross::Compiler const &refl, spirv_cross::Resou
 
 	spirv_cross::SPIRType const &resType = refl.get_type(res.type_id);
 	param._type = getType(resType);
+	if (!supported)
+		param._type = nullptr;
+	// the outermost dimension is the last one, resource arrays sized by a constant get their size from the pipeline
+	if (param._type && resType.array.size() && !resType.array_size_literal.back())
+		param._arraySizeConstant = refl.get_decoration(resType.array.back(), spv::DecorationSpecId);
 
 	return param;
 }
 
+bool ShaderVk::IsSpirv(std::span<uint8_t const> content)
+{
+	static constexpr uint32_t s_SPIRVMagic = 0x07230203;
+	return content.size() >= sizeof(uint32_t) && content.size() % sizeof(uint32_t) == 0 && *(uint32_t *)content.data() == s_SPIRVMagic;
+}
+
+// set by the build to a hash of the shaderc library, without it the cache is only keyed on the SPIR-V version shaderc targets
+#ifndef SHADERC_BUILD_ID
+#define SHADERC_BUILD_ID ""
+#endif
+
+std::string ShaderVk::GetSpirvCachePath(std::span<uint8_t const> source) const
+{
+	auto rhi = static_cast<RhiVk *>(_rhi);
+	if (rhi->_settings._cacheDir.empty())
+		return std::string();
+
+	// has to be changed along with the compile options in Load
+	static constexpr uint32_t s_compileOptionsVersion = 1;
+	unsigned int spvVersion = 0, spvRevision = 0;
+	shaderc_get_spv_version(&spvVersion, &spvRevision);
+	uint32_t keyValues[] = { s_compileOptionsVersion, spvVersion, spvRevision, (uint32_t)_kind };
+	uint64_t hash = utl::GetStableHash(std::span((uint8_t const *)keyValues, sizeof(keyValues)));
+	hash = utl::GetStableHash(SHADERC_BUILD_ID, hash);
+	hash = utl::GetStableHash(_entryPoint, hash);
+	hash = utl::GetStableHash(source, hash);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.spv", (unsigned long long)hash);
+	return rhi->_settings._cacheDir + "/shaders/" + name;
+}
+
 bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &content)
 {
 	if (!Shader::Load(shaderData, content))
@@ -513,10 +589,20 @@ bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &co
 
 	std::span<const uint32_t> spirv;
 	shaderc::SpvCompilationResult shadercResult;
+	std::vector<uint8_t> cachedSpirv;
+
+	std::string cachePath;
+	if (!IsSpirv(content)) {
+		cachePath = GetSpirvCachePath(content);
+		if (!cachePath.empty() && std::filesystem::exists(cachePath))
+			cachedSpirv = utl::ReadFile(cachePath);
+		if (!IsSpirv(cachedSpirv))
+			cachedSpirv.clear();
+	}
 
-	static constexpr uint32_t s_SPIRVMagic = 0x07230203;
-	bool isSpirv = content.size() >= sizeof(uint32_t) && content.size() % sizeof(uint32_t) == 0 && *(uint32_t *)content.data() == s_SPIRVMagic;
-	if (!isSpirv) {
+	if (!cachedSpirv.empty()) {
+		spirv = std::span((uint32_t *)cachedSpirv.data(), cachedSpirv.size() / sizeof(uint32_t));
+	} else if (!IsSpirv(content)) {
 		static std::unordered_map<ShaderKind, shaderc_shader_kind> s_shaderKind2Shaderc = {
 			{ ShaderKind::Vertex, shaderc_shader_kind::shaderc_vertex_shader },
 			{ ShaderKind::Fragment, shaderc_shader_kind::shaderc_fragment_shader },
@@ -525,6 +611,7 @@ bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &co
 		ASSERT(s_shaderKind2Shaderc.size() == (size_t)ShaderKind::Count);
 
 		shaderc::Compiler compiler;
+		// changes to the options need a new s_compileOptionsVersion in GetSpirvCachePath
 		shaderc::CompileOptions options;
 		shaderc_shader_kind shadercKind = s_shaderKind2Shaderc[_kind];
 		shadercResult = compiler.CompileGlslToSpv((char const *)content.data(), content.size(), shadercKind, _name.c_str(), _entryPoint.c_str(), options);
@@ -533,6 +620,8 @@ bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &co
 			return false;
 		}
 		spirv = std::span(shadercResult.begin(), shadercResult.end());
+		if (!cachePath.empty() && !utl::WriteFile(cachePath, std::span((uint8_t const *)spirv.data(), spirv.size_bytes())))
+			LOG("Failed to cache the SPIR-V of shader '%s'", _name);
 	} else {
 		spirv = std::span((uint32_t *)content.data(), content.size() / sizeof(uint32_t));
 	}
@@ -551,20 +640,56 @@ bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &co
 	auto addParams = [&](auto &resources, ShaderParam::Kind kind) {
 		for (auto &res : resources) {
 			_params.push_back(GetShaderParam(refl, res, kind));
+			if (!_params.back()._type)
+				return false;
 		}
+		return true;
 	};
 
-	addParams(shaderResources.uniform_buffers, ShaderParam::UniformBuffer);
-	addParams(shaderResources.storage_buffers, ShaderParam::UAVBuffer);
-	addParams(shaderResources.separate_images, ShaderParam::Texture);
-	addParams(shaderResources.storage_images, ShaderParam::UAVTexture);
-	addParams(shaderResources.separate_samplers, ShaderParam::Sampler);
+	bool paramsAdded =
+		addParams(shaderResources.uniform_buffers, ShaderParam::UniformBuffer) &&
+		addParams(shaderResources.storage_buffers, ShaderParam::UAVBuffer) &&
+		addParams(shaderResources.separate_images, ShaderParam::Texture) &&
+		addParams(shaderResources.storage_images, ShaderParam::UAVTexture) &&
+		addParams(shaderResources.separate_samplers, ShaderParam::Sampler) &&
+		addParams(shaderResources.push_constant_buffers, ShaderParam::PushConstants);
+	if (!paramsAdded)
+		return false;
+
+	for (auto &specConst : refl.get_specialization_constants()) {
+		spirv_cross::SPIRConstant const &constant = refl.get_constant(specConst.id);
+		static std::unordered_map<spirv_cross::SPIRType::BaseType, TypeInfo const *> s_constantTypes{
+			{ spirv_cross::SPIRType::Boolean, TypeInfo::Get<bool>() },
+			{ spirv_cross::SPIRType::Int, TypeInfo::Get<int32_t>() },
+			{ spirv_cross::SPIRType::UInt, TypeInfo::Get<uint32_t>() },
+			{ spirv_cross::SPIRType::Float, TypeInfo::Get<float>() },
+		};
+		auto typeIt = s_constantTypes.find(refl.get_type(constant.constant_type).basetype);
+		if (typeIt == s_constantTypes.end()) {
+			LOG("Shader '%s' has specialization constant '%s' of an unsupported type", _name, refl.get_name(specConst.id));
+			continue;
+		}
+		_constants.push_back(ShaderConstant{
+			._name = refl.get_name(specConst.id),
+			._id = specConst.constant_id,
+			._type = typeIt->second,
+			._defaultValue = constant.scalar(),
+		});
+	}
 
 	if (_kind == ShaderKind::Compute) {
 		auto &entryPoint = refl.get_entry_point(_entryPoint, spv::ExecutionModelGLCompute);
 		auto &groupSize = entryPoint.workgroup_size;
 		_groupSize = glm::ivec3(groupSize.x, groupSize.y, groupSize.z);
-		// group size might be dependent on specialization constants or be otherwise dynamic, and then dimensions might be 0
+		// dimensions that come from specialization constants are resolved with the pipeline's values
+		spirv_cross::SpecializationConstant sizeConstants[3];
+		refl.get_work_group_size_specialization_constants(sizeConstants[0], sizeConstants[1], sizeConstants[2]);
+		for (int32_t d = 0; d < 3; ++d) {
+			if (!sizeConstants[d].id)
+				continue;
+			_groupSizeConstants[d] = sizeConstants[d].constant_id;
+			_groupSize[d] = refl.get_constant(sizeConstants[d].id).scalar();
+		}
 		ASSERT(all(greaterThan(_groupSize, glm::ivec3(0))));
 	}
 
@@ -581,6 +706,8 @@ bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &co
 		size_t offs = 0;
 		for (auto &res : shaderResources.stage_inputs) {
 			ShaderParam attr = GetShaderParam(refl, res, ShaderParam::VertexLayout);
+			if (!attr._type)
+				return false;
 			offs = utl::RoundUp(offs, attr._type->_align);
 			attribsType->_members.push_back({ ._name = attr._name, ._var = { ._type = attr._type, ._offset = offs } });
 			attribsType->_members.back()._metadata.push_back(utl::AnyValue::New(attr._binding));
@@ -601,6 +728,11 @@ bool ShaderVk::Load(ShaderData const &shaderData, std::vector<uint8_t> const &co
 ResourceSetVk::~ResourceSetVk()
 {
 	ClearCreatedViews();
+	if (_descSet) {
+		auto *rhi = _descSet._allocator->_rhi;
+		rhi->RemoveResourceSet(this);
+		rhi->Retire(_lastUseCounter, std::move(_descSet));
+	}
 }
 
 bool ResourceSetVk::Init(Pipeline *pipeline, uint32_t setIndex)
@@ -614,6 +746,8 @@ bool ResourceSetVk::Init(Pipeline *pipeline, uint32_t setIndex)
 	if (!_descSet)
 		return false;
 
+	_descSet._allocator->_rhi->AddResourceSet(this);
+
 	return true;
 
 }
@@ -627,11 +761,19 @@ bool ResourceSetVk::Update()
 
 	ASSERT(_descSet);
 
-	auto pipeVk = static_cast<PipelineVk *>(_pipeline);
+	auto *rhi = _descSet._allocator->_rhi;
+	if (_lastUseCounter > rhi->GetCompletedCounter()) {
+		// the descriptor set may still be read by the GPU, write the new contents into a fresh one
+		DescSetVk descSet = static_cast<PipelineVk *>(_pipeline)->_descriptorSetData[_setIndex].AllocateDescSet();
+		if (!descSet)
+			return false;
+		rhi->Retire(_lastUseCounter, std::move(_descSet));
+		_descSet = std::move(descSet);
+	}
+
 	ResourceSetDescription const *setDescription = GetSetDescription();
 	ASSERT(_resourceRefs.size() == setDescription->GetNumEntries());
 
-	auto *rhi = static_cast<RhiVk *>(pipeVk->_rhi);
 	std::vector<vk::WriteDescriptorSet> writeRes;
 	// we pre-allocate the following arrays with worst-case size because we'll be storing pointers to their elements and we don't want them to get reallocated
 	std::vector<vk::DescriptorImageInfo> imgInfos(_resourceRefs.size());
@@ -678,7 +820,7 @@ bool ResourceSetVk::Update()
 			i, 
 			0,
 			res._numEntries,
-			GetDescriptorType(res._kind),
+			GetDescriptorType(res._kind, res._dynamic),
 			res.IsImage() || res.IsSampler() ? &imgInfos[resRefIdx] : nullptr,
 			res.IsBuffer() ? &bufInfos[resRefIdx] : nullptr,
 			nullptr,
@@ -700,21 +842,35 @@ void ResourceSetVk::ClearCreatedViews()
 		return;
 	auto *rhi = _descSet._allocator->_rhi;
 	for (auto view : _createdViews) {
-		rhi->_device.destroyImageView(view, rhi->AllocCallbacks());
+		rhi->Retire(_lastUseCounter, view);
+	}
+	_createdViews.clear();
+}
+
+void ResourceSetVk::SetLastUseCounter(uint64_t counter)
+{
+	_lastUseCounter = counter;
+	for (auto &resRef : _resourceRefs) {
+		if (SamplerVk *sampler = Cast<SamplerVk>(resRef._bindable.get()))
+			sampler->_lastUseCounter = std::max(sampler->_lastUseCounter, counter);
 	}
 }
 
 PipelineVk::~PipelineVk()
 {
+	// a shared device pipeline and layout belong to the source
+	if (_source)
+		return;
 	auto rhi = static_cast<RhiVk *>(_rhi);
-	rhi->_device.destroyPipeline(_pipeline, rhi->AllocCallbacks());
-	rhi->_device.destroyPipelineLayout(_layout, rhi->AllocCallbacks());
+	uint64_t counter = _lastUseCounter;
+	rhi->Retire(counter, _pipeline);
+	rhi->Retire(counter, _layout);
 	for (auto &setData : _descriptorSetData) {
-		rhi->_device.destroyDescriptorSetLayout(setData._layout, rhi->AllocCallbacks());
+		rhi->Retire(counter, setData._layout);
 	}
 }
 
-vk::PipelineShaderStageCreateInfo GetShaderStageInfo(Shader *shader)
+vk::PipelineShaderStageCreateInfo GetShaderStageInfo(Shader *shader, vk::SpecializationInfo const *specInfo)
 {
 	auto shaderVk = static_cast<ShaderVk *>(shader);
 	return vk::PipelineShaderStageCreateInfo{
@@ -722,6 +878,7 @@ vk::PipelineShaderStageCreateInfo GetShaderStageInfo(Shader *shader)
 			s_shaderKind2Vk[shaderVk->_kind],
 			shaderVk->_shaderModule,
 			shaderVk->_entryPoint.c_str(),
+			specInfo->mapEntryCount ? specInfo : nullptr,
 	};
 }
 
@@ -746,22 +903,43 @@ vk::Format GetVertexAttribFormat(TypeInfo::Member const &attribMember)
 	return vk::Format::eUndefined;
 }
 
-bool PipelineVk::Init(PipelineData const &pipelineData, GraphicsPass *renderPass)
+bool PipelineVk::InitLayout(PipelineData const &pipelineData, GraphicsPass *renderPass)
 {
-	if (!Pipeline::Init(pipelineData, renderPass))
+	if (!Pipeline::InitLayout(pipelineData, renderPass))
 		return false;
 
-	if (!InitLayout())
-		return false;
+	return CreateLayout();
+}
 
+bool PipelineVk::Compile(GraphicsPass *renderPass)
+{
 	ASSERT(_layout);
 
+	// the layouts have the same definitions, so the source's device pipeline can be bound with this one's layout
+	if (_source) {
+		// compiled once the source is, see Pipeline::AddDependent
+		ASSERT(_source->_state != State::Compiling);
+		if (!_source->IsReady())
+			return false;
+		_pipeline = static_cast<PipelineVk *>(_source.get())->_pipeline;
+		return true;
+	}
+
 	auto rhi = static_cast<RhiVk *>(_rhi);
 
-	if (pipelineData.IsCompute()) {
+	// the same constants go to all stages, the ones a stage doesn't declare are ignored by it
+	std::vector<vk::SpecializationMapEntry> specEntries;
+	std::vector<uint32_t> specValues;
+	for (auto &constant : _pipelineData._specialization) {
+		specEntries.push_back(vk::SpecializationMapEntry{ constant._id, (uint32_t)(specValues.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+		specValues.push_back(constant._value);
+	}
+	vk::SpecializationInfo specInfo{ (uint32_t)specEntries.size(), specEntries.data(), specValues.size() * sizeof(uint32_t), specValues.data() };
+
+	if (_pipelineData.IsCompute()) {
 		vk::ComputePipelineCreateInfo pipeInfo{
 			vk::PipelineCreateFlags(),
-			GetShaderStageInfo(_pipelineData._shaders[0].get()),
+			GetShaderStageInfo(_pipelineData._shaders[0].get(), &specInfo),
 			_layout,
 		};
 		if (rhi->_device.createComputePipelines(rhi->_pipelineCache, 1, &pipeInfo, rhi->AllocCallbacks(), &_pipeline) != vk::Result::eSuccess)
@@ -776,7 +954,7 @@ bool PipelineVk::Init(PipelineData const &pipelineData, GraphicsPass *renderPass
 
 		std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
 		for (auto &shader : _pipelineData._shaders)
-			shaderStages.push_back(GetShaderStageInfo(shader.get()));
+			shaderStages.push_back(GetShaderStageInfo(shader.get(), &specInfo));
 
 		std::vector<vk::VertexInputBindingDescription> vertInputBinds;
 		std::vector<vk::VertexInputAttributeDescription> vertInputAttrs;
@@ -839,7 +1017,7 @@ bool PipelineVk::Init(PipelineData const &pipelineData, GraphicsPass *renderPass
 
 		std::vector<vk::DynamicState> dynamicStates;
 		vk::PipelineDynamicStateCreateInfo dynamicState;
-		FillDynamicState(_pipelineData._renderState, dynamicState, dynamicStates);
+		FillDynamicState(rhi->_dynamicState, dynamicState, dynamicStates);
 
 		auto *graphicsPassVk = static_cast<GraphicsPassVk *>(renderPass);
 		vk::GraphicsPipelineCreateInfo pipeInfo{
@@ -865,15 +1043,25 @@ bool PipelineVk::Init(PipelineData const &pipelineData, GraphicsPass *renderPass
 	}
 
 	rhi->SetDebugName(vk::ObjectType::ePipeline, (uint64_t)(VkPipeline)_pipeline, _name.c_str());
+	rhi->_pipelineCacheDirty = true;
 
 	return true;
 }
 
-bool PipelineVk::InitLayout()
+bool PipelineVk::CreateLayout()
 {
 	ASSERT(s_shaderKind2Vk.size() == (size_t)ShaderKind::Count);
 	auto rhi = static_cast<RhiVk *>(_rhi);
 
+	// variants have the same shaders, so their set layouts and descriptor pools are the source's
+	if (_source) {
+		auto *sourceVk = static_cast<PipelineVk *>(_source.get());
+		ASSERT(_resourceSetDescriptions.size() == sourceVk->_resourceSetDescriptions.size());
+		_descriptorSetData = sourceVk->_descriptorSetData;
+		_layout = sourceVk->_layout;
+		return true;
+	}
+
 	_descriptorSetData.resize(_resourceSetDescriptions.size());
 	std::vector<vk::DescriptorSetLayout> setLayouts(_resourceSetDescriptions.size());
 	for (uint32_t setIndex = 0; setIndex < _resourceSetDescriptions.size(); ++setIndex) {
@@ -884,12 +1072,9 @@ bool PipelineVk::InitLayout()
 			auto &resource = setDesc._params[resIndex];
 			vk::DescriptorSetLayoutBinding bind;
 			bind.binding = resIndex;
-			bind.descriptorType = GetDescriptorType(resource._kind);
+			bind.descriptorType = GetDescriptorType(resource._kind, resource._dynamic);
 			bind.descriptorCount = resource._numEntries;
-			for (uint32_t i = 0; i < (uint32_t)ShaderKind::Count; ++i) {
-				if (resource._shaderKindsMask & (1 << i))
-					bind.stageFlags |= s_shaderKind2Vk[(ShaderKind)i];
-			}
+			bind.stageFlags = GetShaderStageFlags(resource._shaderKindsMask);
 			bindings.push_back(bind);
 		}
 
@@ -902,16 +1087,23 @@ bool PipelineVk::InitLayout()
 			return false;
 
 		setLayouts[setIndex] = _descriptorSetData[setIndex]._layout = setResult.value;
-		_descriptorSetData[setIndex]._allocator = std::make_unique<DescriptorSetAllocatorVk>();
+		_descriptorSetData[setIndex]._allocator = std::make_shared<DescriptorSetAllocatorVk>();
 		if (!_descriptorSetData[setIndex]._allocator->Init(rhi, 1024, bindings))
 			return false;
 	}
 
-	std::array<vk::PushConstantRange, 0> noPushConsts;
+	std::vector<vk::PushConstantRange> pushConsts;
+	if (_pushConstants._size) {
+		pushConsts.push_back(vk::PushConstantRange{
+			GetShaderStageFlags(_pushConstants._shaderKindsMask),
+			_pushConstants._offset,
+			_pushConstants._size,
+		});
+	}
 	vk::PipelineLayoutCreateInfo layoutInfo{
 		vk::PipelineLayoutCreateFlags(),
 		setLayouts,
-		noPushConsts,
+		pushConsts,
 	};
 	if (rhi->_device.createPipelineLayout(&layoutInfo, rhi->AllocCallbacks(), &_layout) != vk::Result::eSuccess)
 		return false;
@@ -919,13 +1111,107 @@ bool PipelineVk::InitLayout()
 	return true;
 }
 
+void PipelineVk::PushConstants(vk::CommandBuffer cmds, std::span<uint8_t const> data) const
+{
+	uint32_t end = std::min((uint32_t)data.size(), _pushConstants.GetEnd());
+	if (end <= _pushConstants._offset)
+		return;
+	// push constant offsets and sizes are multiples of 4, and so are the blocks in the shaders
+	ASSERT(end % 4 == 0);
+	cmds.pushConstants(_layout, GetShaderStageFlags(_pushConstants._shaderKindsMask), _pushConstants._offset, end - _pushConstants._offset, data.data() + _pushConstants._offset);
+}
+
+void PipelineVk::SetDynamicState(vk::CommandBuffer cmds) const
+{
+	auto rhi = static_cast<RhiVk *>(_rhi);
+	RenderState const &data = _pipelineData._renderState;
+	DynamicState dynamic = rhi->_dynamicState;
+	vk::StencilFaceFlagBits faces[] = { vk::StencilFaceFlagBits::eFront, vk::StencilFaceFlagBits::eBack };
+
+	if (!!(dynamic & DynamicState::Scissor)) {
+		vk::Rect2D scissor{
+			vk::Offset2D(data._scissor._min.x, data._scissor._min.y),
+			vk::Extent2D(data._scissor.GetSize().x, data._scissor.GetSize().y),
+		};
+		cmds.setScissor(0, 1, &scissor);
+	}
+	if (!!(dynamic & DynamicState::DepthBias))
+		cmds.setDepthBias(data._depthBias._constantFactor, data._depthBias._clamp, data._depthBias._slopeFactor);
+	if (!!(dynamic & DynamicState::BlendColor))
+		cmds.setBlendConstants(&data._blendColor[0]);
+	if (!!(dynamic & DynamicState::DepthBounds))
+		cmds.setDepthBounds(data._depthState._minDepthBounds, data._depthState._maxDepthBounds);
+	if (!!(dynamic & DynamicState::StencilValues)) {
+		for (size_t f = 0; f < data._stencilState.size(); ++f) {
+			cmds.setStencilCompareMask(faces[f], data._stencilState[f]._compareMask);
+			cmds.setStencilWriteMask(faces[f], data._stencilState[f]._writeMask);
+			cmds.setStencilReference(faces[f], data._stencilState[f]._reference);
+		}
+	}
+	if (!!(dynamic & DynamicState::Cull)) {
+		cmds.setCullModeEXT(s_cullMask2Vk.ToDst(data._cullState._cullMask), rhi->_dynamicDispatch);
+		cmds.setFrontFaceEXT(s_frontFace2Vk.ToDst(data._cullState._front), rhi->_dynamicDispatch);
+	}
+	if (!!(dynamic & DynamicState::DepthTest)) {
+		cmds.setDepthTestEnableEXT(data._depthState._depthTestEnable, rhi->_dynamicDispatch);
+		cmds.setDepthWriteEnableEXT(data._depthState._depthWriteEnable, rhi->_dynamicDispatch);
+		cmds.setDepthCompareOpEXT(s_compareFunc2Vk.ToDst(data._depthState._depthCompareFunc), rhi->_dynamicDispatch);
+		cmds.setDepthBoundsTestEnableEXT(data._depthState._depthBoundsTestEnable, rhi->_dynamicDispatch);
+	}
+	if (!!(dynamic & DynamicState::StencilOps)) {
+		cmds.setStencilTestEnableEXT(data._stencilEnable, rhi->_dynamicDispatch);
+		for (size_t f = 0; f < data._stencilState.size(); ++f) {
+			StencilFuncState const &stencil = data._stencilState[f];
+			cmds.setStencilOpEXT(faces[f],
+				s_stencilFunc2Vk.ToDst(stencil._failFunc),
+				s_stencilFunc2Vk.ToDst(stencil._passFunc),
+				s_stencilFunc2Vk.ToDst(stencil._depthFailFunc),
+				s_compareFunc2Vk.ToDst(stencil._compareFunc),
+				rhi->_dynamicDispatch);
+		}
+	}
+	if (!!(dynamic & DynamicState::DepthBiasEnable))
+		cmds.setDepthBiasEnableEXT(data._depthBias._enable, rhi->_dynamicDispatch);
+	if (!!(dynamic & DynamicState::Blend)) {
+		std::vector<vk::Bool32> blendEnables;
+		std::vector<vk::ColorBlendEquationEXT> blendEquations;
+		std::vector<vk::ColorComponentFlags> writeMasks;
+		for (auto &blend : data._blendStates) {
+			blendEnables.push_back(blend._blendEnable);
+			blendEquations.push_back(vk::ColorBlendEquationEXT{
+				s_blendFactor2Vk.ToDst(blend._srcColorBlendFactor),
+				s_blendFactor2Vk.ToDst(blend._dstColorBlendFactor),
+				s_blendFunc2Vk.ToDst(blend._colorBlendFunc),
+				s_blendFactor2Vk.ToDst(blend._srcAlphaBlendFactor),
+				s_blendFactor2Vk.ToDst(blend._dstAlphaBlendFactor),
+				s_blendFunc2Vk.ToDst(blend._alphaBlendFunc),
+			});
+			writeMasks.push_back(s_colorComponentMask2Vk.ToDst(blend._colorWriteMask));
+		}
+		cmds.setColorBlendEnableEXT(0, blendEnables, rhi->_dynamicDispatch);
+		cmds.setColorBlendEquationEXT(0, blendEquations, rhi->_dynamicDispatch);
+		cmds.setColorWriteMaskEXT(0, writeMasks, rhi->_dynamicDispatch);
+	}
+}
+
 std::shared_ptr<ResourceSet> PipelineVk::AllocResourceSet(uint32_t setIndex)
 {
+	if (_source)
+		return _source->AllocResourceSet(setIndex);
 	auto resSet = std::make_shared<ResourceSetVk>();
 	if (!resSet->Init(this, setIndex))
 		return std::shared_ptr<ResourceSet>();
 	return resSet;
 }
 
+void PipelineVk::SetLastUseCounter(uint64_t counter)
+{
+	_lastUseCounter = std::max(_lastUseCounter, counter);
+	if (_source)
+		static_cast<PipelineVk *>(_source.get())->SetLastUseCounter(counter);
+	if (_fallback)
+		static_cast<PipelineVk *>(_fallback.get())->SetLastUseCounter(counter);
+}
+
 
 }
\ No newline at end of file
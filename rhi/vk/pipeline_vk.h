@@ -5,7 +5,7 @@
 
 namespace rhi {
 
-struct DescriptorSetAllocatorVk {
+struct DescriptorSetAllocatorVk : std::enable_shared_from_this<DescriptorSetAllocatorVk> {
 	struct Set {
 		Set() {}
 		Set(Set &&other) { Swap(other); }
@@ -31,7 +31,8 @@ struct DescriptorSetAllocatorVk {
 
 		vk::DescriptorSet _set;
 		vk::DescriptorPool _pool;
-		DescriptorSetAllocatorVk *_allocator = nullptr;
+		// sets keep their allocator alive, so retired sets can still be freed after the pipeline is gone
+		std::shared_ptr<DescriptorSetAllocatorVk> _allocator;
 	};
 
 	DescriptorSetAllocatorVk() = default;
@@ -61,6 +62,10 @@ struct ShaderVk final : Shader {
 
 	bool Load(ShaderData const &shaderData, std::vector<uint8_t> const &content) override;
 
+	static bool IsSpirv(std::span<uint8_t const> content);
+	// Compiled GLSL is kept in the rhi's cache directory, in a file named after a hash of everything that affects the result
+	std::string GetSpirvCachePath(std::span<uint8_t const> source) const;
+
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<ShaderVk>(); }
 
 	vk::ShaderModule _shaderModule;
@@ -75,27 +80,39 @@ struct ResourceSetVk final : ResourceSet {
 	bool Update() override;
 
 	void ClearCreatedViews();
+	// Stamps the set and the samplers in it with the counter of a submission using them
+	void SetLastUseCounter(uint64_t counter);
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<ResourceSetVk>(); }
 
 	DescSetVk _descSet;
 	std::vector<vk::ImageView> _createdViews;
+	uint64_t _lastUseCounter = 0;
 };
 
 struct PipelineVk : public Pipeline {
 	~PipelineVk() override;
 
-	bool Init(PipelineData const &pipelineData, GraphicsPass *renderPass = nullptr) override;
+	bool InitLayout(PipelineData const &pipelineData, GraphicsPass *renderPass) override;
+	bool Compile(GraphicsPass *renderPass) override;
+
+	bool CreateLayout();
 
-	bool InitLayout();
+	// Data is laid out like the push constant blocks of the shaders, only the part in the pipeline's range is pushed
+	void PushConstants(vk::CommandBuffer cmds, std::span<uint8_t const> data) const;
+	// Sets the parts of the render state that aren't compiled into the device pipeline, except the viewport the pass sets
+	void SetDynamicState(vk::CommandBuffer cmds) const;
 
 	std::shared_ptr<ResourceSet> AllocResourceSet(uint32_t setIndex) override;
 
+	// Stamps the pipeline, and the source and fallback it may be drawn with, with the counter of a submission using it
+	void SetLastUseCounter(uint64_t counter);
+
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<PipelineVk>(); }
 
 	struct DescriptorSetData {
 		vk::DescriptorSetLayout _layout;
-		std::unique_ptr<DescriptorSetAllocatorVk> _allocator;
+		std::shared_ptr<DescriptorSetAllocatorVk> _allocator;
 
 		DescSetVk AllocateDescSet() {
 			return _allocator->Allocate(_layout);
@@ -105,6 +122,7 @@ struct PipelineVk : public Pipeline {
 	vk::Pipeline _pipeline;
 	std::vector<DescriptorSetData> _descriptorSetData;
 	vk::PipelineLayout _layout;
+	uint64_t _lastUseCounter = 0;
 };
 
 }
\ No newline at end of file
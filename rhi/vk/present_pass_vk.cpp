@@ -14,20 +14,29 @@ static auto s_regTypes = TypeInfo::AddInitializer("present_pass_vk", [] {
 
 bool PresentPassVk::Prepare(Submission *sub)
 {
+	ASSERT(static_cast<SubmissionVk *>(sub)->GetQueueData()._family == static_cast<RhiVk *>(_rhi)->_universalQueue._family);
 	return true;
 }
 
 bool PresentPassVk::Execute(Submission *sub)
 {
 	SubmissionVk *subVk = static_cast<SubmissionVk*>(sub);
+	SwapchainVk *swapchain = static_cast<SwapchainVk *>(_swapchain.get());
+	uint32_t imgIndex = swapchain->GetTextureIndex(_swapchainTexture.get());
+	ASSERT(imgIndex < swapchain->_images.size());
 
-	ExecuteDataVk exec;
-	exec._fnExecute = [this](RhiVk::QueueData &queue) {
-		SwapchainVk *swapchain = static_cast<SwapchainVk *>(_swapchain.get());
-		uint32_t imgIndex = swapchain->GetTextureIndex(_swapchainTexture.get());
-		ASSERT(imgIndex < swapchain->_images.size());
+	// presentation isn't ordered after the work already submitted to the queue, so it waits on a semaphore signaled by it
+	vk::Semaphore presentSemaphore = swapchain->_presentSemaphores[imgIndex];
+	ExecuteDataVk execSignal;
+	execSignal._signalSemaphores.push_back(SemaphoreReferenceVk{
+		._semaphore = presentSemaphore,
+	});
+	if (!subVk->Execute(std::move(execSignal)))
+		return false;
 
-		std::vector<vk::Semaphore> waitSemaphores;
+	ExecuteDataVk exec;
+	exec._fnExecute = [this, swapchain, imgIndex, presentSemaphore](RhiVk::QueueData &queue) {
+		std::array<vk::Semaphore, 1> waitSemaphores{ presentSemaphore };
 		vk::PresentInfoKHR presentInfo{
 			(uint32_t)waitSemaphores.size(),
 			waitSemaphores.data(),
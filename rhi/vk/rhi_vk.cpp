@@ -1,6 +1,11 @@
 #include "rhi_vk.h"
+#include "submit_vk.h"
+#include "buffer_vk.h"
+#include "texture_vk.h"
 #include "utl/mathutl.h"
 #include "utl/mem.h"
+#include "utl/file.h"
+#include <filesystem>
 
 namespace rhi {
 
@@ -117,11 +122,24 @@ VKAPI_ATTR VkBool32 DebugUtilsMessengerFunc(
 
 RhiVk::~RhiVk()
 {
+    // compiling pipelines use the device and add to the pipeline cache
+    WaitPipelinesCompiled();
+    if (_device) {
+        WaitIdle();
+        SavePipelineCache();
+        if (_defrag._passActive)
+            EndDefragmentationPass();
+        EndDefragmentation();
+        _frames.clear();
+        _cmdPools.clear();
+    }
+
     ClearCachedData();
+    DestroyRetired(true);
 
     _device.destroyPipelineCache(_pipelineCache, AllocCallbacks());
     vmaDestroyAllocator(_vma);
-    _timelineSemaphore.Done();
+    _timelines.clear();
     _device.destroy(AllocCallbacks());
     if (_debugUtilsMessenger)
         _instance.destroyDebugUtilsMessengerEXT(_debugUtilsMessenger, AllocCallbacks(), _dynamicDispatch);
@@ -131,7 +149,11 @@ RhiVk::~RhiVk()
 struct DeviceCreateData {
     vk::PhysicalDevice _physDevice;
     int32_t _universalQueueFamily = -1;
+    int32_t _computeQueueFamily = -1, _transferQueueFamily = -1;
     std::vector<char const *> _layerNames, _extNames;
+    bool _synchronization2 = false;
+    bool _memoryBudget = false;
+    DynamicState _dynamicState = DynamicState::Basic;
 };
 
 DeviceCreateData CheckPhysicalDeviceSuitability(vk::PhysicalDevice const &physDev, Rhi::Settings const &settings)
@@ -165,6 +187,55 @@ DeviceCreateData CheckPhysicalDeviceSuitability(vk::PhysicalDevice const &physDe
             return devCreateData;
     }
 
+    // synchronization2 is optional, barriers and submits fall back to the original commands without it
+    bool hasSync2Ext = std::any_of(devExts.value.begin(), devExts.value.end(), [&](vk::ExtensionProperties const &ext) {
+        return strcmp(ext.extensionName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0;
+    });
+    if (hasSync2Ext) {
+        auto features = physDev.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceSynchronization2FeaturesKHR>();
+        if (features.get<vk::PhysicalDeviceSynchronization2FeaturesKHR>().synchronization2) {
+            extNames.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            devCreateData._synchronization2 = true;
+        }
+    }
+
+    bool hasMemoryBudgetExt = std::any_of(devExts.value.begin(), devExts.value.end(), [&](vk::ExtensionProperties const &ext) {
+        return strcmp(ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+    });
+    if (hasMemoryBudgetExt) {
+        extNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        devCreateData._memoryBudget = true;
+    }
+
+    // the extended dynamic states let more of the render state be set per draw, so fewer pipelines get compiled
+    auto hasExt = [&](char const *name) {
+        return std::any_of(devExts.value.begin(), devExts.value.end(), [&](vk::ExtensionProperties const &ext) {
+            return strcmp(ext.extensionName, name) == 0;
+        });
+    };
+    if (hasExt(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+        auto features = physDev.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>();
+        if (features.get<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>().extendedDynamicState) {
+            extNames.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+            devCreateData._dynamicState |= DynamicState::Cull | DynamicState::DepthTest | DynamicState::StencilOps;
+        }
+    }
+    if (hasExt(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)) {
+        auto features = physDev.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT>();
+        if (features.get<vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT>().extendedDynamicState2) {
+            extNames.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+            devCreateData._dynamicState |= DynamicState::DepthBiasEnable;
+        }
+    }
+    if (hasExt(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        auto features = physDev.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>();
+        auto &features3 = features.get<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>();
+        if (features3.extendedDynamicState3ColorBlendEnable && features3.extendedDynamicState3ColorBlendEquation && features3.extendedDynamicState3ColorWriteMask) {
+            extNames.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+            devCreateData._dynamicState |= DynamicState::Blend;
+        }
+    }
+
     std::vector<vk::QueueFamilyProperties2> queueFamilies = physDev.getQueueFamilyProperties2();
     vk::QueueFlags universalFlags = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer;
     for (int32_t q = 0; q < queueFamilies.size(); ++q) {
@@ -176,6 +247,20 @@ DeviceCreateData CheckPhysicalDeviceSuitability(vk::PhysicalDevice const &physDe
         devCreateData._extNames = std::move(extNames);
         break;
     }
+
+    // families without graphics let compute and copies run alongside it, the first of each kind is used
+    for (int32_t q = 0; q < queueFamilies.size() && devCreateData._physDevice; ++q) {
+        vk::QueueFlags flags = queueFamilies[q].queueFamilyProperties.queueFlags;
+        if (flags & vk::QueueFlagBits::eGraphics)
+            continue;
+        if (flags & vk::QueueFlagBits::eCompute) {
+            if (devCreateData._computeQueueFamily < 0)
+                devCreateData._computeQueueFamily = q;
+        } else if (flags & vk::QueueFlagBits::eTransfer) {
+            if (devCreateData._transferQueueFamily < 0)
+                devCreateData._transferQueueFamily = q;
+        }
+    }
     return devCreateData;
 }
 
@@ -211,24 +296,92 @@ bool RhiVk::Init(Settings const &settings, int32_t deviceIndex)
     if (!InitDevice(deviceIndex))
         return false;
 
-    if (!_timelineSemaphore.Init(this, "RhiTimeline", 1))
+    if (!InitVma())
         return false;
 
-    if (!InitVma())
+    if (!InitPipelineCache())
         return false;
 
-    vk::PipelineCacheCreateInfo cacheInfo{};
-    if (_device.createPipelineCache(&cacheInfo, AllocCallbacks(), &_pipelineCache) != vk::Result::eSuccess)
+    return true;
+}
+
+std::string RhiVk::GetPipelineCachePath()
+{
+    if (_settings._cacheDir.empty())
+        return std::string();
+    // a new driver version usually changes the cache UUID as well, keeping its data in another file avoids rejecting it on each switch
+    vk::PhysicalDeviceProperties props = _physDevice.getProperties();
+    char name[64];
+    snprintf(name, sizeof(name), "pipelines_%04x_%04x_%08x_", props.vendorID, props.deviceID, props.driverVersion);
+    std::string path = _settings._cacheDir + "/" + name;
+    static char const s_hexDigits[] = "0123456789abcdef";
+    for (uint8_t b : props.pipelineCacheUUID) {
+        path += s_hexDigits[b >> 4];
+        path += s_hexDigits[b & 0xf];
+    }
+    return path + ".bin";
+}
+
+bool RhiVk::IsPipelineCacheValid(std::span<uint8_t const> data)
+{
+    vk::PipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header))
         return false;
+    memcpy(&header, data.data(), sizeof(header));
+    vk::PhysicalDeviceProperties props = _physDevice.getProperties();
+    return header.headerSize >= sizeof(header) && header.headerSize <= data.size()
+        && header.headerVersion == vk::PipelineCacheHeaderVersion::eOne
+        && header.vendorID == props.vendorID
+        && header.deviceID == props.deviceID
+        && header.pipelineCacheUUID == props.pipelineCacheUUID;
+}
+
+bool RhiVk::InitPipelineCache()
+{
+    Clock::time_point start = Clock::now();
+    std::string path = GetPipelineCachePath();
+    std::vector<uint8_t> cacheData;
+    if (!path.empty() && std::filesystem::exists(path)) {
+        cacheData = utl::ReadFile(path);
+        if (!IsPipelineCacheValid(cacheData)) {
+            LOG("Ignoring pipeline cache %s made for another device or driver", path);
+            cacheData.clear();
+        }
+    }
 
+    vk::PipelineCacheCreateInfo cacheInfo{ vk::PipelineCacheCreateFlags(), cacheData.size(), cacheData.data() };
+    if (_device.createPipelineCache(&cacheInfo, AllocCallbacks(), &_pipelineCache) != vk::Result::eSuccess) {
+        if (cacheData.empty())
+            return false;
+        LOG("Failed to create the pipeline cache from %s, starting with an empty one", path);
+        cacheData.clear();
+        cacheInfo = vk::PipelineCacheCreateInfo{};
+        if (_device.createPipelineCache(&cacheInfo, AllocCallbacks(), &_pipelineCache) != vk::Result::eSuccess)
+            return false;
+    }
+
+    if (!cacheData.empty())
+        LOG("Loaded pipeline cache of %zu bytes in %.2f ms", cacheData.size(), std::chrono::duration<double, std::milli>(Clock::now() - start).count());
     return true;
 }
 
+bool RhiVk::SavePipelineCache()
+{
+    if (!_pipelineCacheDirty.exchange(false))
+        return true;
+    std::string path = GetPipelineCachePath();
+    if (path.empty())
+        return true;
+    auto cacheData = _device.getPipelineCacheData(_pipelineCache);
+    if (cacheData.result != vk::Result::eSuccess)
+        return false;
+    return utl::WriteFile(path, cacheData.value);
+}
+
 bool RhiVk::InitInstance()
 {
-    if (_settings._enableValidation) {
-        _allocTracker = std::make_unique<HostAllocationTrackerVk>();
-    }
+    // the counters are atomic, cheap enough to keep in release builds for the memory stats
+    _allocTracker = std::make_unique<HostAllocationTrackerVk>();
 
     vk::ApplicationInfo appInfo{
         _settings._appName,
@@ -292,17 +445,55 @@ bool RhiVk::InitDevice(int32_t deviceIndex)
         _physDevice = devCreateData._physDevice;
 
         std::array<float, 1> queuePriorities{ 1.0f };
-        std::array<vk::DeviceQueueCreateInfo, 1> queueCreateInfo{ 
-            vk::DeviceQueueCreateInfo {
+        std::vector<vk::DeviceQueueCreateInfo> queueCreateInfo;
+        for (int32_t family : { devCreateData._universalQueueFamily, devCreateData._computeQueueFamily, devCreateData._transferQueueFamily }) {
+            if (family < 0)
+                continue;
+            queueCreateInfo.push_back(vk::DeviceQueueCreateInfo{
                 vk::DeviceQueueCreateFlags(),
-                (uint32_t)devCreateData._universalQueueFamily,
+                (uint32_t)family,
                 1,
                 queuePriorities.data(),
-            }
-        };
+            });
+        }
+        // the optional features are chained in front of each other when the device has them
+        void *optionalFeatures = nullptr;
+        vk::PhysicalDeviceSynchronization2FeaturesKHR featuresSync2;
+        featuresSync2.setSynchronization2(true);
+        if (devCreateData._synchronization2) {
+            featuresSync2.setPNext(optionalFeatures);
+            optionalFeatures = &featuresSync2;
+        }
+        vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT featuresDynState;
+        featuresDynState.setExtendedDynamicState(true);
+        if (!!(devCreateData._dynamicState & DynamicState::Cull)) {
+            featuresDynState.setPNext(optionalFeatures);
+            optionalFeatures = &featuresDynState;
+        }
+        vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT featuresDynState2;
+        featuresDynState2.setExtendedDynamicState2(true);
+        if (!!(devCreateData._dynamicState & DynamicState::DepthBiasEnable)) {
+            featuresDynState2.setPNext(optionalFeatures);
+            optionalFeatures = &featuresDynState2;
+        }
+        vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT featuresDynState3;
+        featuresDynState3
+            .setExtendedDynamicState3ColorBlendEnable(true)
+            .setExtendedDynamicState3ColorBlendEquation(true)
+            .setExtendedDynamicState3ColorWriteMask(true);
+        if (!!(devCreateData._dynamicState & DynamicState::Blend)) {
+            featuresDynState3.setPNext(optionalFeatures);
+            optionalFeatures = &featuresDynState3;
+        }
         vk::PhysicalDeviceVulkan12Features features12;
         features12.setTimelineSemaphore(true);
+        features12.setPNext(optionalFeatures);
+        // compressed formats are enabled where available, the loaders check the format support of their textures
+        vk::PhysicalDeviceFeatures supportedFeatures = _physDevice.getFeatures();
         vk::PhysicalDeviceFeatures features;
+        features.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        features.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+        features.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
         vk::DeviceCreateInfo devInfo{
             vk::DeviceCreateFlags(),
             queueCreateInfo,
@@ -314,25 +505,73 @@ bool RhiVk::InitDevice(int32_t deviceIndex)
         if (_physDevice.createDevice(&devInfo, AllocCallbacks(), &_device) != vk::Result::eSuccess)
             return false;
 
-        _universalQueue._family = devCreateData._universalQueueFamily;
-        _universalQueue._queue = _device.getQueue(devCreateData._universalQueueFamily, 0);
-        ASSERT(_universalQueue._queue);
-        if (!_universalQueue._queue)
-            return false;
+        // the extension's commands are called through the dispatcher
+        _dynamicDispatch.init(_device);
+        _synchronization2 = devCreateData._synchronization2;
+        _memoryBudget = devCreateData._memoryBudget;
+        _dynamicState = devCreateData._dynamicState;
 
-        SetDebugName(vk::ObjectType::eQueue, (uint64_t)(VkQueue)_universalQueue._queue, "UniversalQueue");
+        std::vector<vk::QueueFamilyProperties> queueFamilies = _physDevice.getQueueFamilyProperties();
+        if (!InitQueue(_universalQueue, devCreateData._universalQueueFamily, queueFamilies, "UniversalQueue"))
+            return false;
+        // without dedicated families the kinds alias a queue that can do their work, they still get timelines
+        // of their own, so their submissions go through the same cross-queue synchronization
+        int32_t computeFamily = devCreateData._computeQueueFamily >= 0 ? devCreateData._computeQueueFamily : devCreateData._universalQueueFamily;
+        if (!InitQueue(_computeQueue, computeFamily, queueFamilies, "ComputeQueue"))
+            return false;
+        int32_t transferFamily = devCreateData._transferQueueFamily >= 0 ? devCreateData._transferQueueFamily : computeFamily;
+        if (!InitQueue(_transferQueue, transferFamily, queueFamilies, "TransferQueue"))
+            return false;
 
         return true;
     }
     return false;
 }
 
+bool RhiVk::InitQueue(QueueData &queue, int32_t family, std::vector<vk::QueueFamilyProperties> const &queueFamilies, char const *name)
+{
+    queue._family = family;
+    queue._queue = _device.getQueue(family, 0);
+    ASSERT(queue._queue);
+    if (!queue._queue)
+        return false;
+    if (std::find(_queueFamilies.begin(), _queueFamilies.end(), queue._family) == _queueFamilies.end()) {
+        SetDebugName(vk::ObjectType::eQueue, (uint64_t)(VkQueue)queue._queue, name);
+        _queueFamilies.push_back(queue._family);
+    }
+
+    queue._flags = queueFamilies[family].queueFlags;
+    if (queue._flags & vk::QueueFlagBits::eGraphics) {
+        queue._stages = ~vk::PipelineStageFlags();
+        queue._stages2 = ~vk::PipelineStageFlags2();
+    } else {
+        queue._stages = vk::PipelineStageFlagBits::eTopOfPipe | vk::PipelineStageFlagBits::eBottomOfPipe |
+            vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eHost | vk::PipelineStageFlagBits::eAllCommands;
+        queue._stages2 = vk::PipelineStageFlagBits2::eTopOfPipe | vk::PipelineStageFlagBits2::eBottomOfPipe |
+            vk::PipelineStageFlagBits2::eAllTransfer | vk::PipelineStageFlagBits2::eCopy | vk::PipelineStageFlagBits2::eHost |
+            vk::PipelineStageFlagBits2::eAllCommands;
+        if (queue._flags & vk::QueueFlagBits::eCompute) {
+            queue._stages |= vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect;
+            queue._stages2 |= vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eDrawIndirect;
+        }
+    }
+
+    auto &timeline = _timelines.emplace_back(std::make_unique<QueueTimeline>());
+    if (!timeline->_semaphore.Init(this, std::string(name) + "Timeline"))
+        return false;
+    queue._timeline = timeline.get();
+
+    return true;
+}
+
 bool RhiVk::InitVma()
 {
     VmaAllocatorCreateInfo vmaInfo{
+        .flags = _memoryBudget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u,
         .physicalDevice = _physDevice,
         .device = _device,
         .instance = _instance,
+        .vulkanApiVersion = VK_API_VERSION_1_2,
     };
     if ((vk::Result)vmaCreateAllocator(&vmaInfo, &_vma) != vk::Result::eSuccess)
         return false;
@@ -353,10 +592,110 @@ bool RhiVk::SetDebugName(vk::ObjectType objType, uint64_t handle, char const *na
     return true;
 }
 
+void RhiVk::SetDebugName(VmaAllocation vmaAlloc, char const *name)
+{
+    // shows in VMA's statistics dumps
+    if (_settings._enableValidation)
+        vmaSetAllocationName(_vma, vmaAlloc, name);
+}
+
 std::span<uint32_t> RhiVk::GetQueueFamilyIndices(ResourceUsage usage)
 {
-    static std::array<uint32_t, 1> s_theQueue { { _universalQueue._family, } };
-    return s_theQueue;
+    // resources are exclusive to a family at a time, submissions transfer their ownership between the queues
+    return _queueFamilies;
+}
+
+auto RhiVk::GetQueue(QueueKind kind) -> QueueData &
+{
+    switch (kind) {
+        case QueueKind::Compute:
+            return _computeQueue;
+        case QueueKind::Transfer:
+            return _transferQueue;
+        default:
+            ASSERT(kind == QueueKind::Universal);
+            return _universalQueue;
+    }
+}
+
+uint64_t RhiVk::ReserveCounter(QueueData &queue)
+{
+    std::lock_guard lock(_timelineMutex);
+    uint64_t counter = ++_counter;
+    queue._timeline->_pending.push_back(counter);
+    return counter;
+}
+
+bool RhiVk::SignalCounter(QueueData &queue, uint64_t counter)
+{
+    vk::Semaphore semaphore = queue._timeline->_semaphore._semaphore;
+    vk::TimelineSemaphoreSubmitInfo semValuesInfo{ 0, nullptr, 1, &counter };
+    vk::SubmitInfo submitInfo{ 0, nullptr, nullptr, 0, nullptr, 1, &semaphore, &semValuesInfo };
+    vk::Result res = queue._queue.submit(submitInfo);
+    CountQueueSubmit(0);
+    return res == vk::Result::eSuccess;
+}
+
+void RhiVk::AbandonPrepared(uint64_t signalValue)
+{
+    auto it = std::find_if(_prepared.begin(), _prepared.end(), [&](PreparedCounters const &prepared) { return prepared._counters.back().second == signalValue; });
+    if (it == _prepared.end()) {
+        ASSERT(0);
+        return;
+    }
+    it->_abandoned = true;
+    SignalAbandoned();
+}
+
+void RhiVk::SignalAbandoned()
+{
+    // only the front is signaled, values signaled ahead of the submissions prepared earlier would make theirs go backwards
+    while (!_prepared.empty() && _prepared.front()._abandoned) {
+        for (auto &[queueKind, counter] : _prepared.front()._counters)
+            SignalCounter(GetQueue(queueKind), counter);
+        _prepared.pop_front();
+    }
+}
+
+uint64_t RhiVk::GetCompletedCounter()
+{
+    std::lock_guard lock(_timelineMutex);
+    // every counter belongs to one queue, so all the ones before the oldest pending counter of any queue are finished
+    uint64_t completed = _counter;
+    for (auto &timeline : _timelines) {
+        uint64_t value = timeline->_semaphore.GetCurrentCounter();
+        while (!timeline->_pending.empty() && timeline->_pending.front() <= value)
+            timeline->_pending.pop_front();
+        if (!timeline->_pending.empty())
+            completed = std::min(completed, timeline->_pending.front() - 1);
+    }
+    if (_completedTimes.empty() || _completedTimes.back().first < completed) {
+        _completedTimes.push_back({ completed, Clock::now() });
+        if (_completedTimes.size() > s_maxCompletedTimes)
+            _completedTimes.pop_front();
+    }
+    return completed;
+}
+
+bool RhiVk::WaitCounter(uint64_t counter, uint64_t timeout)
+{
+    // each queue only has to reach its last counter up to the one waited for
+    std::vector<std::pair<TimelineSemaphoreVk *, uint64_t>> waits;
+    {
+        std::lock_guard lock(_timelineMutex);
+        for (auto &timeline : _timelines) {
+            auto it = std::upper_bound(timeline->_pending.begin(), timeline->_pending.end(), counter);
+            if (it != timeline->_pending.begin())
+                waits.push_back({ &timeline->_semaphore, *std::prev(it) });
+        }
+    }
+    for (auto &[semaphore, value] : waits) {
+        if (!semaphore->WaitCounter(value, timeout))
+            return false;
+    }
+    // the time the wait ended at is when the counter was seen finished
+    GetCompletedCounter();
+    return true;
 }
 
 ResourceUsage RhiVk::GetFormatImageUsage(Format fmt, ResourceUsage usage)
@@ -372,30 +711,475 @@ vk::FormatFeatureFlags RhiVk::GetFormatFeatures(Format fmt, ResourceUsage usage)
     return fmtFlags;
 }
 
+Rhi::MemoryBudget RhiVk::GetMemoryBudget()
+{
+    // without the budget extension VMA estimates the budget from the heap sizes and its own allocations
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> heapBudgets;
+    vmaGetHeapBudgets(_vma, heapBudgets.data());
+    VkPhysicalDeviceMemoryProperties const *memProps = nullptr;
+    vmaGetMemoryProperties(_vma, &memProps);
+
+    MemoryBudget budget;
+    for (uint32_t h = 0; h < memProps->memoryHeapCount; ++h) {
+        if (!(memProps->memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+            continue;
+        budget._usage += heapBudgets[h].usage;
+        budget._budget += heapBudgets[h].budget;
+    }
+    return budget;
+}
+
+auto RhiVk::GetMemoryStats(bool detailed) -> MemoryStats
+{
+    MemoryStats stats = Rhi::GetMemoryStats(detailed);
+
+    if (_allocTracker) {
+        stats._host = MemoryStats::Host{
+            ._allocations = _allocTracker->_allocations,
+            ._frees = _allocTracker->_deallocations,
+            ._bytes = _allocTracker->_sizeAllocated,
+            ._internalBytes = _allocTracker->_sizeAllocatedInternal,
+        };
+    }
+
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> heapBudgets;
+    vmaGetHeapBudgets(_vma, heapBudgets.data());
+    VkPhysicalDeviceMemoryProperties const *memProps = nullptr;
+    vmaGetMemoryProperties(_vma, &memProps);
+    // walks all the blocks and allocations
+    VmaTotalStatistics totalStats;
+    if (detailed)
+        vmaCalculateStatistics(_vma, &totalStats);
+
+    for (uint32_t h = 0; h < memProps->memoryHeapCount; ++h) {
+        VmaBudget const &heapBudget = heapBudgets[h];
+        MemoryStats::Heap heap{
+            ._deviceLocal = (memProps->memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+            ._size = memProps->memoryHeaps[h].size,
+            ._budget{ ._usage = heapBudget.usage, ._budget = heapBudget.budget },
+            ._blocks = heapBudget.statistics.blockCount,
+            ._allocations = heapBudget.statistics.allocationCount,
+            ._blockBytes = heapBudget.statistics.blockBytes,
+            ._allocationBytes = heapBudget.statistics.allocationBytes,
+        };
+        if (detailed) {
+            heap._freeRanges = totalStats.memoryHeap[h].unusedRangeCount;
+            heap._largestFreeRange = totalStats.memoryHeap[h].unusedRangeSizeMax;
+        }
+        stats._heaps.push_back(heap);
+    }
+
+    stats._defragBytesMoved = _defrag._stats.bytesMoved;
+    stats._defragBytesFreed = _defrag._stats.bytesFreed;
+
+    return stats;
+}
+
 VmaAllocationCreateInfo RhiVk::GetVmaAllocCreateInfo(Resource *resource)
 {
     VmaAllocationCreateInfo allocInfo{
         .usage = VMA_MEMORY_USAGE_AUTO,
     };
     if (resource->_descriptor._usage.cpuAccess) {
-        allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-        if (resource->_descriptor._usage.copyDst)
-            allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
-    }
-    if (_settings._enableValidation) {
-        allocInfo.flags |= VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
-        allocInfo.pUserData = const_cast<char*>(resource->_name.c_str());
+        switch (resource->_descriptor._hostAccess) {
+            case HostAccess::Auto:
+                allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+                if (resource->_descriptor._usage.copyDst)
+                    allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+                break;
+            case HostAccess::Upload:
+                allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+                allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                break;
+            case HostAccess::Dynamic:
+                // device local and host visible when there is such memory, host memory the device reads over the bus otherwise
+                allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+                allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                break;
+            case HostAccess::Readback:
+                allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+                allocInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                allocInfo.preferredFlags |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+                break;
+        }
     }
+    // defragmentation finds the resources bound to the allocations it moves through the user data
+    allocInfo.pUserData = resource;
 
     return allocInfo;
 }
 
+bool RhiVk::BeginFrame()
+{
+    if (!Rhi::BeginFrame())
+        return false;
+
+    if (!UpdateDefragmentation())
+        return false;
+
+    // pipelines created since the last save are kept even if the process doesn't exit cleanly
+    if (_frameNumber % s_pipelineCacheSaveInterval == 0 && !SavePipelineCache())
+        LOG("Failed to save the pipeline cache");
+
+    DestroyRetired();
+    PruneCmdPools();
+
+    return true;
+}
+
+uint64_t RhiVk::GetFrameSignalValue(FrameContext const &frame)
+{
+    uint64_t signalValue = 0;
+    for (auto &sub : frame._submissions) {
+        signalValue = std::max(signalValue, static_cast<SubmissionVk *>(sub.get())->_executeSignalValue);
+    }
+    return signalValue;
+}
+
+bool RhiVk::IsFrameFinished(FrameContext &frame)
+{
+    // a submission that wasn't prepared yet may still be executed, the frame isn't finished before that
+    for (auto &sub : frame._submissions) {
+        if (!static_cast<SubmissionVk *>(sub.get())->_executeSignalValue)
+            return false;
+    }
+    return GetFrameSignalValue(frame) <= GetCompletedCounter();
+}
+
+bool RhiVk::WaitFrame(FrameContext &frame)
+{
+    // submissions that were never prepared didn't get to the GPU, there's nothing to wait for them
+    uint64_t signalValue = GetFrameSignalValue(frame);
+    if (!signalValue)
+        return true;
+    return WaitCounter(signalValue);
+}
+
+auto RhiVk::GetFrameFinishTime(FrameContext &frame, Clock::time_point observed) -> Clock::time_point
+{
+    uint64_t signalValue = GetFrameSignalValue(frame);
+    std::lock_guard lock(_timelineMutex);
+    auto it = std::lower_bound(_completedTimes.begin(), _completedTimes.end(), signalValue, [](auto const &completed, uint64_t value) {
+        return completed.first < value;
+    });
+    if (it == _completedTimes.end())
+        return observed;
+    return std::min(it->second, observed);
+}
+
 bool RhiVk::WaitIdle()
 {
     if (_device.waitIdle() != vk::Result::eSuccess)
         return false;
+
+    DestroyRetired();
+
+    return true;
+}
+
+CmdPoolVk *RhiVk::GetCmdPool(uint32_t queueFamily)
+{
+    CmdPoolVk *pool;
+    {
+        std::lock_guard lock(_cmdPoolsMutex);
+        auto &framePools = _cmdPools[{ std::this_thread::get_id(), queueFamily }];
+        framePools.resize(_frames.size());
+        auto &slotPool = framePools[_frameNumber % _frames.size()];
+        if (!slotPool)
+            slotPool = std::make_unique<CmdPoolVk>();
+        pool = slotPool.get();
+        pool->_lastHandedOutFrame = _frameNumber;
+    }
+
+    // only the calling thread uses the pool, so it can be created and reset without holding the lock
+    if (!pool->_pool && !pool->Init(this, queueFamily))
+        return nullptr;
+    if (pool->_frameNumber != _frameNumber && !pool->Reset(_frameNumber))
+        return nullptr;
+
+    return pool;
+}
+
+void RhiVk::PruneCmdPools()
+{
+    uint64_t completed = GetCompletedCounter();
+    std::lock_guard lock(_cmdPoolsMutex);
+    std::erase_if(_cmdPools, [&](auto const &threadPools) {
+        return std::all_of(threadPools.second.begin(), threadPools.second.end(), [&](auto const &pool) {
+            return !pool || (pool->_lastHandedOutFrame + s_cmdPoolIdleFrames < _frameNumber && !pool->_numUnsubmitted && pool->_lastUseCounter <= completed);
+        });
+    });
+}
+
+void RhiVk::Retire(uint64_t counter, vk::ObjectType type, uint64_t handle, VmaAllocation vmaAlloc)
+{
+    if (!handle && !vmaAlloc)
+        return;
+    // the resource in the user data is going away, defragmentation leaves the allocation in place until it's destroyed
+    if (vmaAlloc)
+        vmaSetAllocationUserData(_vma, vmaAlloc, nullptr);
+    std::lock_guard lock(_retireMutex);
+    _retiredHandles.push_back(RetiredHandle{
+        ._counter = counter,
+        ._type = type,
+        ._handle = handle,
+        ._vmaAlloc = vmaAlloc,
+    });
+}
+
+void RhiVk::Retire(uint64_t counter, DescSetVk &&descSet)
+{
+    if (!descSet)
+        return;
+    std::lock_guard lock(_retireMutex);
+    _retiredDescSets.push_back(RetiredDescSet{
+        ._counter = counter,
+        ._descSet = std::move(descSet),
+    });
+}
+
+void RhiVk::DestroyRetired(bool all)
+{
+    uint64_t counter = all ? ~0ull : GetCompletedCounter();
+    std::vector<RetiredHandle> handles;
+    std::vector<RetiredDescSet> descSets;
+    {
+        std::lock_guard lock(_retireMutex);
+        // the allocations an active defragmentation pass moves are held until it ends
+        auto handlesEnd = std::partition(_retiredHandles.begin(), _retiredHandles.end(), [&](RetiredHandle const &h) {
+            return h._counter > counter || (h._vmaAlloc && _defrag._sourceAllocs.contains(h._vmaAlloc));
+        });
+        handles.insert(handles.end(), std::make_move_iterator(handlesEnd), std::make_move_iterator(_retiredHandles.end()));
+        _retiredHandles.erase(handlesEnd, _retiredHandles.end());
+
+        auto setsEnd = std::partition(_retiredDescSets.begin(), _retiredDescSets.end(), [&](RetiredDescSet const &s) { return s._counter > counter; });
+        descSets.insert(descSets.end(), std::make_move_iterator(setsEnd), std::make_move_iterator(_retiredDescSets.end()));
+        _retiredDescSets.erase(setsEnd, _retiredDescSets.end());
+    }
+
+    // sets are freed first, they may be the last ones holding their pools
+    descSets.clear();
+    for (auto &h : handles) {
+        DestroyHandle(h._type, h._handle, h._vmaAlloc);
+    }
+}
+
+void RhiVk::DestroyHandle(vk::ObjectType type, uint64_t handle, VmaAllocation vmaAlloc)
+{
+    switch (type) {
+        case vk::ObjectType::eBuffer:
+            vmaDestroyBuffer(_vma, (VkBuffer)handle, vmaAlloc);
+            break;
+        case vk::ObjectType::eImage:
+            if (vmaAlloc)
+                vmaDestroyImage(_vma, (VkImage)handle, vmaAlloc);
+            else
+                _device.destroyImage((VkImage)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eImageView:
+            _device.destroyImageView((VkImageView)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eSampler:
+            _device.destroySampler((VkSampler)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eFramebuffer:
+            _device.destroyFramebuffer((VkFramebuffer)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eRenderPass:
+            _device.destroyRenderPass((VkRenderPass)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eCommandPool:
+            _device.destroyCommandPool((VkCommandPool)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::ePipeline:
+            _device.destroyPipeline((VkPipeline)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::ePipelineLayout:
+            _device.destroyPipelineLayout((VkPipelineLayout)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eDescriptorSetLayout:
+            _device.destroyDescriptorSetLayout((VkDescriptorSetLayout)handle, AllocCallbacks());
+            break;
+        case vk::ObjectType::eUnknown:
+            // a bare allocation without a resource bound to it
+            vmaFreeMemory(_vma, vmaAlloc);
+            break;
+        default:
+            ASSERT(0);
+            break;
+    }
+}
+
+void RhiVk::AddResourceSet(ResourceSetVk *resSet)
+{
+    std::lock_guard lock(_resourceSetsMutex);
+    _resourceSets.insert(resSet);
+}
+
+void RhiVk::RemoveResourceSet(ResourceSetVk *resSet)
+{
+    std::lock_guard lock(_resourceSetsMutex);
+    _resourceSets.erase(resSet);
+}
+
+void RhiVk::UpdateResourceSets(std::unordered_set<Resource *> const &resources)
+{
+    std::lock_guard lock(_resourceSetsMutex);
+    for (auto *resSet : _resourceSets) {
+        bool refersResources = std::any_of(resSet->_resourceRefs.begin(), resSet->_resourceRefs.end(), [&](ResourceRef const &ref) {
+            return resources.contains(Cast<Resource>(ref._bindable.get()));
+        });
+        if (!refersResources)
+            continue;
+        bool res = resSet->Update();
+        ASSERT(res);
+    }
+}
+
+bool RhiVk::UpdateDefragmentation()
+{
+    if (_defrag._passActive) {
+        // the moved resources' old memory can only be reused once the copies are done
+        if (_defrag._copyCounter > GetCompletedCounter())
+            return true;
+        if (!EndDefragmentationPass())
+            return false;
+    }
+
+    if (!_defrag._context) {
+        if (!_settings._defragBytesPerPass || _frameNumber < _defrag._nextFrame)
+            return true;
+        VmaDefragmentationInfo defragInfo{
+            .maxBytesPerPass = _settings._defragBytesPerPass,
+        };
+        if ((vk::Result)vmaBeginDefragmentation(_vma, &defragInfo, &_defrag._context) != vk::Result::eSuccess)
+            return false;
+    }
+
+    return BeginDefragmentationPass();
+}
+
+bool RhiVk::BeginDefragmentationPass()
+{
+    vk::Result res = (vk::Result)vmaBeginDefragmentationPass(_vma, _defrag._context, &_defrag._passInfo);
+    if (res == vk::Result::eSuccess) {
+        // nothing left to move
+        EndDefragmentation();
+        return true;
+    }
+    if (res != vk::Result::eIncomplete)
+        return false;
+    _defrag._passActive = true;
+
+    auto copyPass = Create<CopyPass>("Defragmentation");
+    for (uint32_t m = 0; m < _defrag._passInfo.moveCount; ++m) {
+        VmaDefragmentationMove &move = _defrag._passInfo.pMoves[m];
+        _defrag._sourceAllocs.insert(move.srcAllocation);
+        VmaAllocationInfo allocInfo;
+        vmaGetAllocationInfo(_vma, move.srcAllocation, &allocInfo);
+        // allocations without a resource, like the transient heaps' blocks, or resources being destroyed stay in place
+        auto *resourcePtr = static_cast<Resource *>(allocInfo.pUserData);
+        std::shared_ptr<Resource> resource = resourcePtr ? std::static_pointer_cast<Resource>(resourcePtr->weak_from_this().lock()) : nullptr;
+        std::shared_ptr<Resource> moved = resource && IsMovable(resource.get()) ? CreateMovedResource(resource.get(), move.dstTmpAllocation) : nullptr;
+        bool copied = false;
+        if (auto tex = Cast<Texture>(moved))
+            copied = copyPass->CopyMips(std::static_pointer_cast<Texture>(resource), tex);
+        else if (moved)
+            copied = copyPass->Copy({ { resource }, { moved } });
+        if (!copied) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+        _defrag._moves.push_back(DefragMove{ ._resource = std::move(resource), ._moved = std::move(moved) });
+    }
+
+    _defrag._copyCounter = 0;
+    if (_defrag._moves.empty())
+        return true;
+
+    auto sub = Submit({ copyPass }, "Defragmentation");
+    if (!sub->Prepare() || !sub->Execute())
+        return false;
+    _defrag._copyCounter = static_cast<SubmissionVk *>(sub.get())->_executeSignalValue;
+
+    // later submissions use the copies, the GPU executes them in order on the same queue
+    std::unordered_set<Resource *> movedResources;
+    for (auto &move : _defrag._moves) {
+        SwapMovedHandles(move._resource.get(), move._moved.get());
+        movedResources.insert(move._resource.get());
+    }
+    UpdateResourceSets(movedResources);
+
     return true;
 }
 
+bool RhiVk::EndDefragmentationPass()
+{
+    ASSERT(_defrag._passActive);
+    vk::Result res = (vk::Result)vmaEndDefragmentationPass(_vma, _defrag._context, &_defrag._passInfo);
+    _defrag._passActive = false;
+    _defrag._moves.clear();
+    _defrag._sourceAllocs.clear();
+    if (res == vk::Result::eSuccess) {
+        EndDefragmentation();
+        return true;
+    }
+    return res == vk::Result::eIncomplete;
+}
+
+void RhiVk::EndDefragmentation()
+{
+    if (!_defrag._context)
+        return;
+    VmaDefragmentationStats stats;
+    vmaEndDefragmentation(_vma, _defrag._context, &stats);
+    _defrag._context = {};
+    _defrag._stats.bytesMoved += stats.bytesMoved;
+    _defrag._stats.bytesFreed += stats.bytesFreed;
+    _defrag._stats.allocationsMoved += stats.allocationsMoved;
+    _defrag._stats.deviceMemoryBlocksFreed += stats.deviceMemoryBlocksFreed;
+    _defrag._nextFrame = _frameNumber + s_defragInterval;
+}
+
+bool RhiVk::IsMovable(Resource *resource)
+{
+    // mapped memory has to stay where the host sees it, render targets have views outside of resource sets
+    ResourceUsage usage = resource->_descriptor._usage;
+    if (usage.cpuAccess || usage.rt || usage.ds || usage.present)
+        return false;
+    return usage.copySrc && usage.copyDst;
+}
+
+std::shared_ptr<Resource> RhiVk::CreateMovedResource(Resource *resource, VmaAllocation vmaAlloc)
+{
+    if (Cast<BufferVk>(resource)) {
+        auto buffer = Create<BufferVk>(resource->_name);
+        if (!buffer->Init(resource->_descriptor, vmaAlloc, 0))
+            return nullptr;
+        return buffer;
+    }
+    if (Cast<TextureVk>(resource)) {
+        auto texture = Create<TextureVk>(resource->_name);
+        if (!texture->Init(resource->_descriptor, vmaAlloc, 0))
+            return nullptr;
+        return texture;
+    }
+    return nullptr;
+}
+
+void RhiVk::SwapMovedHandles(Resource *resource, Resource *moved)
+{
+    if (auto *buffer = Cast<BufferVk>(resource)) {
+        std::swap(buffer->_buffer, static_cast<BufferVk *>(moved)->_buffer);
+    } else {
+        auto *texture = Cast<TextureVk>(resource);
+        auto *movedTex = static_cast<TextureVk *>(moved);
+        std::swap(texture->_image, movedTex->_image);
+        std::swap(texture->_view, movedTex->_view);
+    }
+    // the contents are in the state the copy left the destination in
+    std::swap(resource->_states, moved->_states);
+}
+
 
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "base_vk.h"
+#include "pipeline_vk.h"
 
 #include "../rhi.h"
 
@@ -40,14 +41,15 @@ struct WindowDataWayland : public WindowData {
 struct HostAllocationTrackerVk {
 	vk::AllocationCallbacks _allocCallbacks{ this, Allocate, Reallocate, Free, InternalAllocationNotify, InternalFreeNotify };
 
-	size_t _allocations = 0;
-	size_t _deallocations = 0;
-	size_t _reallocations = 0;
-	size_t _internalAllocations = 0;
-	size_t _internalDeallocations = 0;
+	// the driver may call the callbacks from any thread
+	std::atomic<size_t> _allocations = 0;
+	std::atomic<size_t> _deallocations = 0;
+	std::atomic<size_t> _reallocations = 0;
+	std::atomic<size_t> _internalAllocations = 0;
+	std::atomic<size_t> _internalDeallocations = 0;
 
-	size_t _sizeAllocated = 0;
-	size_t _sizeAllocatedInternal = 0;
+	std::atomic<size_t> _sizeAllocated = 0;
+	std::atomic<size_t> _sizeAllocatedInternal = 0;
 
 	static VKAPI_ATTR void *VKAPI_CALL Allocate(void *pUserData, size_t size, size_t alignment, vk::SystemAllocationScope allocationScope);
 	static VKAPI_ATTR void *VKAPI_CALL Reallocate(void *pUserData, void *pOriginal, size_t size, size_t alignment, vk::SystemAllocationScope allocationScope);
@@ -57,6 +59,7 @@ struct HostAllocationTrackerVk {
 };
 
 struct RhiVk final : public Rhi {
+	struct QueueData;
 
 	~RhiVk() override;
 
@@ -64,42 +67,185 @@ struct RhiVk final : public Rhi {
 
 	bool Init(Settings const &settings, int32_t deviceIndex = 0) override;
 
+	bool BeginFrame() override;
+	bool IsFrameFinished(FrameContext &frame) override;
+	bool WaitFrame(FrameContext &frame) override;
+	Clock::time_point GetFrameFinishTime(FrameContext &frame, Clock::time_point observed) override;
+
 	bool WaitIdle() override;
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<RhiVk>(); }
 
+	uint64_t GetFrameSignalValue(FrameContext const &frame);
+
 	vk::AllocationCallbacks *AllocCallbacks() { return _allocTracker ? &_allocTracker->_allocCallbacks : nullptr; }
 
 	bool InitInstance();
 	bool InitDevice(int32_t deviceIndex);
+	bool InitQueue(QueueData &queue, int32_t family, std::vector<vk::QueueFamilyProperties> const &queueFamilies, char const *name);
 	bool InitVma();
+	bool InitPipelineCache();
+
+	// Empty when there's no cache directory, the file name identifies the device and driver
+	std::string GetPipelineCachePath();
+	bool IsPipelineCacheValid(std::span<uint8_t const> data);
+	// Writes the cache if pipelines were created since the last save
+	bool SavePipelineCache();
 
 	bool SetDebugName(vk::ObjectType objType, uint64_t handle, char const *name);
+	void SetDebugName(VmaAllocation vmaAlloc, char const *name);
 
 	std::span<uint32_t> GetQueueFamilyIndices(ResourceUsage usage);
-	ResourceUsage GetFormatImageUsage(Format fmt, ResourceUsage usage);
+	ResourceUsage GetFormatImageUsage(Format fmt, ResourceUsage usage) override;
+	MemoryBudget GetMemoryBudget() override;
+	MemoryStats GetMemoryStats(bool detailed = false) override;
 	vk::FormatFeatureFlags GetFormatFeatures(Format fmt, ResourceUsage usage);
 
 	VmaAllocationCreateInfo GetVmaAllocCreateInfo(Resource *resource);
 
+	// Returns the calling thread's command pool for the current frame slot, reset if an earlier frame used it
+	CmdPoolVk *GetCmdPool(uint32_t queueFamily);
+	// Frees the pools of threads that haven't recorded for a while, like the ones that exited, called by BeginFrame
+	void PruneCmdPools();
+
+	// The queue that executes submissions of the kind, kinds without a dedicated family alias the queue of another
+	QueueData &GetQueue(QueueKind kind);
+
+	// Reserves the next timeline counter for a submission to the queue, counters increase across all the queues
+	uint64_t ReserveCounter(QueueData &queue);
+	// Signals a reserved counter without executing anything, after the work already submitted to the queue
+	bool SignalCounter(QueueData &queue, uint64_t counter);
+	// Signals the counters of a prepared submission that won't be executed, once the ones prepared before it are
+	void AbandonPrepared(uint64_t signalValue);
+	// Signals the counters of the abandoned submissions whose turn came, called after executing a submission
+	void SignalAbandoned();
+	// The counter all the work up to which is finished on every queue
+	uint64_t GetCompletedCounter();
+	bool WaitCounter(uint64_t counter, uint64_t timeout = std::numeric_limits<uint64_t>::max());
+
+	// The timeline value signaled by the latest submission, objects that aren't tracked per submission are retired with it
+	uint64_t GetLastSubmittedCounter() const { return _counter; }
+
+	// Destroys the handle (and its VMA allocation) once the timeline semaphore reaches the counter
+	void Retire(uint64_t counter, vk::ObjectType type, uint64_t handle, VmaAllocation vmaAlloc = {});
+	template <typename HandleType>
+	void Retire(uint64_t counter, HandleType handle, VmaAllocation vmaAlloc = {}) {
+		Retire(counter, HandleType::objectType, (uint64_t)(typename HandleType::CType)handle, vmaAlloc);
+	}
+	void Retire(uint64_t counter, DescSetVk &&descSet);
+	// Destroys the retired objects whose counter has been reached, or all of them
+	void DestroyRetired(bool all = false);
+	void DestroyHandle(vk::ObjectType type, uint64_t handle, VmaAllocation vmaAlloc);
+
+	// Resource sets are re-written when the resources they refer to are moved by defragmentation
+	void AddResourceSet(ResourceSetVk *resSet);
+	void RemoveResourceSet(ResourceSetVk *resSet);
+	void UpdateResourceSets(std::unordered_set<Resource *> const &resources);
+
+	// Runs a pass of defragmentation once the copies of the previous one are finished, called by BeginFrame
+	bool UpdateDefragmentation();
+	bool BeginDefragmentationPass();
+	bool EndDefragmentationPass();
+	void EndDefragmentation();
+	static bool IsMovable(Resource *resource);
+	// Creates a resource like the given one, over the allocation it's moved to
+	std::shared_ptr<Resource> CreateMovedResource(Resource *resource, VmaAllocation vmaAlloc);
+	// The resource takes the handles of the moved one, which retires the old ones when destroyed
+	static void SwapMovedHandles(Resource *resource, Resource *moved);
+
 	// The host allocation tracker's callbacks will be called during destruction of Vulkan objects
 	// so the tracker has to appear before all those variables in the class, so it gets desroyed after them
 	std::unique_ptr<HostAllocationTrackerVk> _allocTracker;
 	vk::DebugUtilsMessengerEXT _debugUtilsMessenger;
 
+	// Every queue kind signals a timeline of its own, even when it aliases the queue of another kind
+	struct QueueTimeline {
+		TimelineSemaphoreVk _semaphore;
+		// counters reserved for the queue that weren't seen finished yet, in increasing order
+		std::deque<uint64_t> _pending;
+	};
+
 	struct QueueData {
 		vk::Queue _queue;
 		uint32_t _family = ~0;
+		vk::QueueFlags _flags;
+		// stages barriers on the queue can use
+		vk::PipelineStageFlags _stages;
+		vk::PipelineStageFlags2 _stages2;
+		QueueTimeline *_timeline = nullptr;
 	};
 
 	vk::Instance _instance;
 	vk::detail::DispatchLoaderDynamic _dynamicDispatch;
 	vk::PhysicalDevice _physDevice;
 	vk::Device _device;
-	QueueData _universalQueue;
+	QueueData _universalQueue, _computeQueue, _transferQueue;
+	// distinct families of the queues
+	std::vector<uint32_t> _queueFamilies;
 	VmaAllocator _vma = {};
-	TimelineSemaphoreVk _timelineSemaphore;
+	std::mutex _timelineMutex;
+	std::vector<std::unique_ptr<QueueTimeline>> _timelines;
+	std::atomic<uint64_t> _counter = 0;
+	// the times the completed counter was seen advancing to each value, for the latency of the frames
+	std::deque<std::pair<uint64_t, Clock::time_point>> _completedTimes;
+	static constexpr uint32_t s_maxCompletedTimes = 256;
+	// The counters a prepared submission reserved, in increasing order, the last one is its own signal value
+	struct PreparedCounters {
+		std::vector<std::pair<QueueKind, uint64_t>> _counters;
+		bool _abandoned = false;
+	};
+	// submissions that were prepared and not executed yet, in the order they were prepared in, which they execute in
+	std::deque<PreparedCounters> _prepared;
 	vk::PipelineCache _pipelineCache;
+	std::atomic<bool> _pipelineCacheDirty = false;
+	static constexpr uint64_t s_pipelineCacheSaveInterval = 1800;
+	// barriers and queue submits use VK_KHR_synchronization2 when the device supports it
+	bool _synchronization2 = false;
+	// with VK_EXT_memory_budget the budgets account for the other processes using the device
+	bool _memoryBudget = false;
+
+	struct RetiredHandle {
+		uint64_t _counter = 0;
+		vk::ObjectType _type = vk::ObjectType::eUnknown;
+		uint64_t _handle = 0;
+		VmaAllocation _vmaAlloc = {};
+	};
+	struct RetiredDescSet {
+		uint64_t _counter = 0;
+		DescSetVk _descSet;
+	};
+	std::mutex _cmdPoolsMutex;
+	// pools per thread and queue family, with one pool for each slot of the frame ring
+	std::unordered_map<std::pair<std::thread::id, uint32_t>, std::vector<std::unique_ptr<CmdPoolVk>>> _cmdPools;
+	static constexpr uint64_t s_cmdPoolIdleFrames = 120;
+
+	std::mutex _retireMutex;
+	std::vector<RetiredHandle> _retiredHandles;
+	std::vector<RetiredDescSet> _retiredDescSets;
+
+	std::mutex _resourceSetsMutex;
+	std::unordered_set<ResourceSetVk *> _resourceSets;
+
+	struct DefragMove {
+		std::shared_ptr<Resource> _resource;
+		// created over the destination, holds the resource's old handles after the swap
+		std::shared_ptr<Resource> _moved;
+	};
+	struct Defragmentation {
+		VmaDefragmentationContext _context = {};
+		VmaDefragmentationPassMoveInfo _passInfo = {};
+		bool _passActive = false;
+		// the pass can end once the timeline reaches the counter of its copies
+		uint64_t _copyCounter = 0;
+		std::vector<DefragMove> _moves;
+		// sources of the pass' moves, they can't be freed until it ends
+		std::unordered_set<VmaAllocation> _sourceAllocs;
+		uint64_t _nextFrame = 0;
+		VmaDefragmentationStats _stats = {};
+	};
+	Defragmentation _defrag;
+	// frames to wait after a defragmentation before starting another one
+	static constexpr uint64_t s_defragInterval = 600;
 };
 
 }
\ No newline at end of file
@@ -13,7 +13,7 @@ static auto s_regTypes = TypeInfo::AddInitializer("sampler_vk", [] {
 SamplerVk::~SamplerVk()
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	rhi->_device.destroySampler(_sampler, rhi->AllocCallbacks());
+	rhi->Retire(_lastUseCounter, _sampler);
 }
 
 bool SamplerVk::Init(SamplerDescriptor const &desc)
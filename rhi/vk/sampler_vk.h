@@ -13,6 +13,8 @@ struct SamplerVk final : Sampler {
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<SamplerVk>(); }
 
 	vk::Sampler _sampler;
+	// stamped by the resource sets using the sampler when their submissions are prepared
+	uint64_t _lastUseCounter = 0;
 };
 
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "rhi_vk.h"
 #include "buffer_vk.h"
 #include "texture_vk.h"
+#include "../pass.h"
 
 namespace rhi {
 
@@ -49,65 +50,208 @@ void ExecuteDataVk::Combine(ExecuteDataVk const &other)
 }
 
 
-bool SubmissionVk::InitRhi(Rhi *rhi, std::string name)
+// Stages the queue can't execute were reached on another queue, whose semaphore already made their writes visible
+static void FitToQueue(RhiVk::QueueData const &queue, ResourceStateVk &state)
 {
-	if (!Submission::InitRhi(rhi, name))
+	if (state._stages & ~queue._stages) {
+		state._stages &= queue._stages;
+		if (!state._stages) {
+			state._stages = vk::PipelineStageFlagBits::eAllCommands;
+			state._access = vk::AccessFlags();
+		}
+	}
+	if (state._stages2 & ~queue._stages2) {
+		state._stages2 &= queue._stages2;
+		if (!state._stages2) {
+			state._stages2 = vk::PipelineStageFlagBits2::eAllCommands;
+			state._access2 = vk::AccessFlags2();
+		}
+	}
+}
+
+SubmissionVk::~SubmissionVk()
+{
+	// counters reserved for a submission that's never executed still have to be signaled for the later ones to finish
+	if (_executeSignalValue && !_executed && !_abandoned)
+		static_cast<RhiVk *>(_rhi)->AbandonPrepared(_executeSignalValue);
+}
+
+bool SubmissionVk::Prepare()
+{
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	RhiVk::QueueData &queue = GetQueueData();
+	if (!_recorder.Init(rhi, queue._family))
 		return false;
-	auto rhiVk = static_cast<RhiVk*>(_rhi);
-	if (!_recorder.Init(rhiVk, rhiVk->_universalQueue._family))
+
+	// resources whose contents another family owns are released there and acquired here, in the states they're in
+	// before this submission's transitions
+	std::unordered_set<Resource *> resources;
+	bool aliasedOnOtherQueue = false;
+	for (auto &pass : _passes) {
+		pass->EnumResources([&](Resource *resource, ResourceUsage usage, ResourceView const &view) {
+			auto *resVk = Cast<ResourceVk>(resource);
+			if (!resVk || !resources.insert(resource).second)
+				return;
+			// aliased memory is handed between textures with barriers, which only order work on the same queue
+			auto *texture = Cast<TextureVk>(resource);
+			if (texture && texture->_aliased && queue._queue != rhi->_universalQueue._queue) {
+				LOG("Transient texture %s can only be used on the universal queue", texture->_name);
+				aliasedOnOtherQueue = true;
+			}
+			if (rhi->GetQueue(resVk->_ownerQueue)._family == queue._family)
+				return;
+			// contents that were never written don't have to be kept
+			if (std::all_of(resource->_states.begin(), resource->_states.end(), [](ResourceUsage state) { return state.create; }))
+				return;
+			_ownershipTransfers.push_back(OwnershipTransfer{
+				._resource = resource,
+				._srcQueue = resVk->_ownerQueue,
+				._states = resource->_states,
+			});
+		});
+	}
+	if (aliasedOnOtherQueue)
 		return false;
 
+	// the counters are reserved when preparing, so everything the passes record can be stamped with them
+	RhiVk::PreparedCounters prepared;
+	for (auto &transfer : _ownershipTransfers) {
+		uint32_t srcFamily = rhi->GetQueue(transfer._srcQueue)._family;
+		if (std::any_of(_releases.begin(), _releases.end(), [&](OwnershipRelease const &release) { return rhi->GetQueue(release._queue)._family == srcFamily; }))
+			continue;
+		_releases.push_back(OwnershipRelease{
+			._queue = transfer._srcQueue,
+			._counter = rhi->ReserveCounter(rhi->GetQueue(transfer._srcQueue)),
+		});
+		prepared._counters.push_back({ _releases.back()._queue, _releases.back()._counter });
+	}
+	_executeSignalValue = rhi->ReserveCounter(queue);
+	prepared._counters.push_back({ _queue, _executeSignalValue });
+	rhi->_prepared.push_back(std::move(prepared));
+	_recorder.SetLastUseCounter(_executeSignalValue);
+
+	if (!Submission::Prepare()) {
+		// nothing gets executed, the reserved values are signaled in turn with the other prepared submissions
+		_abandoned = true;
+		rhi->AbandonPrepared(_executeSignalValue);
+		return false;
+	}
+
+	// later submissions see the owners as of this one, Execute asserts they run in the same order
+	for (Resource *resource : _usedResources) {
+		if (auto *resVk = Cast<ResourceVk>(resource))
+			resVk->_ownerQueue = _queue;
+	}
+
 	return true;
 }
 
 bool SubmissionVk::Execute()
 {
-	ASSERT(!_executeSignalValue);
-
-	if (!Submission::Execute())
-		return false;
+	ASSERT(_executeSignalValue && !_executed && !_abandoned);
+	_executed = true;
 
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	_executeSignalValue = ++rhi->_timelineSemaphore._value;
+	// timeline values have to be signaled in increasing order, and the owners set by Prepare are only right in the
+	// same order, so submissions are executed in the order they were prepared in
+	ASSERT(rhi->_prepared.size() && rhi->_prepared.front()._counters.back().second == _executeSignalValue);
+	rhi->_prepared.pop_front();
+	RhiVk::QueueData &queue = GetQueueData();
+
+	// the passes wait for the queues that released resources to this one, and for the ones that used them last
+	std::unordered_map<RhiVk::QueueTimeline *, uint64_t> waits;
+	bool res = ReleaseOwnership(waits);
+	for (Resource *resource : _usedResources) {
+		auto *resVk = Cast<ResourceVk>(resource);
+		if (!resVk || !resVk->_lastUseCounter)
+			continue;
+		RhiVk::QueueTimeline *timeline = rhi->GetQueue(resVk->_lastUseQueue)._timeline;
+		if (timeline == queue._timeline)
+			continue;
+		uint64_t &wait = waits[timeline];
+		wait = std::max(wait, resVk->_lastUseCounter);
+	}
 
+	for (Resource *resource : _usedResources) {
+		if (auto *resVk = Cast<ResourceVk>(resource)) {
+			resVk->_lastUseCounter = _executeSignalValue;
+			resVk->_lastUseQueue = _queue;
+		}
+	}
+
+	ExecuteDataVk execWait;
+	for (auto &[timeline, counter] : waits) {
+		execWait._waitSemaphores.push_back(SemaphoreReferenceVk{
+			._semaphore = timeline->_semaphore._semaphore,
+			._stages = vk::PipelineStageFlagBits::eAllCommands,
+			._counter = counter,
+		});
+	}
+	res = res && Execute(std::move(execWait)) && AcquireOwnership() && Submission::Execute();
+
+	// the reserved value has to be signaled even on failure, or waits on later values would never finish
 	ExecuteDataVk execSignalEnd;
 	execSignalEnd._signalSemaphores.push_back(SemaphoreReferenceVk{
-		._semaphore = rhi->_timelineSemaphore._semaphore,
+		._semaphore = queue._timeline->_semaphore._semaphore,
 		._counter = _executeSignalValue,
 	});
-	if (!Execute(std::move(execSignalEnd)))
-		return false;
-	FlushToExecute();
+	res = Execute(std::move(execSignalEnd)) && res;
+	res = FlushToExecute() && res;
+	res = SubmitBatches() && res;
 
-	return true;
+	// submissions prepared after this one that won't be executed are next in turn
+	rhi->SignalAbandoned();
+
+	// samples the completion of earlier work more often than once a frame, for the latency of the frames it belongs to
+	rhi->GetCompletedCounter();
+
+	return res;
 }
 
 bool SubmissionVk::ExecuteTransitions(Pass *pass)
 {
-	ExecuteDataVk execTransitions = RecordPassTransitionCmds(pass);
+	ExecuteDataVk execTransitions;
+	auto it = _inlineTransitions.find(pass);
+	if (it != _inlineTransitions.end()) {
+		execTransitions = std::move(it->second);
+		_inlineTransitions.erase(it);
+	} else {
+		// passes without command buffers of their own get their barriers recorded in a separate one
+		execTransitions = RecordPassTransitionCmds(pass);
+	}
 	if (!Execute(std::move(execTransitions)))
 		return false;
 
 	return true;
 }
 
+bool SubmissionVk::RecordTransitions(Pass *pass, vk::CommandBuffer passCmds)
+{
+	ASSERT(!_inlineTransitions.contains(pass));
+	ExecuteDataVk execTransitions = RecordPassTransitionCmds(pass, passCmds);
+	// signals would have to follow the whole pass, none of the resource states produce them
+	ASSERT(execTransitions._signalSemaphores.empty());
+	_inlineTransitions[pass] = std::move(execTransitions);
+
+	return true;
+}
+
 bool SubmissionVk::IsFinishedExecuting()
 {
-	if (!_executeSignalValue)
+	if (!_executed)
 		return false;
-	auto rhi = static_cast<RhiVk*>(_rhi);
-	return _executeSignalValue <= rhi->_timelineSemaphore.GetCurrentCounter();
+	return _executeSignalValue <= GetQueueData()._timeline->_semaphore.GetCurrentCounter();
 }
 
 bool SubmissionVk::WaitUntilFinished()
 {
-	if (!_executeSignalValue)
+	if (!_executed)
 		return false;
 	
-	auto rhi = static_cast<RhiVk*>(_rhi);
-	bool res = rhi->_timelineSemaphore.WaitCounter(_executeSignalValue);
-	uint64_t semCounter = rhi->_timelineSemaphore.GetCurrentCounter();
-	ASSERT(semCounter <= _executeSignalValue);
+	TimelineSemaphoreVk &timeline = GetQueueData()._timeline->_semaphore;
+	bool res = timeline.WaitCounter(_executeSignalValue);
+	uint64_t semCounter = timeline.GetCurrentCounter();
+	ASSERT(!res || semCounter >= _executeSignalValue);
 	return res;
 }
 
@@ -132,97 +276,215 @@ bool SubmissionVk::Execute(vk::CommandBuffer cmds)
 
 bool SubmissionVk::FlushToExecute()
 {
-	auto rhi = static_cast<RhiVk*>(_rhi);
 	if (_toExecute._fnExecute) {
-		if (!_toExecute._fnExecute(rhi->_universalQueue))
+		// direct execution has to come after everything before it on the queue
+		if (!SubmitBatches())
+			return false;
+		if (!_toExecute._fnExecute(GetQueueData()))
 			return false;
+		_toExecute._fnExecute = nullptr;
 	}
 
-	std::vector<vk::Semaphore> waitSemaphores, signalSemaphores;
-	std::vector<vk::PipelineStageFlags> waitStages;
-	std::vector<uint64_t> waitSemValues, signalSemValues;
-	std::vector<vk::CommandBuffer> cmds;
-	for (auto &sem : _toExecute._waitSemaphores) {
-		waitSemaphores.push_back(sem._semaphore);
-		waitStages.push_back(sem._stages);
-		waitSemValues.push_back(sem._counter);
-	}
-	for (auto &sem : _toExecute._signalSemaphores) {
-		signalSemaphores.push_back(sem._semaphore);
-		signalSemValues.push_back(sem._counter);
-	}
+	if (_toExecute._waitSemaphores.size() || _toExecute._cmds.size() || _toExecute._signalSemaphores.size())
+		_batches.push_back(std::move(_toExecute));
+	_toExecute.Clear();
+
+	return true;
+}
+
+bool SubmissionVk::SubmitBatches()
+{
+	return SubmitBatches(GetQueueData(), _batches);
+}
+
+bool SubmissionVk::SubmitBatches(RhiVk::QueueData &queue, std::vector<ExecuteDataVk> &batches)
+{
+	if (batches.empty())
+		return true;
 
-	vk::TimelineSemaphoreSubmitInfo semValuesInfo{
-		waitSemValues,
-		signalSemValues,
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	if (rhi->_synchronization2)
+		return SubmitBatches2(queue, batches);
+
+	struct SubmitArrays {
+		std::vector<vk::Semaphore> _waitSemaphores, _signalSemaphores;
+		std::vector<vk::PipelineStageFlags> _waitStages;
+		std::vector<uint64_t> _waitSemValues, _signalSemValues;
+		vk::TimelineSemaphoreSubmitInfo _semValuesInfo;
 	};
-	vk::SubmitInfo submitInfo{
-		waitSemaphores,
-		waitStages,
-		_toExecute._cmds,
-		signalSemaphores, 
-		&semValuesInfo
+	std::vector<SubmitArrays> submitArrays(batches.size());
+	std::vector<vk::SubmitInfo> submitInfos;
+	uint32_t numCmdBuffers = 0;
+	for (uint32_t i = 0; i < batches.size(); ++i) {
+		ExecuteDataVk &batch = batches[i];
+		SubmitArrays &arrays = submitArrays[i];
+		for (auto &sem : batch._waitSemaphores) {
+			arrays._waitSemaphores.push_back(sem._semaphore);
+			arrays._waitStages.push_back(sem._stages);
+			arrays._waitSemValues.push_back(sem._counter);
+		}
+		for (auto &sem : batch._signalSemaphores) {
+			arrays._signalSemaphores.push_back(sem._semaphore);
+			arrays._signalSemValues.push_back(sem._counter);
+		}
+		arrays._semValuesInfo = vk::TimelineSemaphoreSubmitInfo{
+			arrays._waitSemValues,
+			arrays._signalSemValues,
+		};
+		submitInfos.push_back(vk::SubmitInfo{
+			arrays._waitSemaphores,
+			arrays._waitStages,
+			batch._cmds,
+			arrays._signalSemaphores,
+			&arrays._semValuesInfo
+		});
+		numCmdBuffers += (uint32_t)batch._cmds.size();
+	}
+
+	vk::Result res = queue._queue.submit(submitInfos);
+	rhi->CountQueueSubmit(numCmdBuffers);
+	batches.clear();
+
+	return res == vk::Result::eSuccess;
+}
+
+bool SubmissionVk::SubmitBatches2(RhiVk::QueueData &queue, std::vector<ExecuteDataVk> &batches)
+{
+	struct SubmitArrays {
+		std::vector<vk::SemaphoreSubmitInfo> _waitSemaphores, _signalSemaphores;
+		std::vector<vk::CommandBufferSubmitInfo> _cmds;
 	};
-	if (rhi->_universalQueue._queue.submit(submitInfo) != vk::Result::eSuccess)
-		return false;
+	std::vector<SubmitArrays> submitArrays(batches.size());
+	std::vector<vk::SubmitInfo2> submitInfos;
+	uint32_t numCmdBuffers = 0;
+	for (uint32_t i = 0; i < batches.size(); ++i) {
+		ExecuteDataVk &batch = batches[i];
+		SubmitArrays &arrays = submitArrays[i];
+		for (auto &sem : batch._waitSemaphores) {
+			vk::PipelineStageFlags2 stages = sem._stages2 ? sem._stages2 : vk::PipelineStageFlags2((VkPipelineStageFlags)sem._stages);
+			arrays._waitSemaphores.push_back(vk::SemaphoreSubmitInfo{
+				sem._semaphore,
+				sem._counter,
+				stages,
+			});
+		}
+		for (vk::CommandBuffer cmds : batch._cmds) {
+			arrays._cmds.push_back(vk::CommandBufferSubmitInfo{ cmds });
+		}
+		for (auto &sem : batch._signalSemaphores) {
+			arrays._signalSemaphores.push_back(vk::SemaphoreSubmitInfo{
+				sem._semaphore,
+				sem._counter,
+				vk::PipelineStageFlagBits2::eAllCommands,
+			});
+		}
+		submitInfos.push_back(vk::SubmitInfo2{
+			vk::SubmitFlags(),
+			arrays._waitSemaphores,
+			arrays._cmds,
+			arrays._signalSemaphores,
+		});
+		numCmdBuffers += (uint32_t)batch._cmds.size();
+	}
 
-	_toExecute.Clear();
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	vk::Result res = queue._queue.submit2KHR(submitInfos, nullptr, rhi->_dynamicDispatch);
+	rhi->CountQueueSubmit(numCmdBuffers);
+	batches.clear();
 
-	return true;
+	return res == vk::Result::eSuccess;
 }
 
-ExecuteDataVk SubmissionVk::RecordPassTransitionCmds(Pass *pass)
+RhiVk::QueueData &SubmissionVk::GetQueueData()
+{
+	return static_cast<RhiVk*>(_rhi)->GetQueue(_queue);
+}
+
+ExecuteDataVk SubmissionVk::RecordPassTransitionCmds(Pass *pass, vk::CommandBuffer passCmds)
 {
 	auto &transitions = _passTransitions[pass];
 
 	auto rhi = static_cast<RhiVk*>(_rhi);
+	RhiVk::QueueData &queue = GetQueueData();
 	ExecuteDataVk cmds;
 	std::vector<vk::MemoryBarrier> memoryBarriers;
 	std::vector<vk::BufferMemoryBarrier> bufferBarriers;
 	std::vector<vk::ImageMemoryBarrier> imageBarriers;
 	vk::PipelineStageFlags srcStages, dstStages;
+	// with synchronization2 every barrier keeps its own stages instead of all of them sharing the union
+	std::vector<vk::BufferMemoryBarrier2> bufferBarriers2;
+	std::vector<vk::ImageMemoryBarrier2> imageBarriers2;
 	for (ResourceTransition &transition : transitions) {
 		ASSERT(transition._prevUsage != transition._usage || transition._prevUsage.write && transition._usage.write);
 
 		auto *resourceVk = Cast<ResourceVk>(transition._resource);
 		ResourceTransitionVk transitionData = resourceVk->GetTransitionData(transition._prevUsage, transition._usage);
+		FitToQueue(queue, transitionData._srcState);
+		FitToQueue(queue, transitionData._dstState);
 		srcStages |= transitionData._srcState._stages;
 		dstStages |= transitionData._dstState._stages;
 
 		if (transitionData._srcState._semaphore._semaphore) {
 			transitionData._srcState._semaphore._stages = transitionData._dstState._stages;
+			transitionData._srcState._semaphore._stages2 = transitionData._dstState._stages2;
 			cmds._waitSemaphores.push_back(transitionData._srcState._semaphore);
+			// the semaphore wait makes the previous accesses available, the barrier only has to chain after it
+			transitionData._srcState._stages2 = transitionData._dstState._stages2;
+			transitionData._srcState._access2 = vk::AccessFlags2();
 		}
 		if (transitionData._dstState._semaphore._semaphore)
 			cmds._signalSemaphores.push_back(transitionData._dstState._semaphore);
 
 		if (TextureVk *texture = Cast<TextureVk>(transition._resource)) {
-			// image transition
-			vk::ImageSubresourceRange subResRange{
-				GetImageAspect(texture->_descriptor._format),
-				0,
-				(uint32_t)texture->_descriptor._mipLevels,
-				0,
-				std::max((uint32_t)texture->_descriptor._dimensions[3], 1u)
-			};
+			// image transition, limited to the mips and layers that change
+			vk::ImageSubresourceRange subResRange = GetViewSubresourceRange(transition._view);
+			if (rhi->_synchronization2) {
+				imageBarriers2.push_back(vk::ImageMemoryBarrier2{
+					transitionData._srcState._stages2,
+					transitionData._srcState._access2,
+					transitionData._dstState._stages2,
+					transitionData._dstState._access2,
+					transitionData._srcState._layout,
+					transitionData._dstState._layout,
+					queue._family,
+					queue._family,
+					texture->_image,
+					subResRange,
+				});
+				continue;
+			}
 			vk::ImageMemoryBarrier imgBarrier{
 				transitionData._srcState._access,
 				transitionData._dstState._access,
 				transitionData._srcState._layout,
 				transitionData._dstState._layout,
-				rhi->_universalQueue._family,
-				rhi->_universalQueue._family,
+				queue._family,
+				queue._family,
 				texture->_image,
 				subResRange,
 			};
 			imageBarriers.push_back(imgBarrier);
 		} else if (BufferVk *buffer = Cast<BufferVk>(transition._resource)) {
 			// buffer transition
+			if (rhi->_synchronization2) {
+				bufferBarriers2.push_back(vk::BufferMemoryBarrier2{
+					transitionData._srcState._stages2,
+					transitionData._srcState._access2,
+					transitionData._dstState._stages2,
+					transitionData._dstState._access2,
+					queue._family,
+					queue._family,
+					buffer->_buffer,
+					0,
+					(uint32_t)buffer->_descriptor._dimensions[0],
+				});
+				continue;
+			}
 			vk::BufferMemoryBarrier bufBarrier{
 				transitionData._srcState._access,
 				transitionData._dstState._access,
-				rhi->_universalQueue._family,
-				rhi->_universalQueue._family,
+				queue._family,
+				queue._family,
 				buffer->_buffer,
 				0,
 				(uint32_t)buffer->_descriptor._dimensions[0],
@@ -231,9 +493,29 @@ ExecuteDataVk SubmissionVk::RecordPassTransitionCmds(Pass *pass)
 		}
 	}
 
-	ASSERT(!((cmds._waitSemaphores.size() || cmds._signalSemaphores.size()) && bufferBarriers.empty() && imageBarriers.empty() && memoryBarriers.empty()));
-	if (bufferBarriers.empty() && imageBarriers.empty() && memoryBarriers.empty())
+	bool noBarriers = bufferBarriers.empty() && imageBarriers.empty() && memoryBarriers.empty() && bufferBarriers2.empty() && imageBarriers2.empty();
+	ASSERT(!((cmds._waitSemaphores.size() || cmds._signalSemaphores.size()) && noBarriers));
+	if (noBarriers)
+		return cmds;
+
+	auto recordBarriers = [&](vk::CommandBuffer cmdBuf) {
+		if (rhi->_synchronization2) {
+			vk::DependencyInfo depInfo{
+				vk::DependencyFlags(),
+				nullptr,
+				bufferBarriers2,
+				imageBarriers2,
+			};
+			cmdBuf.pipelineBarrier2KHR(depInfo, rhi->_dynamicDispatch);
+		} else {
+			cmdBuf.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags(), memoryBarriers, bufferBarriers, imageBarriers);
+		}
+	};
+
+	if (passCmds) {
+		recordBarriers(passCmds);
 		return cmds;
+	}
 
 	vk::CommandBuffer cmdBuf = _recorder.AllocCmdBuffer(vk::CommandBufferLevel::ePrimary, "X_" + pass->_name);
 	vk::CommandBufferBeginInfo beginInfo{
@@ -242,7 +524,7 @@ ExecuteDataVk SubmissionVk::RecordPassTransitionCmds(Pass *pass)
 	vk::Result res = cmdBuf.begin(beginInfo);
 	ASSERT(res == vk::Result::eSuccess);
 
-	cmdBuf.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags(), memoryBarriers, bufferBarriers, imageBarriers);
+	recordBarriers(cmdBuf);
 
 	res = cmdBuf.end();
 	ASSERT(res == vk::Result::eSuccess);
@@ -252,4 +534,134 @@ ExecuteDataVk SubmissionVk::RecordPassTransitionCmds(Pass *pass)
 	return cmds;
 }
 
+
+bool SubmissionVk::ReleaseOwnership(std::unordered_map<RhiVk::QueueTimeline *, uint64_t> &waits)
+{
+	// the release barriers go on the owning queues after the work already submitted there, one submit per queue
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	bool res = true;
+	for (auto &release : _releases) {
+		RhiVk::QueueData &srcQueue = rhi->GetQueue(release._queue);
+		uint64_t counter = release._counter;
+
+		CmdRecorderVk recorder;
+		vk::CommandBuffer cmds;
+		if (recorder.Init(rhi, srcQueue._family))
+			cmds = recorder.BeginCmds("Release_" + _name);
+		if (cmds) {
+			RecordOwnershipBarriers(cmds, &srcQueue);
+			if (!recorder.EndCmds(cmds))
+				cmds = vk::CommandBuffer();
+		}
+
+		bool submitted = false;
+		if (cmds) {
+			recorder.SetLastUseCounter(counter);
+			std::vector<ExecuteDataVk> batches(1);
+			batches[0]._cmds.push_back(cmds);
+			batches[0]._signalSemaphores.push_back(SemaphoreReferenceVk{
+				._semaphore = srcQueue._timeline->_semaphore._semaphore,
+				._counter = counter,
+			});
+			submitted = SubmitBatches(srcQueue, batches);
+		}
+		// the reserved value is signaled even without the barriers, or waits on later values would never finish
+		if (!submitted) {
+			res = false;
+			rhi->SignalCounter(srcQueue, counter);
+		}
+
+		uint64_t &wait = waits[srcQueue._timeline];
+		wait = std::max(wait, counter);
+	}
+
+	return res;
+}
+
+bool SubmissionVk::AcquireOwnership()
+{
+	if (_ownershipTransfers.empty())
+		return true;
+
+	vk::CommandBuffer cmds = _recorder.BeginCmds("Acquire_" + _name);
+	if (!cmds)
+		return false;
+	RecordOwnershipBarriers(cmds, nullptr);
+	if (!_recorder.EndCmds(cmds))
+		return false;
+
+	return Execute(cmds);
+}
+
+void SubmissionVk::RecordOwnershipBarriers(vk::CommandBuffer cmds, RhiVk::QueueData *releaseQueue)
+{
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	RhiVk::QueueData &dstQueue = GetQueueData();
+	RhiVk::QueueData &barrierQueue = releaseQueue ? *releaseQueue : dstQueue;
+	std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+	std::vector<vk::ImageMemoryBarrier> imageBarriers;
+	vk::PipelineStageFlags stages;
+	// the layouts stay the same, the transitions of the passes change them after the acquire
+	auto getAccess = [&](ResourceUsage state, vk::AccessFlags &srcAccess, vk::AccessFlags &dstAccess) {
+		ResourceStateVk barrierState{
+			._access = GetAccess(state),
+			._stages = GetPipelineStages(state),
+		};
+		FitToQueue(barrierQueue, barrierState);
+		stages |= barrierState._stages;
+		srcAccess = releaseQueue ? barrierState._access : vk::AccessFlags();
+		dstAccess = releaseQueue ? vk::AccessFlags() : barrierState._access;
+	};
+	for (auto &transfer : _ownershipTransfers) {
+		uint32_t srcFamily = rhi->GetQueue(transfer._srcQueue)._family;
+		if (releaseQueue && srcFamily != releaseQueue->_family)
+			continue;
+		vk::AccessFlags srcAccess, dstAccess;
+		if (TextureVk *texture = Cast<TextureVk>(transfer._resource)) {
+			// consecutive mips of a layer in the same state share a barrier
+			uint32_t numMips = texture->GetNumMips();
+			for (uint32_t sub = 0; sub < transfer._states.size(); ) {
+				ResourceUsage state = transfer._states[sub];
+				uint32_t end = sub + 1;
+				while (end < transfer._states.size() && end % numMips && transfer._states[end] == state)
+					++end;
+				if (!state.create) {
+					getAccess(state, srcAccess, dstAccess);
+					imageBarriers.push_back(vk::ImageMemoryBarrier{
+						srcAccess,
+						dstAccess,
+						GetImageLayout(state),
+						GetImageLayout(state),
+						srcFamily,
+						dstQueue._family,
+						texture->_image,
+						vk::ImageSubresourceRange{ GetImageAspect(texture->_descriptor._format), sub % numMips, end - sub, sub / numMips, 1 },
+					});
+				}
+				sub = end;
+			}
+		} else if (BufferVk *buffer = Cast<BufferVk>(transfer._resource)) {
+			getAccess(transfer._states[0], srcAccess, dstAccess);
+			bufferBarriers.push_back(vk::BufferMemoryBarrier{
+				srcAccess,
+				dstAccess,
+				srcFamily,
+				dstQueue._family,
+				buffer->_buffer,
+				0,
+				vk::WholeSize,
+			});
+		}
+	}
+
+	if (bufferBarriers.empty() && imageBarriers.empty())
+		return;
+	cmds.pipelineBarrier(
+		releaseQueue ? stages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe),
+		releaseQueue ? vk::PipelineStageFlags(vk::PipelineStageFlagBits::eBottomOfPipe) : stages,
+		vk::DependencyFlags(),
+		nullptr,
+		bufferBarriers,
+		imageBarriers);
+}
 }
\ No newline at end of file
@@ -20,11 +20,14 @@ struct ExecuteDataVk {
 };
 
 struct SubmissionVk final : Submission {
-	bool InitRhi(Rhi *rhi, std::string name) override;
+	~SubmissionVk() override;
 
+	bool Prepare() override;
 	bool Execute() override;
 
 	bool ExecuteTransitions(Pass *pass) override;
+	// Records the pass's barriers at the start of its own command buffer, so they don't need a separate one
+	bool RecordTransitions(Pass *pass, vk::CommandBuffer passCmds);
 
 	bool IsFinishedExecuting() override;
 	bool WaitUntilFinished() override;
@@ -32,14 +35,47 @@ struct SubmissionVk final : Submission {
 	bool Execute(ExecuteDataVk &&execute);
 	bool Execute(vk::CommandBuffer cmds);
 	bool FlushToExecute();
+	bool SubmitBatches();
+	bool SubmitBatches(RhiVk::QueueData &queue, std::vector<ExecuteDataVk> &batches);
+	bool SubmitBatches2(RhiVk::QueueData &queue, std::vector<ExecuteDataVk> &batches);
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<SubmissionVk>(); }
 
-	ExecuteDataVk RecordPassTransitionCmds(Pass *pass);
+	RhiVk::QueueData &GetQueueData();
+
+	ExecuteDataVk RecordPassTransitionCmds(Pass *pass, vk::CommandBuffer passCmds = vk::CommandBuffer());
+
+	// Submits the release barriers on the queues that own the transferred resources, adding the counters they signal to the waits
+	bool ReleaseOwnership(std::unordered_map<RhiVk::QueueTimeline *, uint64_t> &waits);
+	bool AcquireOwnership();
+	// Release barriers for the resources owned by the queue's family, or acquire barriers for all of them without one
+	void RecordOwnershipBarriers(vk::CommandBuffer cmds, RhiVk::QueueData *releaseQueue);
+
+	// A resource whose contents are owned by another queue family, with its states before the submission
+	struct OwnershipTransfer {
+		Resource *_resource = nullptr;
+		QueueKind _srcQueue = QueueKind::Universal;
+		std::vector<ResourceUsage> _states;
+	};
+	// The release barriers submitted to a source family, with the counter reserved for them
+	struct OwnershipRelease {
+		QueueKind _queue = QueueKind::Universal;
+		uint64_t _counter = 0;
+	};
 
 	CmdRecorderVk _recorder;
 	ExecuteDataVk _toExecute;
+	// stages that couldn't be combined, they're submitted together with a single queue submit
+	std::vector<ExecuteDataVk> _batches;
+	// the semaphores of transitions already recorded in the passes' command buffers
+	std::unordered_map<Pass *, ExecuteDataVk> _inlineTransitions;
+	std::vector<OwnershipTransfer> _ownershipTransfers;
+	std::vector<OwnershipRelease> _releases;
+	// reserved by Prepare, signaled on the submission's queue when it finishes executing
 	uint64_t _executeSignalValue = 0;
+	bool _executed = false;
+	// failed preparing, the reserved counters are signaled without executing it
+	bool _abandoned = false;
 };
 
 }
\ No newline at end of file
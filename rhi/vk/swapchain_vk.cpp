@@ -13,10 +13,13 @@ static auto s_regTypes = TypeInfo::AddInitializer("swapchain_vk", [] {
 
 SwapchainVk::~SwapchainVk()
 {
+	auto rhi = static_cast<RhiVk*>(_rhi);
+	// the swapchain and its semaphores are destroyed right away, so frames still in flight have to finish first
+	rhi->WaitIdle();
+
 	_images.clear();
 	DestroySemaphores();
 
-	auto rhi = static_cast<RhiVk*>(_rhi);
 	rhi->_device.destroySwapchainKHR(_swapchain, rhi->AllocCallbacks());
 	rhi->_instance.destroySurfaceKHR(_surface, rhi->AllocCallbacks());
 }
@@ -132,6 +135,7 @@ bool SwapchainVk::Update(glm::ivec2 surfaceSize, PresentMode presentMode, Format
 	if (!_needsUpdate && _descriptor._dimensions == newDims && presentMode == _descriptor._presentMode && surfaceFormat == _descriptor._format)
 		return true;
 
+	rhi->WaitIdle();
 	_images.clear();
 	DestroySemaphores();
 
@@ -213,13 +217,22 @@ bool SwapchainVk::CreateSemaphores(uint32_t num)
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
 
-	for (uint32_t i = 0; i < num; ++i) {
-		vk::SemaphoreCreateInfo semInfo{};
-		auto semRes = rhi->_device.createSemaphore(semInfo, rhi->AllocCallbacks());
-		if (semRes.result != vk::Result::eSuccess)
-			return false;
-		_acquireSemaphores.push_back(semRes.value);
-	}
+	auto createSemaphores = [&](uint32_t count, std::vector<vk::Semaphore> &semaphores) {
+		for (uint32_t i = 0; i < count; ++i) {
+			vk::SemaphoreCreateInfo semInfo{};
+			auto semRes = rhi->_device.createSemaphore(semInfo, rhi->AllocCallbacks());
+			if (semRes.result != vk::Result::eSuccess)
+				return false;
+			semaphores.push_back(semRes.value);
+		}
+		return true;
+	};
+
+	if (!createSemaphores(num, _acquireSemaphores))
+		return false;
+	// presenting an image waits for the semaphore of its index, signaled after the work that rendered it
+	if (!createSemaphores((uint32_t)_images.size(), _presentSemaphores))
+		return false;
 
 	return true;
 }
@@ -231,6 +244,10 @@ void SwapchainVk::DestroySemaphores()
 		rhi->_device.destroySemaphore(sem, rhi->AllocCallbacks());
 	}
 	_acquireSemaphores.clear();
+	for (auto sem : _presentSemaphores) {
+		rhi->_device.destroySemaphore(sem, rhi->AllocCallbacks());
+	}
+	_presentSemaphores.clear();
 }
 
 std::shared_ptr<Texture> SwapchainVk::AcquireNextImage()
@@ -254,7 +271,9 @@ std::shared_ptr<Texture> SwapchainVk::AcquireNextImage()
 	// then put the extra semaphore at the index of the image
 	std::swap(_acquireSemaphores[imgIndex], _acquireSemaphores.back());
 	ASSERT(imgIndex < _images.size());
-	_images[imgIndex]->_state = _images[imgIndex]->_state & ResourceUsage{ .create = 1 } | ResourceUsage{ .present = 1, .write = 1 };
+	for (auto &state : _images[imgIndex]->_states) {
+		state = state & ResourceUsage{ .create = 1 } | ResourceUsage{ .present = 1, .write = 1 };
+	}
 	return _images[imgIndex];
 }
 
@@ -24,6 +24,7 @@ struct SwapchainVk final : Swapchain {
 	vk::SurfaceKHR _surface;
 	vk::SwapchainKHR _swapchain;
 	std::vector<vk::Semaphore> _acquireSemaphores;
+	std::vector<vk::Semaphore> _presentSemaphores;
 	bool _needsUpdate = false;
 };
 
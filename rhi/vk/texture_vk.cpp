@@ -19,6 +19,9 @@ vk::ImageCreateFlags GetImageCreateFlags(ResourceDescriptor const &desc)
 		flags |= vk::ImageCreateFlagBits::eCubeCompatible;
 	if (GetImageType(desc._dimensions) == vk::ImageType::e3D)
 		flags |= vk::ImageCreateFlagBits::e2DArrayCompatible;
+	// srgb formats can't be storage images, the shaders write them through views with the linear format
+	if (desc._usage.uav && IsSrgb(desc._format))
+		flags |= vk::ImageCreateFlagBits::eMutableFormat | vk::ImageCreateFlagBits::eExtendedUsage;
 	return flags;
 }
 
@@ -98,45 +101,79 @@ vk::ImageLayout GetImageLayout(ResourceUsage usage)
 TextureVk::~TextureVk()
 {
 	auto rhi = static_cast<RhiVk*>(_rhi);
-	rhi->_device.destroyImageView(_view, rhi->AllocCallbacks());
 	if (_vmaAlloc) {
-		vmaDestroyImage(rhi->_vma, _image, _vmaAlloc);
+		VmaAllocationInfo allocInfo;
+		vmaGetAllocationInfo(rhi->_vma, _vmaAlloc, &allocInfo);
+		rhi->CountResourceMemory(Rhi::GetResourceKind(_descriptor._usage), -1, -(int64_t)allocInfo.size);
+	}
+	rhi->Retire(_lastUseCounter, _view);
+	// images without an allocation belong to a swapchain, aliased ones don't own their memory
+	if (_vmaAlloc || _aliased) {
+		rhi->Retire(_lastUseCounter, _image, _vmaAlloc);
 	}
 }
 
-vk::ImageLayout TextureVk::GetInitialLayout() const
+vk::ImageLayout TextureVk::GetInitialLayout(ResourceDescriptor const &desc)
 {
-	if (_descriptor._usage.cpuAccess && _descriptor._usage.copySrc)
+	if (desc._usage.cpuAccess && desc._usage.copySrc)
 		return vk::ImageLayout::ePreinitialized;
 	// to do: choose a concrete layout
 	return vk::ImageLayout::eUndefined;
 }
 
 
-bool TextureVk::Init(ResourceDescriptor const &desc)
+vk::ImageCreateInfo TextureVk::GetImageCreateInfo(RhiVk *rhi, ResourceDescriptor const &desc)
 {
-	if (!Texture::Init(desc))
-		return false;
-	auto rhi = static_cast<RhiVk*>(_rhi); 
-	auto queueFamilies = rhi->GetQueueFamilyIndices(_descriptor._usage);
+	auto queueFamilies = rhi->GetQueueFamilyIndices(desc._usage);
 	vk::ImageCreateInfo imgInfo{
-		GetImageCreateFlags(_descriptor),
-		GetImageType(_descriptor._dimensions),
-		s_vk2Format.ToSrc(_descriptor._format, vk::Format::eUndefined),
-		GetExtent3D(_descriptor._dimensions),
-		(uint32_t)_descriptor._mipLevels,
-		glm::max((uint32_t)_descriptor._dimensions[3], 1u),
+		GetImageCreateFlags(desc),
+		GetImageType(desc._dimensions),
+		s_vk2Format.ToSrc(desc._format, vk::Format::eUndefined),
+		GetExtent3D(desc._dimensions),
+		(uint32_t)desc._mipLevels,
+		glm::max((uint32_t)desc._dimensions[3], 1u),
 		vk::SampleCountFlagBits::e1,
-		GetImageTiling(_descriptor._usage),
-		GetImageUsage(_descriptor._usage, _descriptor._format),
+		GetImageTiling(desc._usage),
+		GetImageUsage(desc._usage, desc._format),
 		vk::SharingMode::eExclusive,
 		(uint32_t)queueFamilies.size(),
 		queueFamilies.data(),
-		GetInitialLayout(),
+		GetInitialLayout(desc),
 	};
+	return imgInfo;
+}
+
+bool TextureVk::Init(ResourceDescriptor const &desc)
+{
+	if (!Texture::Init(desc))
+		return false;
+	auto rhi = static_cast<RhiVk*>(_rhi); 
+	vk::ImageCreateInfo imgInfo = GetImageCreateInfo(rhi, _descriptor);
 	VmaAllocationCreateInfo allocInfo = rhi->GetVmaAllocCreateInfo(this);
-	if ((vk::Result)vmaCreateImage(rhi->_vma, (VkImageCreateInfo *)&imgInfo, &allocInfo, (VkImage *)&_image, &_vmaAlloc, nullptr) != vk::Result::eSuccess)
+	VmaAllocationInfo allocResult;
+	if ((vk::Result)vmaCreateImage(rhi->_vma, (VkImageCreateInfo *)&imgInfo, &allocInfo, (VkImage *)&_image, &_vmaAlloc, &allocResult) != vk::Result::eSuccess)
 		return false;
+	rhi->CountResourceMemory(Rhi::GetResourceKind(_descriptor._usage), 1, allocResult.size);
+
+	rhi->SetDebugName(vk::ObjectType::eImage, (uint64_t)(VkImage)_image, _name.c_str());
+	rhi->SetDebugName(_vmaAlloc, _name.c_str());
+
+	_view = CreateView(ResourceView::FromDescriptor(_descriptor, 0));
+	if (!_view)
+		return false;
+
+	return true;
+}
+
+bool TextureVk::Init(ResourceDescriptor const &desc, VmaAllocation vmaAlloc, vk::DeviceSize offset)
+{
+	if (!Texture::Init(desc))
+		return false;
+	auto rhi = static_cast<RhiVk*>(_rhi); 
+	vk::ImageCreateInfo imgInfo = GetImageCreateInfo(rhi, _descriptor);
+	if ((vk::Result)vmaCreateAliasingImage2(rhi->_vma, vmaAlloc, offset, (VkImageCreateInfo *)&imgInfo, (VkImage *)&_image) != vk::Result::eSuccess)
+		return false;
+	_aliased = true;
 
 	rhi->SetDebugName(vk::ObjectType::eImage, (uint64_t)(VkImage)_image, _name.c_str());
 
@@ -176,8 +213,18 @@ ResourceStateVk TextureVk::GetState(ResourceUsage usage)
 	ResourceStateVk state;
 	state._access = GetAccess(usage);
 	state._stages = GetPipelineStages(usage);
+	state._access2 = GetAccess2(usage);
+	state._stages2 = GetPipelineStages2(usage);
 	state._layout = usage.create ? GetInitialLayout() : GetImageLayout(usage);
 
+	if (usage.create && _aliased) {
+		// the memory may have been used by another texture, whatever it did has to finish before this texture's first use
+		state._access = vk::AccessFlagBits::eMemoryWrite;
+		state._stages = vk::PipelineStageFlagBits::eAllCommands;
+		state._access2 = vk::AccessFlagBits2::eMemoryWrite;
+		state._stages2 = vk::PipelineStageFlagBits2::eAllCommands;
+	}
+
 	if (usage.present && usage.write) {
 		// present acquired, need to wait for the image's swapchain semaphore
 		auto swapchain = Cast<SwapchainVk>(_owner.lock());
@@ -202,6 +249,10 @@ vk::ImageView TextureVk::CreateView(ResourceView const &view)
 		vk::ComponentMapping{vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity},
 		GetViewSubresourceRange(view),
 	};
+	// views of storage images inherit the storage usage, drop it for formats that can't be storage images
+	vk::ImageViewUsageCreateInfo usageInfo{ GetImageUsage(_descriptor._usage, _descriptor._format) & ~vk::ImageUsageFlagBits::eStorage };
+	if (_descriptor._usage.uav && !(rhi->GetFormatFeatures(view._format, _descriptor._usage) & vk::FormatFeatureFlagBits::eStorageImage))
+		viewInfo.pNext = &usageInfo;
 	vk::ImageView imgView;
 	if (rhi->_device.createImageView(&viewInfo, rhi->AllocCallbacks(), &imgView) != vk::Result::eSuccess)
 		return vk::ImageView();
@@ -10,6 +10,10 @@ struct TextureVk final : Texture, ResourceVk {
 
 	bool Init(ResourceDescriptor const &desc) override;
 	bool Init(vk::Image image, ResourceDescriptor &desc, RhiOwned *owner);
+	// Creates the image over an allocation other images may share, see TransientHeapVk
+	bool Init(ResourceDescriptor const &desc, VmaAllocation vmaAlloc, vk::DeviceSize offset);
+
+	static vk::ImageCreateInfo GetImageCreateInfo(RhiVk *rhi, ResourceDescriptor const &desc);
 
 	ResourceTransitionVk GetTransitionData(ResourceUsage prevUsage, ResourceUsage usage) override;
 	ResourceStateVk GetState(ResourceUsage usage);
@@ -18,7 +22,8 @@ struct TextureVk final : Texture, ResourceVk {
 
 	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<TextureVk>(); }
 
-	vk::ImageLayout GetInitialLayout() const;
+	vk::ImageLayout GetInitialLayout() const { return GetInitialLayout(_descriptor); }
+	static vk::ImageLayout GetInitialLayout(ResourceDescriptor const &desc);
 
 	vk::Image _image;
 	VmaAllocation _vmaAlloc = {};
@@ -0,0 +1,157 @@
+#include "transient_heap_vk.h"
+#include "rhi_vk.h"
+#include "texture_vk.h"
+#include "utl/mathutl.h"
+
+namespace rhi {
+
+static auto s_regTypes = TypeInfo::AddInitializer("transient_heap_vk", [] {
+	TypeInfo::Register<TransientHeapVk>().Name("TransientHeapVk")
+		.Base<TransientHeap>()
+		.Metadata(RhiOwned::s_rhiTagType, TypeInfo::Get<RhiVk>());
+});
+
+
+TransientHeapVk::~TransientHeapVk()
+{
+	// textures still referenced elsewhere don't use the memory after the work already submitted
+	auto rhi = static_cast<RhiVk *>(_rhi);
+	_textures.clear();
+	for (auto &block : _blocks) {
+		rhi->CountResourceMemory(Rhi::ResourceKind::Transient, -1, -(int64_t)block._size);
+		rhi->Retire(rhi->GetLastSubmittedCounter(), vk::ObjectType::eUnknown, 0, block._vmaAlloc);
+	}
+}
+
+std::shared_ptr<Texture> TransientHeapVk::CreateTexture(ResourceDescriptor const &desc, std::string name)
+{
+	ResourceDescriptor texDesc = desc;
+	if (texDesc._mipLevels == 0)
+		texDesc.SetMaxMipLevels();
+	ASSERT(!texDesc._usage.cpuAccess);
+
+	vk::MemoryRequirements memReqs = GetMemoryRequirements(texDesc);
+	if (!memReqs.size)
+		return nullptr;
+	Placement placement = Place(memReqs, nullptr);
+	if (placement._block == ~0u)
+		return nullptr;
+
+	// the same textures get the same placements from frame to frame, so they can be reused with their views
+	std::shared_ptr<TextureVk> texture;
+	for (auto &cached : _textures) {
+		if (cached._live || cached._placement != placement || cached._texture->_descriptor != texDesc)
+			continue;
+		texture = cached._texture;
+		texture->SetState(ResourceUsage{ .create = 1 });
+		cached._live = true;
+		cached._lastFrame = _frame;
+		break;
+	}
+	if (!texture) {
+		texture = _rhi->Create<TextureVk>(name);
+		if (!texture || !texture->Init(texDesc, _blocks[placement._block]._vmaAlloc, placement._offset)) {
+			_blocks[placement._block]._live.pop_back();
+			return nullptr;
+		}
+		_textures.push_back(CachedTexture{
+			._texture = texture,
+			._placement = placement,
+			._lastFrame = _frame,
+			._live = true,
+		});
+	}
+	_blocks[placement._block]._live.back()._texture = texture.get();
+
+	return texture;
+}
+
+void TransientHeapVk::Release(Texture *texture)
+{
+	for (auto &block : _blocks) {
+		std::erase_if(block._live, [&](Range const &range) { return range._texture == texture; });
+	}
+	for (auto &cached : _textures) {
+		if (cached._texture.get() == texture)
+			cached._live = false;
+	}
+}
+
+void TransientHeapVk::Reset()
+{
+	for (auto &block : _blocks) {
+		block._live.clear();
+	}
+	++_frame;
+	std::erase_if(_textures, [&](CachedTexture &cached) {
+		cached._live = false;
+		return cached._lastFrame + s_keepFrames < _frame;
+	});
+}
+
+vk::MemoryRequirements TransientHeapVk::GetMemoryRequirements(ResourceDescriptor const &desc)
+{
+	for (auto &[reqDesc, memReqs] : _memRequirements) {
+		if (reqDesc == desc)
+			return memReqs;
+	}
+
+	// an image that's never bound gives the requirements for all the textures with the same descriptor
+	auto rhi = static_cast<RhiVk *>(_rhi);
+	vk::ImageCreateInfo imgInfo = TextureVk::GetImageCreateInfo(rhi, desc);
+	vk::Image image;
+	if (rhi->_device.createImage(&imgInfo, rhi->AllocCallbacks(), &image) != vk::Result::eSuccess)
+		return vk::MemoryRequirements();
+	vk::MemoryRequirements memReqs = rhi->_device.getImageMemoryRequirements(image);
+	rhi->_device.destroyImage(image, rhi->AllocCallbacks());
+
+	_memRequirements.push_back({ desc, memReqs });
+	return memReqs;
+}
+
+auto TransientHeapVk::Place(vk::MemoryRequirements const &memReqs, Texture *texture) -> Placement
+{
+	// first fit in the gaps between the live textures of the blocks with a suitable memory type
+	for (uint32_t b = 0; b < _blocks.size(); ++b) {
+		Block &block = _blocks[b];
+		if (!(memReqs.memoryTypeBits & (1u << block._memoryType)))
+			continue;
+		std::sort(block._live.begin(), block._live.end(), [](Range const &r0, Range const &r1) {
+			return r0._offset < r1._offset;
+		});
+		vk::DeviceSize offset = 0;
+		bool placed = false;
+		for (auto &range : block._live) {
+			if (utl::RoundUp(offset, memReqs.alignment) + memReqs.size <= range._offset) {
+				placed = true;
+				break;
+			}
+			offset = std::max(offset, range._offset + range._size);
+		}
+		offset = utl::RoundUp(offset, memReqs.alignment);
+		if (!placed && offset + memReqs.size > block._size)
+			continue;
+		block._live.push_back(Range{ ._offset = offset, ._size = memReqs.size, ._texture = texture });
+		return Placement{ ._block = b, ._offset = offset };
+	}
+
+	auto rhi = static_cast<RhiVk *>(_rhi);
+	VkMemoryRequirements blockReqs = memReqs;
+	blockReqs.size = std::max(memReqs.size, s_minBlockSize);
+	VmaAllocationCreateInfo allocInfo{
+		.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	};
+	Block block;
+	VmaAllocationInfo blockInfo;
+	if ((vk::Result)vmaAllocateMemory(rhi->_vma, &blockReqs, &allocInfo, &block._vmaAlloc, &blockInfo) != vk::Result::eSuccess)
+		return Placement();
+	block._memoryType = blockInfo.memoryType;
+	block._size = blockReqs.size;
+	rhi->CountResourceMemory(Rhi::ResourceKind::Transient, 1, block._size);
+	block._live.push_back(Range{ ._offset = 0, ._size = memReqs.size, ._texture = texture });
+	_blocks.push_back(std::move(block));
+
+	return Placement{ ._block = (uint32_t)_blocks.size() - 1, ._offset = 0 };
+}
+
+}
\ No newline at end of file
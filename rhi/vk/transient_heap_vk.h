@@ -0,0 +1,56 @@
+#pragma once
+
+#include "base_vk.h"
+#include "../resource.h"
+
+namespace rhi {
+
+struct TextureVk;
+
+struct TransientHeapVk final : TransientHeap {
+	~TransientHeapVk() override;
+
+	std::shared_ptr<Texture> CreateTexture(ResourceDescriptor const &desc, std::string name) override;
+	void Release(Texture *texture) override;
+	void Reset() override;
+
+	TypeInfo const *GetTypeInfo() const override { return TypeInfo::Get<TransientHeapVk>(); }
+
+	struct Range {
+		vk::DeviceSize _offset = 0, _size = 0;
+		Texture *_texture = nullptr;
+	};
+	struct Block {
+		VmaAllocation _vmaAlloc = {};
+		uint32_t _memoryType = ~0u;
+		vk::DeviceSize _size = 0;
+		// memory used by the textures that weren't released yet
+		std::vector<Range> _live;
+	};
+	struct Placement {
+		uint32_t _block = ~0u;
+		vk::DeviceSize _offset = 0;
+		bool operator==(Placement const &other) const = default;
+	};
+	struct CachedTexture {
+		std::shared_ptr<TextureVk> _texture;
+		Placement _placement;
+		uint64_t _lastFrame = 0;
+		bool _live = false;
+	};
+
+	vk::MemoryRequirements GetMemoryRequirements(ResourceDescriptor const &desc);
+	Placement Place(vk::MemoryRequirements const &memReqs, Texture *texture);
+
+	std::vector<Block> _blocks;
+	std::vector<CachedTexture> _textures;
+	std::vector<std::pair<ResourceDescriptor, vk::MemoryRequirements>> _memRequirements;
+	uint64_t _frame = 0;
+
+	// blocks are allocated at least this large, so smaller textures can share them
+	static constexpr vk::DeviceSize s_minBlockSize = 32 * 1024 * 1024;
+	// textures that weren't placed for this many frames are dropped
+	static constexpr uint64_t s_keepFrames = 8;
+};
+
+}
\ No newline at end of file
@@ -99,6 +99,22 @@ size_t GetHash(Type const &val, size_t prevHash = 0)
 	return 31 * prevHash + std::hash<Type>()(val);
 }
 
+// FNV-1a, unlike std::hash it's the same across runs and platforms, so it can key data kept on disk
+inline uint64_t GetStableHash(std::span<uint8_t const> data, uint64_t prevHash = 0xcbf29ce484222325ull)
+{
+	uint64_t hash = prevHash;
+	for (uint8_t b : data) {
+		hash ^= b;
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+inline uint64_t GetStableHash(std::string_view str, uint64_t prevHash = 0xcbf29ce484222325ull)
+{
+	return GetStableHash(std::span((uint8_t const *)str.data(), str.size()), prevHash);
+}
+
 } // utl
 
 namespace std {
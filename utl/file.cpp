@@ -1,6 +1,7 @@
 #include "file.h"
 #include <fstream>
 #include <filesystem>
+#include <thread>
 
 namespace utl {
 
@@ -23,6 +24,38 @@ std::vector<uint8_t> ReadFile(std::string const &path)
 	return contents;
 }
 
+bool WriteFile(std::string const &path, std::span<uint8_t const> contents)
+{
+	std::error_code err;
+	std::filesystem::path dir = std::filesystem::path(path).parent_path();
+	if (!dir.empty())
+		std::filesystem::create_directories(dir, err);
+
+	// concurrent writes of the same file each go through their own temporary one
+	static std::atomic<uint32_t> s_tmpIndex = 0;
+	std::string tmpPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "." + std::to_string(s_tmpIndex++) + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			LOG("Failed to write file %s", tmpPath);
+			return false;
+		}
+		file.write(reinterpret_cast<char const *>(contents.data()), contents.size());
+		if (!file.good()) {
+			LOG("Failed to write file %s", tmpPath);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(tmpPath, path, err);
+	if (err) {
+		LOG("Failed to replace file %s", path);
+		std::filesystem::remove(tmpPath, err);
+		return false;
+	}
+	return true;
+}
+
 std::string GetPathDir(std::string path)
 {
 	return std::filesystem::path(path).parent_path().string();
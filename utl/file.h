@@ -3,6 +3,8 @@
 namespace utl {
 
 std::vector<uint8_t> ReadFile(std::string const &path);
+// Writes to a temporary file that replaces the destination, so readers never see a partial file
+bool WriteFile(std::string const &path, std::span<uint8_t const> contents);
 
 std::string GetPathDir(std::string path);
 std::string GetPathFilenameExt(std::string path);
@@ -0,0 +1,92 @@
+#include "thread_pool.h"
+
+namespace utl {
+
+ThreadPool::ThreadPool(uint32_t numThreads)
+{
+	if (!numThreads)
+		numThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	for (uint32_t i = 0; i < numThreads; ++i) {
+		_threads.emplace_back([this] { WorkerFunc(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		auto lock = std::unique_lock(_mutex);
+		_stopping = true;
+	}
+	_tasksCond.notify_all();
+	for (auto &thread : _threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::Run(Task task)
+{
+	{
+		auto lock = std::unique_lock(_mutex);
+		_tasks.push_back(std::move(task));
+	}
+	_tasksCond.notify_one();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, std::function<void(uint32_t)> fn)
+{
+	if (!count)
+		return;
+
+	// helper tasks may only get to run after all indices are done, so the shared state has to outlive this call
+	struct ForData {
+		std::function<void(uint32_t)> _fn;
+		uint32_t _count = 0;
+		std::atomic<uint32_t> _nextIndex = 0;
+		std::atomic<uint32_t> _numDone = 0;
+		std::mutex _doneMutex;
+		std::condition_variable _doneCond;
+	};
+	auto data = std::make_shared<ForData>();
+	data->_fn = std::move(fn);
+	data->_count = count;
+
+	// indices are claimed one at a time, so uneven work gets balanced between the threads
+	auto runIndices = [data] {
+		uint32_t done = 0;
+		for (uint32_t i = data->_nextIndex++; i < data->_count; i = data->_nextIndex++) {
+			data->_fn(i);
+			++done;
+		}
+		if (done && data->_numDone.fetch_add(done) + done == data->_count) {
+			auto lock = std::unique_lock(data->_doneMutex);
+			data->_doneCond.notify_all();
+		}
+	};
+
+	uint32_t numHelpers = std::min(GetNumThreads(), count - 1);
+	for (uint32_t i = 0; i < numHelpers; ++i) {
+		Run(runIndices);
+	}
+	runIndices();
+
+	auto lock = std::unique_lock(data->_doneMutex);
+	data->_doneCond.wait(lock, [&] { return data->_numDone == count; });
+}
+
+void ThreadPool::WorkerFunc()
+{
+	while (true) {
+		Task task;
+		{
+			auto lock = std::unique_lock(_mutex);
+			_tasksCond.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+			if (_tasks.empty())
+				return;
+			task = std::move(_tasks.front());
+			_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+}
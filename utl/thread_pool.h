@@ -0,0 +1,31 @@
+#pragma once
+
+#include <thread>
+#include <condition_variable>
+
+namespace utl {
+
+struct ThreadPool {
+	using Task = std::function<void()>;
+
+	// with no thread count given, one worker is started per hardware thread besides the calling one
+	ThreadPool(uint32_t numThreads = 0);
+	~ThreadPool();
+
+	uint32_t GetNumThreads() const { return (uint32_t)_threads.size(); }
+
+	void Run(Task task);
+
+	// Runs fn(i) for each i in [0, count) on the workers and the calling thread, returns once all of them are done
+	void ParallelFor(uint32_t count, std::function<void(uint32_t)> fn);
+
+	void WorkerFunc();
+
+	std::mutex _mutex;
+	std::condition_variable _tasksCond;
+	std::deque<Task> _tasks;
+	std::vector<std::thread> _threads;
+	bool _stopping = false;
+};
+
+}